@@ -242,6 +242,10 @@ int main(int argc, char **argv) {
   runtimedef::set("ADDNLL_RECURSIVE", 1);
   runtimedef::set("ADDNLL_GAUSSNLL", 1);
   runtimedef::set("ADDNLL_HISTNLL", 1);
+  runtimedef::set("ADDNLL_CBNLL", 1);
+  runtimedef::set("ADDNLL_BINNED_FASTPATH", 1);
+  runtimedef::set("ADDNLL_HIST_INPLACE", 1);
+  runtimedef::set("SIMNLL_FASTCONSTRAINTS", 1);
   runtimedef::set("TMCSO_AdaptivePseudoAsimov", 1);
 
   for (vector<string>::const_iterator rtdp = runtimeDefines.begin(), endrtdp = runtimeDefines.end(); rtdp != endrtdp; ++rtdp) {
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <map>
+#include <deque>
 #include <RooAbsPdf.h>
 #include <RooAddPdf.h>
 #include <RooRealSumPdf.h>
@@ -15,29 +16,68 @@
 #include <RooGaussian.h>
 #include <RooProduct.h>
 #include "../interface/SimpleGaussianConstraint.h"
+#include "../interface/FastConstraintTerms.h"
 #include <boost/ptr_container/ptr_vector.hpp>
 
 class RooMultiPdf;
+class SimpleThreadPool;
 
 // Part zero: ArgSet checker
 namespace cacheutils {
+    /// Flat copy of the values of a set of parameters (real variables, then category indices).
+    /// It is refreshed by its owner with sync() at the beginning of an evaluation, during which
+    /// the parameters must not change, and invalidated at the end; while valid, the ArgSetCheckers
+    /// bound to it read the values from here instead of calling getVal() on each parameter
+    class ParamMirror {
+        public:
+            ParamMirror() : valid_(false) {}
+            void setup(const std::vector<RooRealVar *> &vars, const std::vector<RooAbsCategory *> &cats) ;
+            /// position of arg in values(), or -1 if it's not mirrored
+            int  indexOf(const RooAbsArg *arg) const ;
+            void sync() ;
+            void invalidate() { valid_ = false; }
+            bool valid() const { return valid_; }
+            const double * values() const { return values_.empty() ? 0 : &values_[0]; }
+            unsigned int size() const { return values_.size(); }
+        private:
+            std::vector<RooRealVar *>     vars_;
+            std::vector<RooAbsCategory *> cats_;
+            std::vector<double>           values_;
+            std::map<const RooAbsArg *, int> index_;
+            bool valid_;
+    };
+
     class ArgSetChecker {
         public:
-            ArgSetChecker() {}
+            ArgSetChecker() : mirror_(0) {}
             ArgSetChecker(const RooAbsCollection &set) ;
             bool changed(bool updateIfChanged=false) ;
+            /// number of values (real variables and categories)
+            unsigned int size() const { return vals_.size(); }
+            /// current values of the variables, followed by the indices of the categories
+            void values(std::vector<double> &out) const ;
+            /// the same, as of the last call of changed(true) (or of the construction)
+            const std::vector<double> & lastValues() const { return vals_; }
+            /// take the values from mirror whenever it's valid (if it contains all the parameters, otherwise it's ignored)
+            void bind(const ParamMirror *mirror) ;
         private:
             std::vector<RooRealVar *> vars_;
-            std::vector<double> vals_;
             std::vector<RooCategory *> cats_;
-            std::vector<int> states_;
+            std::vector<double> vals_; // values of vars_, followed by the indices of cats_
+            const ParamMirror *mirror_;
+            std::vector<int32_t> mirrorIndex_;
     };
 
 // Part zero point five: Cache of pdf values for different parameters
+// Items are kept in least-recently-used order, and identified by the values of the parameters
+// (compared through a hash first). The number of items can be set with --X-rtd CACHINGPDF_SIZE=N,
+// or per class of pdf with --X-rtd CACHINGPDF_SIZE_<ClassName>=N; caches don't grow further once all
+// of them together use more than CACHINGPDF_MAXMB megabytes, but recycle their oldest item instead.
     class ValuesCache {
         public:
-            ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size=MaxItems_);
-            ValuesCache(const RooAbsCollection &params, int size=MaxItems_);
+            enum { DefaultSize = 6, DefaultMaxMB = 512 };
+            ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size=DefaultSize);
+            ValuesCache(const RooAbsCollection &params, int size=DefaultSize);
             ~ValuesCache();
             // search for the item corresponding to the current values of the parameters.
             // if available, return (&values, true)
@@ -45,17 +85,23 @@ namespace cacheutils {
             // and it will be up to the caller code to fill the room the new item
             std::pair<std::vector<Double_t> *, bool> get(); 
             void clear();
+            /// size to use for caching the values of this pdf, from the runtime flags
+            static int sizeFor(const RooAbsReal &pdf) ;
+            void bind(const ParamMirror *mirror) { params_.bind(mirror); }
         private:
             struct Item {
-                Item(const RooAbsCollection &set)   : checker(set),   good(false) {}
-                Item(const ArgSetChecker    &check) : checker(check), good(false) {}
+                Item() : hash(0), good(false), bytes(0) {}
+                std::vector<double>   key;
+                std::size_t           hash;
                 std::vector<Double_t> values;
-                ArgSetChecker         checker;
                 bool                  good;
+                std::size_t           bytes; // memory accounted for this item in totalBytes_
             };
-            int size_, maxSize_;
-            enum { MaxItems_ = 3 };
-            Item *items[MaxItems_];
+            ArgSetChecker        params_;
+            std::vector<Item *>  items_; // most recently used first
+            int                  maxSize_;
+            static std::size_t   totalBytes_;
+            void account_(Item &item) ;
     };
 // Part one: cache all values of a pdf
 class CachingPdfBase {
@@ -65,6 +111,14 @@ class CachingPdfBase {
         virtual const std::vector<Double_t> & eval(const RooAbsData &data) = 0;
         virtual const RooAbsReal *pdf() const = 0;
         virtual void  setDataDirty() = 0;
+        /// derivative of the values returned by eval(data) with respect to param, at the current point.
+        /// the default implementation uses finite differences
+        virtual void  evalDerivative(const RooAbsData &data, RooRealVar &param, std::vector<Double_t> &out) ;
+        /// read the parameter values from mirror when possible (see ParamMirror)
+        virtual void  bindParamMirror(const ParamMirror *mirror) {}
+        /// the same values as eval(data), read in place from the pdf without copying them into the cache,
+        /// or null if the pdf can't provide them this way. They are valid until the parameters change.
+        virtual const Double_t * evalInPlace(const RooAbsData &data) { return 0; }
 };
 class CachingPdf : public CachingPdfBase {
     public:
@@ -74,6 +128,7 @@ class CachingPdf : public CachingPdfBase {
         virtual const std::vector<Double_t> & eval(const RooAbsData &data) ;
         const RooAbsReal *pdf() const { return pdf_; }
         virtual void  setDataDirty() { lastData_ = 0; }
+        virtual void  bindParamMirror(const ParamMirror *mirror) { cache_.bind(mirror); }
     protected:
         const RooArgSet *obs_;
         RooAbsReal *pdfOriginal_;
@@ -95,6 +150,8 @@ class OptimizedCachingPdfT : public CachingPdf {
         OptimizedCachingPdfT(const OptimizedCachingPdfT &other) : 
             CachingPdf(other), vpdf_(0) {}
         virtual ~OptimizedCachingPdfT() { delete vpdf_; }
+        virtual void  evalDerivative(const RooAbsData &data, RooRealVar &param, std::vector<Double_t> &out) ;
+        virtual const Double_t * evalInPlace(const RooAbsData &data) ;
     protected:
         virtual void realFill_(const RooAbsData &data, std::vector<Double_t> &values) ;
         virtual void newData_(const RooAbsData &data) ;
@@ -103,6 +160,10 @@ class OptimizedCachingPdfT : public CachingPdf {
 
 CachingPdfBase * makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) ;
 
+// derivative of a function with respect to a parameter, at the current point:
+// analytic for the few classes for which it's known, finite differences on this node only otherwise
+double derivative(const RooAbsReal &node, RooRealVar &param) ;
+
 class CachingAddNLL : public RooAbsReal {
     public:
         CachingAddNLL(const char *name, const char *title, RooAbsPdf *pdf, RooAbsData *data) ;
@@ -113,6 +174,12 @@ class CachingAddNLL : public RooAbsReal {
         virtual Bool_t isDerived() const { return kTRUE; }
         virtual Double_t defaultErrorLevel() const { return 0.5; }
         void setData(const RooAbsData &data) ;
+        /// same as setData(data), with the weights of the entries of data with non-zero weight already known
+        void setData(const RooAbsData &data, const double *weights, unsigned int n) ;
+        /// new weights for the same entries of the current data (e.g. a binned toy with the same empty bins):
+        /// the pdf caches are kept, only the weights and their sum change
+        void setWeights(const double *weights, unsigned int n) ;
+        const RooAbsData & data() const { return *data_; }
         virtual RooArgSet* getObservables(const RooArgSet* depList, Bool_t valueOnly = kTRUE) const ;
         virtual RooArgSet* getParameters(const RooArgSet* depList, Bool_t stripDisconnected = kTRUE) const ;
         double  sumWeights() const { return sumWeights_; }
@@ -120,9 +187,42 @@ class CachingAddNLL : public RooAbsReal {
         void setZeroPoint() { zeroPoint_ = -this->getVal(); setValueDirty(); }
         void clearZeroPoint() { zeroPoint_ = 0.0; setValueDirty();  }
         RooSetProxy & params() { return params_; }
+        /// rough estimate of the cost of one evaluation (bins or events times number of pdfs)
+        double  evalCost() const { return double(weights_.size()) * (pdfs_.size() + 1); }
+        /// true if derivative() can work node by node (i.e. not for a RooRealSumPdf)
+        bool    supportsGradient() const { return !isRooRealSum_; }
+        /// derivative of the NLL with respect to param, at the current point
+        double  derivative(RooRealVar &param) const ;
+        friend class CachingSimNLL;
     private:
         void setup_();
         void addPdfs_(RooAddPdf *addpdf, bool recursive, const RooArgList & basecoeffs) ;
+        // common part of the setData methods, once weights_ is filled
+        void newData_(const RooAbsData &data) ;
+        double sumOfWeights_() const ;
+        // The evaluation is split in three steps: the first and the last one use the RooFit graph
+        // (coefficients, pdf caches, error logging), while the middle one works only on the
+        // cached numbers and so it can be run concurrently for different channels
+        void   prepareEval_() const ;
+        void   computeEval_() const ;
+        double finishEval_() const ;
+        // computeEval_ for the fast path on the expected yields (ADDNLL_BINNED_FASTPATH)
+        void   computeEvalBinned_(bool kahan) const ;
+        // store a value computed outside of evaluate() as the current one
+        void   setCachedValue_(double value) const { _value = value; clearValueAndShapeDirty(); }
+        bool   needsEval_() const { return isValueDirty() || isShapeDirty(); }
+        // find out which coefficients and pdfs depend on which parameter
+        void   setupGradient_() const ;
+        void   bindParamMirror_(const ParamMirror *mirror) ;
+        // Evaluation at several parameter points (see CachingSimNLL::evaluateBatch): beginBatch_ once, then
+        // addBatchPoint_ at each point (the RooFit part, as in prepareEval_), computeBatch_ once for all the
+        // points, going through the bins in blocks so that the pdf values are reused while still in cache,
+        // and finally finishBatchPoint_ for each point. The results are identical to those of evaluate().
+        bool   supportsBatch_() const { return !isRooRealSum_ && multiPdfs_.empty(); }
+        void   beginBatch_(const RooArgSet &params) const ;
+        void   addBatchPoint_() const ;
+        void   computeBatch_() const ;
+        double finishBatchPoint_(unsigned int k) const ;
         RooAbsPdf *pdf_;
         RooSetProxy params_;
         const RooAbsData *data_;
@@ -136,7 +236,35 @@ class CachingAddNLL : public RooAbsReal {
         mutable std::vector<Double_t> partialSum_;
         mutable std::vector<Double_t> workingArea_;
         mutable bool isRooRealSum_, fastExit_;
+        // nll computed as sum_i (-n_i log nu_i) + sum_i nu_i on the expected yields nu_i, without normalizing the pdf
+        mutable bool binnedFast_;
         double zeroPoint_;
+        // results of the partial steps of the evaluation
+        mutable std::vector<Double_t> coeffVals_;
+        // values of each pdf on the entries with non-zero weight (weights_.size() of them), either in the
+        // cache of the CachingPdf or, with ADDNLL_HIST_INPLACE, straight in the template of the pdf
+        mutable std::vector<const Double_t *> pdfVals_;
+        mutable double sumCoeff_, reduced_, firstUnderflow_;
+        mutable unsigned int underflows_;
+        // for the derivatives: indices of the coefficients and pdfs depending on each parameter
+        struct GradTerms { std::vector<int> coeffs, pdfs; };
+        mutable bool gradientReady_;
+        mutable std::map<const RooAbsArg *, GradTerms> gradTerms_;
+        mutable std::vector<Double_t> gradSum_, gradWork_, gradTmp_;
+        // for the batched evaluation: coefficients and pdf values at each point, and results of computeBatch_.
+        // The values of the pdfs that depend on the batch parameters are copied in batchStore_, since the
+        // pdf caches can reuse their buffers from one point to the next.
+        struct BatchPoint {
+            std::vector<Double_t> coeffs;
+            std::vector<const Double_t *> pdfVals;
+            double sumCoeff, reduced, firstUnderflow;
+            unsigned int underflows;
+        };
+        mutable std::vector<BatchPoint> batchPoints_;
+        mutable unsigned int batchSize_, batchStoreUsed_;
+        mutable std::vector<uint8_t> batchCopy_;
+        mutable std::deque<std::vector<Double_t> > batchStore_;
+        mutable std::vector<Double_t> batchSum_, batchWork_, batchSums_, batchCompensations_;
 };
 
 class CachingSimNLL  : public RooAbsReal {
@@ -156,9 +284,34 @@ class CachingSimNLL  : public RooAbsReal {
         void setZeroPoint() ; 
         void clearZeroPoint() ;
         static void forceUnoptimizedConstraints() { optimizeContraints_ = false; }
+        /// true if the gradient can be computed node by node in all the channels
+        bool supportsGradient() const ;
+        /// derivatives of the NLL with respect to params, at the current point (see CachingAddNLL::derivative)
+        void gradient(const std::vector<RooRealVar *> &params, double *grad) const ;
+        /// NLL at npoints points in the space of params (the value of params[j] at point k is points[k*params.size()+j]),
+        /// with the other parameters at their current values. Each channel goes through its data once for all
+        /// the points; the results are identical to those of getVal() at each point. The params are restored at the end.
+        void evaluateBatch(const std::vector<RooRealVar *> &params, const double *points, unsigned int npoints, double *nlls) const ;
+        /// derivatives of the NLL with respect to params from central finite differences, computed with evaluateBatch
+        void numericalGradient(const std::vector<RooRealVar *> &params, double *grad) const ;
         friend class CachingAddNLL;
     private:
         void setup_();
+        void setupGradient_() const ;
+        void setupThreads_();
+        void setupIndex_();
+        // find out which channels have to be recomputed, from the parameters that changed since the last evaluation
+        void markDirtyChannels_() const ;
+        // bring channelVals_ up to date, evaluating only the channels that need it
+        void evaluateChannels_() const ;
+        // evaluate all the channels that need it, running the numerical part in the thread pool
+        void evaluateChannelsParallel_() const ;
+        // with VERTINTERP_FLOAT_MORPHS=2, print the difference of the NLL of the channels with the morphs of the
+        // FastVerticalInterpHistPdf2 in double precision instead of single precision (at evaluation 1, 10, 100, ...)
+        void validateFloatMorphs_() const ;
+        // the log of each constraint pdf at the current point (generic ones first, then the fast gaussians),
+        // including the zero points unless zeroPoints is false
+        void evalConstraints_(std::vector<double> &terms, bool zeroPoints = true) const ;
         RooSimultaneous   *pdfOriginal_;
         const RooAbsData  *dataOriginal_;
         const RooArgSet   *nuis_;
@@ -168,14 +321,54 @@ class CachingSimNLL  : public RooAbsReal {
         std::vector<RooAbsPdf *>        constrainPdfs_;
         std::vector<SimpleGaussianConstraint *>  constrainPdfsFast_;
         std::vector<bool>                        constrainPdfsFastOwned_;
+        // constraints computed in flat arrays: all of constrainPdfsFast_, and constrainPdfs_[i] if constrainPdfsInArrays_[i]
+        mutable FastConstraintTerms              fastConstraints_;
+        std::vector<uint8_t>                     constrainPdfsInArrays_;
+        mutable std::vector<int>                 constraintsFailed_;
         std::vector<CachingAddNLL*>     pdfs_;
         std::auto_ptr<TList>            dataSets_;
         std::vector<RooDataSet *>       datasets_;
+        // columns made by splitWithWeights: the weights of the events of channel ib are splitWeights_[splitBegin_[ib]]
+        // ... splitWeights_[splitBegin_[ib+1]-1], and the values of their observables (those of datasets_[ib], event
+        // by event) start at splitValues_[splitValueBegin_[ib]]
+        std::vector<double>             splitWeights_, splitValues_;
+        std::vector<unsigned int>       splitBegin_, splitValueBegin_;
+        // the same columns for the previous data, and the channels for which only the weights changed
+        std::vector<double>             prevSplitValues_;
+        std::vector<unsigned int>       prevSplitBegin_, prevSplitValueBegin_;
+        std::vector<uint8_t>            splitSameLayout_;
+        // setData of channel ib from the columns (or only setWeights, if its layout did not change)
+        void setChannelData_(int ib) ;
         static bool noDeepLEE_;
         static bool hasError_;
         static bool optimizeContraints_;
         std::vector<double> constrainZeroPoints_;
         std::vector<double> constrainZeroPointsFast_;
+        // thread pool (only if SIMNLL_THREADS > 1), and channels assigned to each thread
+        std::auto_ptr<SimpleThreadPool>  threadPool_;
+        std::vector<std::vector<int> >   threadPartitions_;
+        mutable std::vector<uint8_t>     channelDirty_;
+        // dependency index: for each parameter, the channels depending on it (indexChannels_[indexOffsets_[i]] ...
+        // indexChannels_[indexOffsets_[i+1]-1], real variables first and then categories), and its value at the
+        // last evaluation. Channels with other kinds of inputs (channelUnindexed_) rely on the RooFit dirty flags.
+        std::vector<RooRealVar *>        indexVars_;
+        std::vector<RooAbsCategory *>    indexCats_;
+        mutable std::vector<double>      indexVarVals_;
+        mutable std::vector<int>         indexCatVals_;
+        std::vector<int>                 indexOffsets_, indexChannels_;
+        std::vector<uint8_t>             channelUnindexed_;
+        // NLL of each channel at the last evaluation; all invalid if channelValsStale_ (new data, zero point, ...)
+        mutable std::vector<double>      channelVals_;
+        mutable bool                     channelValsStale_;
+        bool                             incremental_;
+        // values of indexVars_ and indexCats_, read once per evaluation and shared with the pdf caches
+        mutable ParamMirror              mirror_;
+        // for the gradient: indices of the channels and constraints depending on each parameter
+        mutable bool gradientReady_;
+        mutable std::map<const RooAbsArg *, std::vector<int> > channelsForParam_, constraintsForParam_, constraintsFastForParam_;
+        mutable std::vector<double> constraintTerms_;
+        // with VERTINTERP_FLOAT_MORPHS=2, evaluations so far and the next one at which to run validateFloatMorphs_
+        mutable unsigned long floatMorphsEvals_, floatMorphsNextCheck_;
 };
 
 }
@@ -0,0 +1,62 @@
+#ifndef FastConstraintTerms_h
+#define FastConstraintTerms_h
+
+#include <RooAbsPdf.h>
+#include <RooArgSet.h>
+#include <vector>
+#include <stdint.h>
+
+class SimpleGaussianConstraint;
+
+/// Log of many constraint pdfs at once. The inputs of the pdfs are kept in flat arrays, one group per
+/// kind of pdf, and each group is computed in a single loop over the arrays:
+///  - SimpleGaussianConstraint:              -0.5 (x-mean)^2/sigma^2, exactly as getLogValFast()
+///  - RooPoisson(x, mean), vs mean:          x log(mean) - mean + c
+///  - RooGamma(x, gamma, beta, mu), vs x:    (gamma-1) log(x-mu) - (x-mu)/beta + c
+///  - RooLognormal(x, m0, k), vs x:          -log(x) - 0.5 (log(x)-log(m0))^2/log(k)^2 + c
+/// For the last three only one variable can change from one evaluation to the next. The constant c
+/// (factorials, gamma functions, normalization over nuis) is set from log(pdf->getVal(nuis)) at the first
+/// evaluation, and again each time the other inputs or the range of the variable change (e.g. a new value
+/// of the global observables), so the result is the same as log(pdf->getVal(nuis)) up to rounding.
+class FastConstraintTerms {
+    public:
+        FastConstraintTerms() : nuis_(0) {}
+        /// add pdf to the terms if it's a RooPoisson, RooGamma or RooLognormal whose variable (the mean of
+        /// the RooPoisson, the x of the others) is a RooRealVar and is the only one of its inputs in nuis.
+        /// its log will go in out[slot] in eval. Returns false if it was not added.
+        bool add(const RooAbsPdf &pdf, const RooArgSet *nuis, int slot) ;
+        /// add a gaussian constraint, whose log will go in out[slot]
+        void addGaussian(const SimpleGaussianConstraint &pdf, int slot) ;
+        /// number of terms
+        unsigned int size() const { return gaussSlots_.size() + slots_.size(); }
+        /// compute the log of all the terms in out[slot]. The slots of the terms that could not be
+        /// computed (e.g. a negative mean, or a pdf that evaluates to zero) are put in failed,
+        /// and the caller must compute them from the pdf
+        void eval(double *out, std::vector<int> &failed) ;
+        void clear() ;
+    private:
+        // gaussians
+        std::vector<int>                 gaussSlots_;
+        std::vector<const RooAbsReal *>  gaussX_, gaussMean_;
+        std::vector<double>              gaussScale_;
+        // the other terms, as p log(u) + q u + r (log(u) - s)^2 + c, with u = x - shift
+        enum Kind { Poisson, Gamma, Lognormal };
+        std::vector<int>                 slots_, kinds_;
+        std::vector<const RooAbsPdf *>   pdfs_;
+        std::vector<const RooAbsReal *>  vars_;
+        std::vector<double>              shift_, p_, q_, r_, s_, c_;
+        std::vector<uint8_t>             good_;   // c_ is up to date
+        // the inputs other than the variable, and the range of the variable:
+        // if their values change, the constant c and the coefficients are recomputed
+        std::vector<unsigned int>        keyBegin_;
+        std::vector<const RooAbsReal *>  keyArgs_;
+        std::vector<double>              keyVals_;
+        const RooArgSet                 *nuis_;
+        // working areas
+        std::vector<double>              x_, mean_, out_, work_, work2_;
+        std::vector<int>                 calib_;
+        bool keyChanged_(unsigned int i) ;
+        bool calibrate_(unsigned int i, double f) ;
+};
+
+#endif
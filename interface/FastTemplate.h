@@ -4,8 +4,68 @@
 #include <TH1.h>
 #include <TH2.h>
 #include <algorithm>
+#include <cstddef>
 #include <vector>
 
+/// Allocator for long-lived arrays that are not persisted (e.g. the values of the morphs of
+/// FastVerticalInterpHistPdf2Base, one array per pdf), as 64-byte aligned slices of large slabs, so that they
+/// are not scattered across the heap: arrays created together end up next to each other.
+/// Deallocated slices are reused for arrays of the same size, and a slab is released when all the
+/// slices in it have been deallocated.
+namespace fasttemplate {
+    void * allocate(std::size_t bytes) ;
+    void   deallocate(void *ptr, std::size_t bytes) ;
+    /// Print the memory in use by the arrays from the arena and that reserved in slabs
+    void   printMemoryReport() ;
+
+    template<typename T>
+    class Allocator {
+        public:
+            typedef T value_type;
+            typedef T * pointer;
+            typedef const T * const_pointer;
+            typedef T & reference;
+            typedef const T & const_reference;
+            typedef std::size_t size_type;
+            typedef std::ptrdiff_t difference_type;
+            template<typename U> struct rebind { typedef Allocator<U> other; };
+
+            Allocator() {}
+            template<typename U> Allocator(const Allocator<U> &) {}
+
+            pointer       address(reference x) const { return &x; }
+            const_pointer address(const_reference x) const { return &x; }
+            pointer   allocate(size_type n, const void * = 0) { return static_cast<pointer>(fasttemplate::allocate(n * sizeof(T))); }
+            void      deallocate(pointer p, size_type n) { fasttemplate::deallocate(p, n * sizeof(T)); }
+            size_type max_size() const { return size_type(-1) / sizeof(T); }
+            void construct(pointer p, const T & val) { new (static_cast<void *>(p)) T(val); }
+            void destroy(pointer p) { p->~T(); }
+    };
+    template<typename T, typename U> bool operator==(const Allocator<T> &, const Allocator<U> &) { return true; }
+    template<typename T, typename U> bool operator!=(const Allocator<T> &, const Allocator<U> &) { return false; }
+
+    /// Search of the bin containing x, with the same result as a std::lower_bound on the edges: -1 if x is
+    /// not above the first edge (or is NaN), nbins if it's above the last one, and i if edges[i] < x <= edges[i+1].
+    /// With uniform binning the bin is computed from x (and checked against the edges), otherwise the edges are
+    /// kept in Eytzinger order (that of a binary heap), in which the search has no unpredictable branches.
+    class BinLookup {
+        public:
+            BinLookup() : ready_(false), uniform_(false), nbins_(0), invWidth_(0) {}
+            /// set up from nedges edges in increasing order (i.e. nedges-1 bins)
+            void init(const double *edges, unsigned int nedges) ;
+            bool ready() const { return ready_; }
+            int  find(double x) const ;
+            void find(const double *x, int *bins, unsigned int n) const ;
+        private:
+            bool ready_, uniform_;
+            int nbins_;
+            double invWidth_;
+            std::vector<double> edges_;     // for uniform binning
+            std::vector<double> eytzinger_; // otherwise, in positions 1 .. nbins+1
+            std::vector<int>    rank_;      // position in the sorted edges of each of them (nbins+1 at 0, i.e. not found)
+    };
+}
+
 class FastTemplate {
     public:
         typedef double T;
@@ -39,6 +99,8 @@ class FastTemplate {
         T Integral() const ;
         void Scale(T factor) ;
         void Clear() ; 
+        /// Free the memory of the values, leaving an empty template
+        void Release() { size_ = 0; AT().swap(values_); }
         void CopyValues(const FastTemplate &other) ;
         void CopyValues(const TH1 &other) ;
         void CopyValues(const TH2 &other) ;
@@ -85,6 +147,7 @@ class FastHisto : public FastTemplate {
                 values_    = other.values_;
                 binWidths_ = other.binWidths_;
                 binEdges_  = other.binEdges_;
+                lookup_    = other.lookup_;
             } else CopyValues(other); 
             return *this; 
         }
@@ -101,10 +164,16 @@ class FastHisto : public FastTemplate {
             std::swap(values_, other.values_);
             std::swap(binWidths_, other.binWidths_);
             std::swap(binEdges_, other.binEdges_);
+            std::swap(lookup_, other.lookup_);
         }
         T GetAt(const T &x) const ;
         int FindBin(const T &x) const ;
+        /// FindBin for n values of x at once
+        void FindBins(const T *x, int *bins, unsigned int n) const ;
         const T & GetBinContent(int bin) const { return values_[bin]; }
+        const T & GetBinWidth(int bin) const { return binWidths_[bin]; }
+        /// lower edge of bin, or upper edge of the last bin for bin = fullsize()
+        const T & GetEdge(int bin) const { return binEdges_[bin]; }
         T IntegralWidth() const ;
         void Normalize() {
             T sum = IntegralWidth();
@@ -115,7 +184,12 @@ class FastHisto : public FastTemplate {
     private:
         AT binEdges_;
         AT binWidths_;
-    
+        /// search on binEdges_, made on the first lookup (also for the templates read from a file)
+        mutable fasttemplate::BinLookup lookup_; //! not to be serialized
+        const fasttemplate::BinLookup & lookup() const { 
+            if (!lookup_.ready()) lookup_.init(binEdges_.empty() ? 0 : &binEdges_[0], binEdges_.size());
+            return lookup_;
+        }
 };
 class FastHisto2D : public FastTemplate {
     public:
@@ -131,6 +205,8 @@ class FastHisto2D : public FastTemplate {
                 binEdgesY_ = other.binEdgesY_;
                 binX_      = other.binX_;
                 binY_      = other.binY_;
+                lookupX_   = other.lookupX_;
+                lookupY_   = other.lookupY_;
             } else CopyValues(other); 
             return *this; 
         }
@@ -143,8 +219,14 @@ class FastHisto2D : public FastTemplate {
             std::swap(binWidths_, other.binWidths_);
             std::swap(binEdgesX_, other.binEdgesX_);
             std::swap(binEdgesY_, other.binEdgesY_);
+            std::swap(lookupX_, other.lookupX_);
+            std::swap(lookupY_, other.lookupY_);
         }
         T GetAt(const T &x, const T &y) const ;
+        /// index of the bin containing (x,y) in values (ix * binY() + iy), or -1 if the point is outside
+        int FindBin(const T &x, const T &y) const ;
+        /// FindBin for n points (x[i], y[i]) at once
+        void FindBins(const T *x, const T *y, int *bins, unsigned int n) const ;
         T IntegralWidth() const ;
         unsigned int binX() const { return binX_; }
         unsigned int binY() const { return binY_; }
@@ -161,7 +243,9 @@ class FastHisto2D : public FastTemplate {
         AT binEdgesX_;
         AT binEdgesY_;
         AT binWidths_;
-    
+        /// searches on binEdgesX_ and binEdgesY_, as in FastHisto
+        mutable fasttemplate::BinLookup lookupX_, lookupY_; //! not to be serialized
+        void initLookups() const ;
 };
 
 #endif
@@ -10,6 +10,37 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+
+/// Last few normalization integrals computed numerically by one of the pdfs below, with the values of the parameters
+/// and of the range they were computed for, so that each is done only once for each point in the parameter space
+/// (and not again for the integrals of the same pdf in CachingAddNLL). More than one is kept because the minimizer
+/// comes back to the central point after the steps it takes to compute the derivatives.
+class HZZ4LIntegralCache {
+public:
+	enum { Size = 4 };
+	HZZ4LIntegralCache() : last_(0), next_(0) {}
+	/// true if the integral for key is in the cache, then value() returns it
+	bool matches(const double *key, unsigned int n) const {
+		for (unsigned int i = 0; i < Size; ++i) {
+			unsigned int j = (last_ + Size - i) % Size;
+			if (keys_[j].size() == n && std::equal(key, key + n, keys_[j].begin())) { last_ = j; return true; }
+		}
+		return false;
+	}
+	double value() const { return values_[last_]; }
+	/// store an integral, replacing the oldest one
+	void set(const double *key, unsigned int n, double value) {
+		keys_[next_].assign(key, key + n); values_[next_] = value;
+		last_ = next_; next_ = (next_ + 1) % Size;
+	}
+private:
+	std::vector<double> keys_[Size];
+	double values_[Size];
+	mutable unsigned int last_;
+	unsigned int next_;
+};
 
 /*
 namespace RooFit{
@@ -51,6 +82,8 @@ public:
 	RooqqZZPdf(const RooqqZZPdf& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooqqZZPdf(*this,newname); }
 	inline virtual ~RooqqZZPdf() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -64,6 +97,8 @@ protected:
 	RooRealProxy frac ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -87,6 +122,8 @@ public:
 	RooggZZPdf(const RooggZZPdf& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooggZZPdf(*this,newname); }
 	inline virtual ~RooggZZPdf() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -100,6 +137,8 @@ protected:
 	RooRealProxy frac ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -133,6 +172,8 @@ public:
 	RooqqZZPdf_v2(const RooqqZZPdf_v2& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooqqZZPdf_v2(*this,newname); }
 	inline virtual ~RooqqZZPdf_v2() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -154,6 +195,8 @@ protected:
 	
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -182,6 +225,8 @@ public:
 	RooggZZPdf_v2(const RooggZZPdf_v2& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooggZZPdf_v2(*this,newname); }
 	inline virtual ~RooggZZPdf_v2() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -198,6 +243,8 @@ protected:
 	RooRealProxy a9 ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -501,6 +548,8 @@ public:
 	RooRelBW1(const RooRelBW1& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooRelBW1(*this,newname); }
 	inline virtual ~RooRelBW1() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -509,6 +558,8 @@ protected:
 	RooRealProxy gamma ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -526,6 +577,8 @@ public:
 	RooRelBWUF(const RooRelBWUF& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooRelBWUF(*this,newname); }
 	inline virtual ~RooRelBWUF() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -533,6 +586,8 @@ protected:
 	RooRealProxy mH ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -551,6 +606,8 @@ public:
 	RooRelBWUF_SM4(const RooRelBWUF_SM4& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooRelBWUF_SM4(*this,newname); }
 	inline virtual ~RooRelBWUF_SM4() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -558,6 +615,8 @@ protected:
 	RooRealProxy mH ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -577,6 +636,8 @@ public:
 	RooRelBWUFParamWidth(const RooRelBWUFParamWidth& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooRelBWUFParamWidth(*this,newname); }
 	inline virtual ~RooRelBWUFParamWidth() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -602,6 +663,8 @@ public:
 	RooRelBWUFParam(const RooRelBWUFParam& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooRelBWUFParam(*this,newname); }
 	inline virtual ~RooRelBWUFParam() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -610,6 +673,8 @@ protected:
 	RooRealProxy scaleParam ;
 	
 	Double_t evaluate() const ;
+	Double_t evaluateAt(Double_t mass) const ;
+	mutable HZZ4LIntegralCache integral_; //! normalization integral
 	
 private:
 	
@@ -628,6 +693,8 @@ public:
 	RooRelBWHighMass(const RooRelBWHighMass& other, const char* name=0) ;
 	virtual TObject* clone(const char* newname) const { return new RooRelBWHighMass(*this,newname); }
 	inline virtual ~RooRelBWHighMass() { }
+	Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+	Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 	
 protected:
 	
@@ -660,8 +727,8 @@ public:
   RooTsallis(const RooTsallis& other, const char* name=0) ;
   virtual TObject* clone(const char* newname) const { return new RooTsallis(*this,newname); }
   inline virtual ~RooTsallis() { }
-  /* Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
-     Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;*/
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
 
 protected:
 
@@ -675,6 +742,8 @@ protected:
   RooRealProxy fexp ;
 
   Double_t evaluate() const ;
+  Double_t evaluateAt(Double_t mass) const ;
+  mutable HZZ4LIntegralCache integral_; //! normalization integral
 
 private:
 
@@ -706,6 +775,9 @@ class RooaDoubleCBxBW : public RooAbsPdf {
   virtual TObject* clone(const char* newname) const { return new RooaDoubleCBxBW(*this,newname); }
   inline virtual ~RooaDoubleCBxBW() { }
 
+  /// values (not normalized) at n values of x, as evaluate()
+  void evaluateMany(unsigned int n, const double *xvals, double *out) const ;
+
  protected:
 
   RooRealProxy x ;
@@ -721,11 +793,21 @@ class RooaDoubleCBxBW : public RooAbsPdf {
   RooRealProxy thetaR;
   bool computeActualCB;
 
+  /// With --X-rtd CBXBW_TABLE=N the convolution is interpolated (Catmull-Rom) from a table with N nodes per
+  /// min(sigma, width). The convolution only depends on x - shift, so the table is a function of x - shift,
+  /// and it's rebuilt only when the other parameters change, or when the shift goes out of the table
   Double_t evaluate() const ;
-  Double_t evaluateDoubleCB() const ;
-  Double_t evaluatePowerLaw(double lim, unsigned power, bool isLeft) const ;
-  Double_t evaluateQuadratic(double lim1, double lim2, bool isLeft) const ;
-  Double_t evaluateVoigtian() const ;
+  Double_t evaluateExact(double xv) const ;
+  Double_t evaluateDoubleCB(double xv) const ;
+  Double_t evaluatePowerLaw(double xv, double lim, unsigned power, bool isLeft) const ;
+  Double_t evaluateQuadratic(double xv, double lim1, double lim2, bool isLeft) const ;
+  Double_t evaluateVoigtian(double xv) const ;
+  void updateTable_() const ;
+  Double_t interpolate_(double d) const ;
+
+  mutable std::vector<double> table_;    //! values at x - shift = tableLo_ + i * tableStep_
+  mutable std::vector<double> tableKey_; //! parameters for which table_ was computed
+  mutable double tableLo_, tableStep_;   //!
 
  private:
 
@@ -0,0 +1,80 @@
+#ifndef ROO_HORIZONTAL_INTERP_HIST
+#define ROO_HORIZONTAL_INTERP_HIST
+
+/** Horizontal interpolation between histograms as a function of a parameter (e.g. a mass), as in th1fmorph
+    (A. L. Read, "Linear interpolation of histograms", NIM A 425 (1999) 357): the quantiles of the two templates
+    next to the value of the parameter are interpolated linearly, and the result is projected back onto the bins.
+
+    The cumulative distributions of the templates are computed once, and for each pair of neighbouring templates
+    also their inverses at the union of the cumulative probabilities at the bin edges of both, which is where
+    the interpolated cumulative distribution has its kinks. An interpolation is then a linear combination of
+    two such tables followed by a walk along the bin edges, with no allocations, and the result is cached
+    for the last value of the parameter. All the templates must have the same binning.
+    Outside of the range of the parameter values of the templates, the first or last pair is extrapolated. */
+
+#include "RooAbsPdf.h"
+#include "RooRealProxy.h"
+#include "RooAbsData.h"
+#include "TList.h"
+#include "../interface/FastTemplate.h"
+#include <vector>
+
+class FastHorizontalInterpHistPdfV;
+class FastHorizontalInterpHistPdf : public RooAbsPdf {
+public:
+
+  FastHorizontalInterpHistPdf() : _cacheParam(0) {}
+  /// funcList contains one TH1 for each of the points, which must be in increasing order
+  FastHorizontalInterpHistPdf(const char *name, const char *title, const RooRealVar &x, const RooAbsReal &param, const TList & funcList, const std::vector<double> &points) ;
+  FastHorizontalInterpHistPdf(const FastHorizontalInterpHistPdf& other, const char* name=0) ;
+  virtual TObject* clone(const char* newname) const { return new FastHorizontalInterpHistPdf(*this,newname) ; }
+  virtual ~FastHorizontalInterpHistPdf() {}
+
+  Bool_t selfNormalized() const { return kTRUE; }
+  Double_t evaluate() const ;
+
+  friend class FastHorizontalInterpHistPdfV;
+protected:
+  RooRealProxy _x, _param;
+
+  /// Values of the parameter for the templates
+  std::vector<double> _points;
+  /// Cumulative distributions of the templates at the bin edges (size+1 values for each, from 0 to 1; all 0 if empty)
+  std::vector<double> _cdfs;
+  /// Binning of the templates (with the contents of the first one)
+  FastHisto _binning;
+
+  /// Cache of the result, and value of the parameter for it
+  mutable FastHisto _cache; //! not to be serialized
+  mutable double _cacheParam; //! not to be serialized
+  /// For the pair of templates i, i+1: the probabilities _ys[j], the quantiles _xlo[j] for the template i,
+  /// and the differences _xdiff[j] between those for template i+1 and i, for j in _pairBegin[i] .. _pairBegin[i+1]
+  mutable std::vector<int> _pairBegin; //! not to be serialized
+  mutable std::vector<double> _ys, _xlo, _xdiff; //! not to be serialized
+  mutable std::vector<double> _xwork; //! not to be serialized
+
+  void initPairs() const ;
+  void syncTotal() const ;
+  /// recompute the cache if the parameter changed
+  void sync() const { if (_cache.size() == 0 || _cacheParam != _param) syncTotal(); }
+
+private:
+  ClassDef(FastHorizontalInterpHistPdf,1) //
+};
+
+class FastHorizontalInterpHistPdfV {
+    public:
+        FastHorizontalInterpHistPdfV(const FastHorizontalInterpHistPdf &, const RooAbsData &data) ;
+        void fill(std::vector<Double_t> &out) const ;
+        /// as FastVerticalInterpHistPdf2V::values
+        const Double_t * values() const ;
+    private:
+        const FastHorizontalInterpHistPdf & hpdf_;
+        // the entries are the bins begin_ .. end_ of the template, or else they're picked one by one from bins_
+        // (with -1 for those outside of the template, if outside_)
+        int begin_, end_;
+        std::vector<int> bins_;
+        bool outside_;
+};
+
+#endif
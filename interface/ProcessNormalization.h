@@ -29,6 +29,12 @@ class ProcessNormalization : public RooAbsReal {
       void addAsymmLogNormal(double kappaLo, double kappaHi, RooAbsReal &theta) ;
       void addOtherFactor(RooAbsReal &factor) ;
       void dump() const ;
+      /// derivative of the logarithm of the normalization with respect to theta, 
+      /// considering only the symmetric and asymmetric log-normal terms (i.e. not the other factors)
+      Double_t logKappaDerivative(const RooAbsArg &theta) const ;
+      const RooArgList & otherFactors() const { return otherFactorList_; }
+      /// true if all the nuisances of the log-normal terms are variables (so logKappaDerivative is complete)
+      Bool_t hasFundamentalThetasOnly() const ;
     protected:
         Double_t evaluate() const;
 
@@ -43,6 +49,8 @@ class ProcessNormalization : public RooAbsReal {
 
         // get the kappa for the appropriate x
         Double_t logKappaForX(double x, const std::pair<double,double> &logKappas ) const ;
+        // and its derivative with respect to x
+        Double_t logKappaForXDerivative(double x, const std::pair<double,double> &logKappas ) const ;
 
   ClassDef(ProcessNormalization,1) // Process normalization interpolator 
 };
@@ -9,6 +9,12 @@
    #undef protected
 #endif
 
+#include <memory>
+#include <Math/IFunction.h>
+
+namespace cacheutils { class CachingSimNLL; }
+class RooMinimizerGradFcnOpt;
+
 class RooMinimizerOpt : public RooMinimizer {
     public:
         RooMinimizerOpt(RooAbsReal& function) ;
@@ -19,7 +25,13 @@ class RooMinimizerOpt : public RooMinimizer {
         Int_t hesse() ;
         Int_t minos() ;
         Int_t minos(const RooArgSet& minosParamList) ;
-
+        ~RooMinimizerOpt() ;
+    protected:
+        /// Run the fit on _fcn, or with the analytic gradient if enabled with --X-rtd MINIMIZER_ANALYTIC_GRAD=1
+        /// and possible (a CachingSimNLL where all channels support it, and Minuit2), or else with a gradient
+        /// from batched finite differences if enabled with --X-rtd MINIMIZER_BATCH_GRAD=1 (CachingSimNLL and Minuit2)
+        bool fitFCN() ;
+        std::auto_ptr<RooMinimizerGradFcnOpt> _gradFcn;
 };
 
 class RooMinimizerFcnOpt : public RooMinimizerFcn {
@@ -29,6 +41,10 @@ class RooMinimizerFcnOpt : public RooMinimizerFcn {
         virtual ROOT::Math::IBaseFunctionMultiDim* Clone() const;
         Bool_t Synchronize(std::vector<ROOT::Fit::ParameterSettings>& parameters, Bool_t optConst, Bool_t verbose);
         void initStdVects() const ;
+        /// the floating parameters, in the order of the minimizer coordinates
+        const std::vector<RooRealVar *> & vars() const { return _vars; }
+        /// d(parameter value)/d(minimizer coordinate x) for the i-th parameter
+        double jacobian(unsigned int i, double x) const { return _hasOptimzedBounds[i] ? _optimzedBounds[i].derivative(x) : 1.0; }
     protected:
         virtual double DoEval(const double * x) const;
         mutable std::vector<RooRealVar *> _vars;
@@ -47,8 +63,37 @@ class RooMinimizerFcnOpt : public RooMinimizerFcn {
                     return x;
                 }
             }
+            double derivative(double x) const {
+                if (x < softMin) {
+                    double dx = softMin-x, s = softMin-hardMin;
+                    return ( 1 + 2*dx/s ) * std::exp ( -2*dx/s );
+                } else if (x > softMax) { 
+                    double dx = x-softMax, s = hardMax-softMax;
+                    return ( 1 + 2*dx/s ) * std::exp ( -2*dx/s );
+                } else {
+                    return 1;
+                }
+            }
         };
         mutable std::vector<OptBound> _optimzedBounds;
 };
 
+/// Same function as a RooMinimizerFcnOpt on a CachingSimNLL, but also providing the gradient:
+/// analytic, or from finite differences evaluated in a single batch (CachingSimNLL::numericalGradient)
+class RooMinimizerGradFcnOpt : public ROOT::Math::IMultiGradFunction {
+    public:
+        RooMinimizerGradFcnOpt(const RooMinimizerFcnOpt &fcn, const cacheutils::CachingSimNLL &nll, bool analytic = true) : fcn_(fcn), nll_(nll), analytic_(analytic) {}
+        virtual RooMinimizerGradFcnOpt * Clone() const { return new RooMinimizerGradFcnOpt(fcn_, nll_, analytic_); }
+        virtual unsigned int NDim() const { return fcn_.NDim(); }
+        virtual void Gradient(const double *x, double *grad) const ;
+        virtual void FdF(const double *x, double &f, double *grad) const ;
+    private:
+        const RooMinimizerFcnOpt & fcn_;
+        const cacheutils::CachingSimNLL & nll_;
+        bool analytic_;
+        void gradient(const std::vector<RooRealVar *> &params, double *grad) const ;
+        virtual double DoEval(const double *x) const { return fcn_(x); }
+        virtual double DoDerivative(const double *x, unsigned int icoord) const ;
+};
+
 #endif
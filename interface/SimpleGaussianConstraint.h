@@ -27,6 +27,15 @@ class SimpleGaussianConstraint : public RooGaussian {
             return _value;
         }
 
+        /// derivative of getLogValFast() with respect to param, valid only if hasFundamentalArgs()
+        double getLogValFastDerivative(const RooAbsArg &param) const { 
+            double ret = 0;
+            if (&x.arg() == &param)    ret += 2*scale_*(x - mean);
+            if (&mean.arg() == &param) ret -= 2*scale_*(x - mean);
+            return ret;
+        }
+        bool hasFundamentalArgs() const { return x.arg().isFundamental() && mean.arg().isFundamental(); }
+
     private:
         double scale_;
         void init() ;
@@ -0,0 +1,29 @@
+#ifndef HiggsAnalysis_CombinedLimit_SimpleThreadPool_h
+#define HiggsAnalysis_CombinedLimit_SimpleThreadPool_h
+
+#include <vector>
+#include <functional>
+
+/** Minimal pool of persistent worker threads.
+    run() gives one list of job indices to each thread (the calling thread takes the first list)
+    and returns only when all lists have been processed. */
+class SimpleThreadPool {
+    public:
+        explicit SimpleThreadPool(unsigned int nthreads) ;
+        ~SimpleThreadPool() ;
+        /// number of threads, including the calling one
+        unsigned int size() const { return nthreads_; }
+        void run(const std::vector<std::vector<int> > &partitions, const std::function<void(int)> &job) ;
+        /// split jobs 0..costs.size()-1 in nthreads lists with similar total cost (greedy, largest first).
+        /// each list is sorted, so that the jobs of one thread are always done in the same order
+        static void partition(const std::vector<double> &costs, unsigned int nthreads, std::vector<std::vector<int> > &out) ;
+    private:
+        struct Impl;
+        Impl *impl_;
+        unsigned int nthreads_;
+        // not copyable
+        SimpleThreadPool(const SimpleThreadPool &other) ;
+        SimpleThreadPool & operator=(const SimpleThreadPool &other) ;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef VectorizedBernstein_h
+#define VectorizedBernstein_h
+
+#include <RooAbsData.h>
+#include "../interface/RooBernsteinFast.h"
+#include <vector>
+
+/// RooBernsteinFast<N> on all the events at once: the coefficients are converted to the power basis
+/// (already divided by the normalization integral), and the polynomial is computed with Horner's rule
+/// on the values of x rescaled to [0,1], which are kept until the range of x changes.
+/// Instantiated for N = 1 .. 7, as in the dictionary.
+template<int N>
+class VectorizedBernstein {
+    class Worker : public RooBernsteinFast<N> {
+        public:
+            Worker(const RooBernsteinFast<N> &pdf) : RooBernsteinFast<N>(pdf, "") {}
+            const RooAbsReal & xvar()  const { return this->_x.arg(); }
+            const RooArgList & coefs() const { return this->_coefList; }
+            double cmatrix(int ipow, int ibern) const { return this->_cmatrix(ipow, ibern); }
+    };
+    public:
+        VectorizedBernstein(const RooBernsteinFast<N> &pdf, const RooAbsData &data) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const RooRealVar * x_;
+        std::vector<const RooAbsReal *> coefs_;
+        double cmatrix_[N+1][N+1];
+        std::vector<Double_t> xvals_;
+        mutable std::vector<Double_t> uvals_;
+        mutable double xmin_, xmax_;
+};
+
+#endif
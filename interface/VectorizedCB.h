@@ -0,0 +1,79 @@
+#ifndef VectorizedCB_h
+#define VectorizedCB_h
+
+#include <RooAbsData.h>
+#include <RooArgSet.h>
+#include "../interface/HZZ2L2QRooPdfs.h"
+#include "../interface/HWWLVJRooPdfs.h"
+#include "../interface/HZZ4LRooPdfs.h"
+#include <vector>
+
+/// Crystal ball of HZZ2L2QRooPdfs (gaussian core with one tail, rotated by theta)
+class VectorizedCB {
+    class Worker : public RooCB {
+        public:
+            Worker(const RooCB &pdf) : RooCB(pdf, "") {}
+            const RooAbsReal & xvar()     const { return x.arg(); }
+            const RooAbsReal & meanvar()  const { return mean.arg(); }
+            const RooAbsReal & widthvar() const { return width.arg(); }
+            const RooAbsReal & alphavar() const { return alpha.arg(); }
+            const RooAbsReal & nvar()     const { return n.arg(); }
+            const RooAbsReal & thetavar() const { return theta.arg(); }
+    };
+    public:
+        VectorizedCB(const RooCB &pdf, const RooAbsData &data) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const RooAbsPdf  * pdf_;
+        RooArgSet          normSet_;
+        const RooAbsReal * mean_, * width_, * alpha_, * n_, * theta_;
+        std::vector<Double_t> xvals_;
+        mutable std::vector<Double_t> work_, work2_;
+};
+
+/// Double-sided crystal ball; RooDoubleCB and RooDoubleCrystalBall are the same function
+template<typename PdfT>
+class VectorizedDoubleCBT {
+    class Worker : public PdfT {
+        public:
+            Worker(const PdfT &pdf) : PdfT(pdf, "") {}
+            const RooAbsReal & xvar()      const { return this->x.arg(); }
+            const RooAbsReal & meanvar()   const { return this->mean.arg(); }
+            const RooAbsReal & widthvar()  const { return this->width.arg(); }
+            const RooAbsReal & alpha1var() const { return this->alpha1.arg(); }
+            const RooAbsReal & n1var()     const { return this->n1.arg(); }
+            const RooAbsReal & alpha2var() const { return this->alpha2.arg(); }
+            const RooAbsReal & n2var()     const { return this->n2.arg(); }
+    };
+    public:
+        VectorizedDoubleCBT(const PdfT &pdf, const RooAbsData &data) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const RooAbsPdf  * pdf_;
+        RooArgSet          normSet_;
+        const RooAbsReal * mean_, * width_, * alpha1_, * n1_, * alpha2_, * n2_;
+        std::vector<Double_t> xvals_;
+        mutable std::vector<Double_t> work_, work2_;
+};
+
+typedef VectorizedDoubleCBT<RooDoubleCB>          VectorizedDoubleCB;
+typedef VectorizedDoubleCBT<RooDoubleCrystalBall> VectorizedDoubleCrystalBall;
+
+/// Double crystal ball convolved with a Breit-Wigner (HZZ4LRooPdfs): all the events in a single call
+/// to the pdf, which with CBXBW_TABLE interpolates them from a table of the convolution
+class VectorizedDoubleCBxBW {
+    class Worker : public RooaDoubleCBxBW {
+        public:
+            Worker(const RooaDoubleCBxBW &pdf) : RooaDoubleCBxBW(pdf, "") {}
+            const RooAbsReal & xvar() const { return x.arg(); }
+    };
+    public:
+        VectorizedDoubleCBxBW(const RooaDoubleCBxBW &pdf, const RooAbsData &data) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const RooaDoubleCBxBW * pdf_;
+        RooArgSet               normSet_;
+        std::vector<Double_t>   xvals_;
+};
+
+#endif
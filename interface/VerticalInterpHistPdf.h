@@ -83,8 +83,17 @@ public:
   const RooArgList& funcList() const { return _funcList ; }
   const RooArgList& coefList() const { return _coefList ; }
 
-  /// Must be public, for serialization
-  struct Morph { FastTemplate sum; FastTemplate diff; };
+  /// Must be public, for serialization.
+  /// Only sum and diff are serialized, and always dense. FastVerticalInterpHistPdf2Base moves their values
+  /// to an array of the pdf, from offset (see FastVerticalInterpHistPdf2Base::compactMorphs). There the morph
+  /// can be sparse: if bins is not empty only the values for those bins (in increasing order) are kept, out of
+  /// nbins. nactive is the number of active bins of the dense ones.
+  struct Morph { 
+      Morph() : nbins(0), nactive(0), offset(0) {}
+      FastTemplate sum; FastTemplate diff; 
+      std::vector<unsigned int> bins; //! not to be serialized
+      unsigned int nbins, nactive, offset; //! not to be serialized
+  };
 
   friend class FastVerticalInterpHistPdf2Base;
 protected:
@@ -250,6 +259,12 @@ public:
 
   /// Must be public, for serialization
   typedef FastVerticalInterpHistPdfBase::Morph Morph;
+
+  /// With VERTINTERP_FLOAT_MORPHS=2, use the morphs in double precision instead of the single precision ones
+  /// (for all the pdfs, that will be resynchronized at the next evaluation)
+  static void setDoubleMorphs(bool doubleMorphs) ;
+  /// The --X-rtd VERTINTERP_FLOAT_MORPHS mode, read once for the whole job
+  static int floatMorphs() ;
 protected:
   RooListProxy _coefList ;  //  List of coefficients
   Double_t     _smoothRegion;
@@ -264,28 +279,89 @@ protected:
   // For additive morphing, histograms of (fUp-f0)+(fDown-f0) and (fUp-f0)-(fDown-f0)
   // For multiplicative morphing, log(fUp/f0)+log(fDown/f0),  log(fUp/f0)-log(fDown/f0)
   // NOTE: it's the responsibility of the daughter to make sure these are initialized!!!
-  std::vector<Morph> _morphs;  
+  // mutable, as they are compacted at the first syncTotal (see compactMorphs)
+  mutable std::vector<Morph> _morphs;  
 
   // Coefficients of the list in _coefList, already dynamic_cast'ed and in a vector
   mutable std::vector<const RooAbsReal *> _morphParams; //! not to be serialized
 
+  // With --X-rtd VERTINTERP_RESYNC=N, the morphed template before the final Exp() or CropUnderflows(),
+  // the (0.5*x, 0.5*x*smoothStepFunc(x)) applied for each morph, and the number of incremental updates
+  // since the last full sync: syncTotal then only adds the change of the morphs whose parameter moved.
+  // It's off by default: the result then depends on the previous evaluations at the level of the rounding
+  // errors, so fits are not reproducible bit by bit (testFastVerticalInterpHistPdf2Resync checks the difference)
+  mutable FastTemplate _morphSum; //! not to be serialized
+  mutable std::vector<double> _morphApplied; //! not to be serialized
+  mutable unsigned int _deltaUpdates; //! not to be serialized
+
+  // The morphs are created and read dense, and compacted at the first syncTotal: those with few bins that are
+  // not null become sparse (unless --X-rtd VERTINTERP_DENSE_MORPHS), and the values of all of them are moved
+  // from sum and diff to _morphValues, a single array from the fasttemplate arena. For each morph it holds sum
+  // then diff, each starting on a 64 byte boundary, so the morphs of the pdf are contiguous and aligned.
+  // With --X-rtd VERTINTERP_FLOAT_MORPHS=1 they are then kept only in single precision, in _morphFloats at the
+  // same offsets, to save memory (the morphing is still computed in double precision). With
+  // VERTINTERP_FLOAT_MORPHS=2 the double precision ones are kept too, and CachingSimNLL reports from time to
+  // time the difference in the NLL between the two (see setDoubleMorphs).
+  // restoreMorphs puts them back in sum and diff, dense, and is called before writing the pdf (see Streamer):
+  // the ones kept only in single precision are then written rounded to it.
+  mutable std::vector<double, fasttemplate::Allocator<double> > _morphValues; //! not to be serialized
+  mutable std::vector<float, fasttemplate::Allocator<float> > _morphFloats; //! not to be serialized
+  mutable bool _morphsCompacted; //! not to be serialized
+  void compactMorphs() const ;
+  void restoreMorphs() const ;
+  // Values of the morph in _morphValues, and their number padded to 64 bytes (the offset of diff from sum)
+  static unsigned int morphSize(const Morph &m) { return m.bins.empty() ? m.nbins : m.bins.size(); }
+  static unsigned int morphStride(const Morph &m) { return (morphSize(m) + 7) & ~7u; }
+  const double * morphSum(const Morph &m) const { return _morphValues.data() + m.offset; }
+  const double * morphDiff(const Morph &m) const { return _morphValues.data() + m.offset + morphStride(m); }
+  const float * morphFloatSum(const Morph &m) const { return _morphFloats.data() + m.offset; }
+  const float * morphFloatDiff(const Morph &m) const { return _morphFloats.data() + m.offset + morphStride(m); }
+  // use the single precision morphs, if there are any
+  bool useMorphFloats() const { return !_morphFloats.empty() && !doubleMorphs_; }
+
+  // Coefficients of diff and sum for each morph in the current syncTotal, and working space for meldAll
+  mutable std::vector<double> _morphCoeffs; //! not to be serialized
+  mutable std::vector<unsigned int> _morphCursors; //! not to be serialized
+
   // Prepare morphing data for a triplet of templates
   void initMorph(Morph &out, const FastTemplate &nominal, FastTemplate &lo, FastTemplate &hi) const;
 
+  // Make the morph sparse (i.e. list in bins those that are not null), if few of its bins are not null
+  static void sparsifyMorph(Morph &morph) ;
+
   // Do the vertical morphing from nominal value and morphs into cache. 
   // Do not normalize yet, as that depends on the dimension of the template
   void syncTotal(FastTemplate &cache, const FastTemplate &cacheNominal, const FastTemplate &cacheNominalLog) const ;
 
+  // Add to sum (after setting it to start, if not null) all the morphs with the coefficients in _morphCoeffs,
+  // and put in out its exponential (_smoothAlgo < 0) or its values cropped at 1e-9, in a single pass
+  // over tiles of bins. sum and out can be the same template
+  void meldAll(const FastTemplate *start, FastTemplate &sum, FastTemplate &out) const ;
+
   // return a smooth function that is equal to +/-1 for |x| >= smoothRegion_ and it's null in zero
   inline double smoothStepFunc(double x) const { 
     if (fabs(x) >= _smoothRegion) return x > 0 ? +1 : -1;
     double xnorm = x/_smoothRegion, xnorm2 = xnorm*xnorm;
     return 0.125 * xnorm * (xnorm2 * (3.*xnorm2 - 10.) + 15);
   }
+  // derivative of smoothStepFunc
+  inline double smoothStepFuncDerivative(double x) const { 
+    if (fabs(x) >= _smoothRegion) return 0;
+    double xnorm = x/_smoothRegion, xnorm2 = xnorm*xnorm;
+    return 1.875 * (xnorm2 - 1) * (xnorm2 - 1) / _smoothRegion;
+  }
+
+  // Add to out the derivative of the (un-normalized, and for _smoothAlgo < 0 logarithmic) morphed template
+  // with respect to param. Returns false if param is not one of the morphing parameters
+  bool addMorphDerivative(const RooAbsArg &param, double *out) const ;
 
   // initialize the morphParams and the sentry. to be called by the daughter class, sets also _initBase to true
   void initBase() const ; 
 
+  // variable that all the sentries depend upon with VERTINTERP_FLOAT_MORPHS=2, to resync after setDoubleMorphs
+  static RooRealVar & storageSwitch() ;
+  static bool doubleMorphs_;
+
 private:
   ClassDef(FastVerticalInterpHistPdf2Base,1) // 
 };
@@ -295,13 +371,13 @@ struct FastVerticalInterpHistPdf2V;
 class FastVerticalInterpHistPdf2 : public FastVerticalInterpHistPdf2Base {
 public:
 
-  FastVerticalInterpHistPdf2() : FastVerticalInterpHistPdf2Base() {}
+  FastVerticalInterpHistPdf2() : FastVerticalInterpHistPdf2Base(), _cacheNorm(0) {}
   FastVerticalInterpHistPdf2(const char *name, const char *title, const RooRealVar &x, const TList & funcList, const RooArgList& coefList, Double_t smoothRegion=1., Int_t smoothAlgo=1) ;
 
   FastVerticalInterpHistPdf2(const FastVerticalInterpHistPdf2& other, const char* name=0) :
     FastVerticalInterpHistPdf2Base(other, name),
     _x("x",this,other._x),
-    _cache(other._cache), _cacheNominal(other._cacheNominal), _cacheNominalLog(other._cacheNominalLog)  {}
+    _cache(other._cache), _cacheNorm(other._cacheNorm), _cacheNominal(other._cacheNominal), _cacheNominalLog(other._cacheNominalLog)  {}
   explicit FastVerticalInterpHistPdf2(const FastVerticalInterpHistPdf& other, const char* name=0) ;
   virtual TObject* clone(const char* newname) const { return new FastVerticalInterpHistPdf2(*this,newname) ; }
   virtual ~FastVerticalInterpHistPdf2() {}
@@ -309,12 +385,18 @@ public:
   virtual void setActiveBins(unsigned int bins) ;
   Double_t evaluate() const ;
 
+  /// Fill out with the derivative of the normalized template with respect to param.
+  /// Returns false if param is not one of the morphing parameters (e.g. if the pdf depends on it only through a function)
+  bool derivative(const RooAbsArg &param, std::vector<Double_t> &out) const ;
+
   friend class FastVerticalInterpHistPdf2V;
 protected:
   RooRealProxy   _x;
 
   /// Cache of the result
   mutable FastHisto _cache; //! not to be serialized
+  /// Normalization of the cache before it was normalized (0 if not known)
+  mutable double _cacheNorm; //! not to be serialized
 
   /// Cache of nominal pdf (additive morphing) and its bin-by-bin logarithm (multiplicative)
   FastHisto _cacheNominal; 
@@ -331,6 +413,11 @@ class FastVerticalInterpHistPdf2V {
     public: 
         FastVerticalInterpHistPdf2V(const FastVerticalInterpHistPdf2 &, const RooAbsData &data) ;
         void fill(std::vector<Double_t> &out) const ;
+        /// the same values as fill, in place in the cache of the pdf, if the entries of the dataset are
+        /// a contiguous range of bins (null otherwise). They are valid until the next change of the parameters
+        const Double_t * values() const ;
+        /// fill out with the derivative of the values with respect to param (see FastVerticalInterpHistPdf2::derivative)
+        bool fillDerivative(const RooAbsArg &param, std::vector<Double_t> &out) const ;
     private:
         const FastVerticalInterpHistPdf2 & hpdf_;
         int begin_, end_, nbins_;
@@ -340,10 +427,14 @@ class FastVerticalInterpHistPdf2V {
         };
         std::vector<Block> blocks_;
         std::vector<int> bins_;
+        mutable std::vector<Double_t> work_;
+        // pick from values (one per bin of the template) those corresponding to the entries of the dataset
+        void gather(const Double_t *values, std::vector<Double_t> &out) const ;
 };
 
 
 
+struct FastVerticalInterpHistPdf2D2V;
 class FastVerticalInterpHistPdf2D2 : public FastVerticalInterpHistPdf2Base {
 public:
 
@@ -363,6 +454,8 @@ public:
   Bool_t conditional() const { return _conditional; }
 
   Double_t evaluate() const ;
+
+  friend class FastVerticalInterpHistPdf2D2V;
 protected:
   RooRealProxy _x, _y;
   bool _conditional;
@@ -381,6 +474,24 @@ protected:
 private:
   ClassDef(FastVerticalInterpHistPdf2D2,1) // 
 };
+class FastVerticalInterpHistPdf2D2V {
+    public: 
+        FastVerticalInterpHistPdf2D2V(const FastVerticalInterpHistPdf2D2 &, const RooAbsData &data) ;
+        void fill(std::vector<Double_t> &out) const ;
+        /// as FastVerticalInterpHistPdf2V::values
+        const Double_t * values() const ;
+    private:
+        const FastVerticalInterpHistPdf2D2 & hpdf_;
+        // ranges of the flattened bins of the template (ix * binY + iy), as in FastVerticalInterpHistPdf2V;
+        // if some entries are outside of the template, they're all picked one by one, with -1 for those outside
+        int begin_, end_, nbins_;
+        struct Block { 
+            int index, begin, end; 
+            Block(int i, int begin_, int end_) : index(i), begin(begin_), end(end_) {}
+        };
+        std::vector<Block> blocks_;
+        std::vector<int> bins_;
+};
 
 
 
@@ -61,6 +61,13 @@ void cacheutils::CachingMultiPdf::setDataDirty()
     }
 }
 
+void cacheutils::CachingMultiPdf::bindParamMirror(const ParamMirror *mirror)
+{
+    for (CachingPdfBase &pdf : cachingPdfs_) {
+        pdf.bindParamMirror(mirror);
+    }
+}
+
 cacheutils::CachingAddPdf::CachingAddPdf(const RooAddPdf &pdf, const RooArgSet &obs) :
     pdf_(&pdf)
 {
@@ -114,3 +121,10 @@ void cacheutils::CachingAddPdf::setDataDirty()
     }
 }
 
+void cacheutils::CachingAddPdf::bindParamMirror(const ParamMirror *mirror)
+{
+    for (CachingPdfBase &pdf : cachingPdfs_) {
+        pdf.bindParamMirror(mirror);
+    }
+}
+
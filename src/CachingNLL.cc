@@ -1,23 +1,45 @@
 #include "../interface/CachingNLL.h"
 #include "../interface/utils.h"
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <RooCategory.h>
 #include <RooDataSet.h>
 #include <RooProduct.h>
 #include "../interface/ProfilingTools.h"
 #include <../interface/RooMultiPdf.h>
 #include <../interface/VerticalInterpHistPdf.h>
+#include <../interface/HorizontalInterpHistPdf.h>
 #include <../interface/VectorizedGaussian.h>
 #include <../interface/VectorizedSimplePdfs.h>
+#include <../interface/VectorizedCB.h>
+#include <../interface/VectorizedBernstein.h>
 #include <../interface/CachingMultiPdf.h>
+#include <../interface/ProcessNormalization.h>
+#include "../interface/SimpleThreadPool.h"
+#include "../interface/FastConstraintTerms.h"
 #include "vectorized.h"
 
 namespace cacheutils {
     typedef OptimizedCachingPdfT<FastVerticalInterpHistPdf,FastVerticalInterpHistPdfV> CachingHistPdf;
     typedef OptimizedCachingPdfT<FastVerticalInterpHistPdf2,FastVerticalInterpHistPdf2V> CachingHistPdf2;
+    typedef OptimizedCachingPdfT<FastVerticalInterpHistPdf2D2,FastVerticalInterpHistPdf2D2V> CachingHistPdf2D2;
+    typedef OptimizedCachingPdfT<FastHorizontalInterpHistPdf,FastHorizontalInterpHistPdfV> CachingHorizHistPdf;
     typedef OptimizedCachingPdfT<RooGaussian,VectorizedGaussian> CachingGaussPdf;
     typedef OptimizedCachingPdfT<RooExponential,VectorizedExponential> CachingExpoPdf;
     typedef OptimizedCachingPdfT<RooPower,VectorizedPower> CachingPowerPdf;
+    typedef OptimizedCachingPdfT<RooCB,VectorizedCB> CachingCBPdf;
+    typedef OptimizedCachingPdfT<RooDoubleCB,VectorizedDoubleCB> CachingDoubleCBPdf;
+    typedef OptimizedCachingPdfT<RooDoubleCrystalBall,VectorizedDoubleCrystalBall> CachingDoubleCrystalBallPdf;
+    typedef OptimizedCachingPdfT<RooaDoubleCBxBW,VectorizedDoubleCBxBW> CachingDoubleCBxBWPdf;
+
+    // RooBernsteinFast<N>, for N from 1 to 7: returns null if pdf is none of them
+    template<int N> CachingPdfBase * makeCachingBernsteinPdf(RooAbsReal *pdf, const RooArgSet *obs) {
+        if (typeid(*pdf) == typeid(RooBernsteinFast<N>)) return new OptimizedCachingPdfT<RooBernsteinFast<N>,VectorizedBernstein<N> >(pdf, obs);
+        return makeCachingBernsteinPdf<N-1>(pdf, obs);
+    }
+    template<> CachingPdfBase * makeCachingBernsteinPdf<0>(RooAbsReal *pdf, const RooArgSet *obs) { return 0; }
 
     class ReminderSum : public RooAbsReal {
         public:
@@ -48,9 +70,35 @@ namespace cacheutils {
 //---- Uncomment to dump PDF values inside CachingAddNLL
 //#define LOG_ADDPDFS
 
-//---- Uncomment to enable Kahan's summation (if enabled at runtime with --X-rtd = ...
+//---- Run with --X-rtd ADDNLL_KAHAN_SUM=1 to use Kahan's summation in CachingAddNLL (vectorized, with 8 partial sums)
 // http://en.wikipedia.org/wiki/Kahan_summation_algorithm
-//#define ADDNLL_KAHAN_SUM
+
+//---- With ADDNLL_BINNED_FASTPATH (on by default in combine) the CachingAddNLL of a RooAddPdf works
+//     directly on the expected yields, sum_i (nu_i - n_i log nu_i), instead of normalizing the pdf
+//     and adding back N log(sumCoeff). The result is the same up to rounding.
+
+//---- With ADDNLL_HIST_INPLACE (on by default in combine) the CachingAddNLL reads the values of the
+//     FastVerticalInterpHistPdf2, FastVerticalInterpHistPdf2D2 and FastHorizontalInterpHistPdf straight from their morphed templates,
+//     when the bins of the data are a contiguous range of those of the template, so that the sum over
+//     the processes is done in one pass over the templates without copying them in the caches of the CachingPdfs
+
+//---- With SIMNLL_FASTCONSTRAINTS (on by default in combine) also the RooPoisson, RooGamma and RooLognormal
+//     constraints are computed together with the gaussian ones in flat arrays (see FastConstraintTerms)
+
+//---- With ADDNLL_CBNLL (on by default in combine) the RooCB, RooDoubleCB and RooDoubleCrystalBall pdfs
+//     are computed for all the events at once with vdt (see VectorizedCB), and so is RooaDoubleCBxBW
+//     (interpolated from a table of the convolution with --X-rtd CBXBW_TABLE=N, see HZZ4LRooPdfs.h)
+
+//---- Run with --X-rtd SIMNLL_THREADS=N to evaluate the channels of CachingSimNLL using N threads
+//     (only the arithmetics on the cached pdf values is parallel, the RooFit part is still serial)
+
+//---- CachingSimNLL recomputes only the channels that depend on parameters that changed since the
+//     last evaluation; run with --X-rtd SIMNLL_NO_INCREMENTAL=1 to rely only on the RooFit dirty flags
+//     The parameter values are read once per evaluation into a flat buffer, from which the caches of
+//     the pdfs check what changed; run with --X-rtd SIMNLL_NO_PARAM_MIRROR=1 to read them one by one
+
+//---- Run with --X-rtd VERTINTERP_FLOAT_MORPHS=1 to keep the morphs of FastVerticalInterpHistPdf2 in single
+//     precision, or with VERTINTERP_FLOAT_MORPHS=2 to print how much that changes the NLL (see validateFloatMorphs_)
 #include "../interface/ProfilingTools.h"
 
 //std::map<std::string,double> cacheutils::CachingAddNLL::offsets_;
@@ -100,8 +148,59 @@ namespace {
 namespace { unsigned long CachingSimNLLEvalCount = 0; }
 #endif
 
-cacheutils::ArgSetChecker::ArgSetChecker(const RooAbsCollection &set) 
+namespace {
+    // step for the numerical derivatives: a small fraction of the uncertainty, if known
+    double finiteDifferenceStep(const RooRealVar &param) {
+        double err = param.getError();
+        return (err > 0 ? 1e-3 * err : 1e-4 * std::max(1.0, std::abs(param.getVal())));
+    }
+    // central difference of func() when moving param, using the values actually set
+    // (so that it becomes a one-sided difference at the boundaries); param is restored at the end
+    template<typename Func>
+    double finiteDifference(RooRealVar &param, const Func &func) {
+        double val = param.getVal(), h = finiteDifferenceStep(param);
+        param.setVal(val + h); double xp = param.getVal(), fp = func();
+        param.setVal(val - h); double xm = param.getVal(), fm = func();
+        param.setVal(val);
+        return (xp != xm ? (fp - fm)/(xp - xm) : 0.0);
+    }
+}
+
+void
+cacheutils::ParamMirror::setup(const std::vector<RooRealVar *> &vars, const std::vector<RooAbsCategory *> &cats) 
+{
+    vars_ = vars; cats_ = cats;
+    values_.resize(vars.size() + cats.size());
+    index_.clear();
+    for (int i = 0, n = vars.size(); i < n; ++i) index_[vars[i]] = i;
+    for (int i = 0, n = cats.size(), nv = vars.size(); i < n; ++i) index_[cats[i]] = nv + i;
+    valid_ = false;
+}
+
+int
+cacheutils::ParamMirror::indexOf(const RooAbsArg *arg) const 
+{
+    std::map<const RooAbsArg *, int>::const_iterator match = index_.find(arg);
+    return (match == index_.end() ? -1 : match->second);
+}
+
+void
+cacheutils::ParamMirror::sync() 
+{
+    std::vector<double>::iterator itv = values_.begin();
+    for (std::vector<RooRealVar *>::const_iterator it = vars_.begin(), ed = vars_.end(); it != ed; ++it, ++itv) {
+        *itv = (*it)->getVal();
+    }
+    for (std::vector<RooAbsCategory *>::const_iterator itc = cats_.begin(), edc = cats_.end(); itc != edc; ++itc, ++itv) {
+        *itv = (*itc)->getIndex();
+    }
+    valid_ = true;
+}
+
+cacheutils::ArgSetChecker::ArgSetChecker(const RooAbsCollection &set) :
+    mirror_(0)
 {
+    std::vector<double> states;
     std::auto_ptr<TIterator> iter(set.createIterator());
     for (RooAbsArg *a  = dynamic_cast<RooAbsArg *>(iter->Next()); 
                     a != 0; 
@@ -115,14 +214,39 @@ cacheutils::ArgSetChecker::ArgSetChecker(const RooAbsCollection &set)
         RooCategory *cat =  dynamic_cast<RooCategory *>(a);
         if (cat) {
             cats_.push_back(cat);
-            states_.push_back(cat->getIndex()); 
+            states.push_back(cat->getIndex()); 
         }
     }
+    vals_.insert(vals_.end(), states.begin(), states.end());
+}
+
+void
+cacheutils::ArgSetChecker::bind(const ParamMirror *mirror) 
+{
+    mirror_ = 0; mirrorIndex_.clear();
+    if (mirror == 0) return;
+    std::vector<int32_t> index;
+    for (std::vector<RooRealVar *>::const_iterator it = vars_.begin(), ed = vars_.end(); it != ed; ++it) {
+        index.push_back(mirror->indexOf(*it));
+        if (index.back() == -1) return;
+    }
+    for (std::vector<RooCategory *>::const_iterator itc = cats_.begin(), edc = cats_.end(); itc != edc; ++itc) {
+        index.push_back(mirror->indexOf(*itc));
+        if (index.back() == -1) return;
+    }
+    mirror_ = mirror; 
+    mirrorIndex_.swap(index);
 }
 
 bool 
 cacheutils::ArgSetChecker::changed(bool updateIfChanged) 
 {
+    if (vals_.empty()) return false;
+    if (mirror_ != 0 && mirror_->valid()) {
+        if (vectorized::count_changed(vals_.size(), &mirrorIndex_[0], mirror_->values(), &vals_[0]) == 0) return false;
+        if (updateIfChanged) vectorized::gather(vals_.size(), &mirrorIndex_[0], mirror_->values(), &vals_[0]);
+        return true;
+    }
     bool changed = false;
     std::vector<RooRealVar *>::const_iterator it = vars_.begin(), ed = vars_.end();
     std::vector<double>::iterator itv = vals_.begin();
@@ -135,14 +259,15 @@ cacheutils::ArgSetChecker::changed(bool updateIfChanged)
             else break;
         }
     }
+    if (changed && !updateIfChanged) return true;
     std::vector<RooCategory *>::const_iterator itc = cats_.begin(), edc = cats_.end();
-    std::vector<int>::iterator itvc = states_.begin();
-    for ( ; itc != edc; ++itc, ++itvc) {
+    itv = vals_.begin() + vars_.size();
+    for ( ; itc != edc; ++itc, ++itv) {
         int val = (*itc)->getIndex();
-        if (val != *itvc) { 
-            //std::cerr << "cat::CachingPdf " << (*itc)->GetName() << " changed: " << *itvc << " -> " << val << std::endl;
+        if (val != *itv) { 
+            //std::cerr << "cat::CachingPdf " << (*itc)->GetName() << " changed: " << *itv << " -> " << val << std::endl;
             changed = true; 
-            if (updateIfChanged) { *itvc = val; }
+            if (updateIfChanged) { *itv = val; }
             else break;
         }
     }
@@ -150,84 +275,133 @@ cacheutils::ArgSetChecker::changed(bool updateIfChanged)
     return changed;
 }
 
+void
+cacheutils::ArgSetChecker::values(std::vector<double> &out) const 
+{
+    out.resize(vals_.size());
+    if (out.empty()) return;
+    if (mirror_ != 0 && mirror_->valid()) {
+        vectorized::gather(vals_.size(), &mirrorIndex_[0], mirror_->values(), &out[0]);
+        return;
+    }
+    std::vector<double>::iterator ito = out.begin();
+    for (std::vector<RooRealVar *>::const_iterator it = vars_.begin(), ed = vars_.end(); it != ed; ++it, ++ito) {
+        *ito = (*it)->getVal();
+    }
+    for (std::vector<RooCategory *>::const_iterator itc = cats_.begin(), edc = cats_.end(); itc != edc; ++itc, ++ito) {
+        *ito = (*itc)->getIndex();
+    }
+}
+
+namespace {
+    // keeps a ParamMirror valid until the end of the scope
+    struct MirrorScope {
+        cacheutils::ParamMirror &mirror;
+        MirrorScope(cacheutils::ParamMirror &m) : mirror(m) { mirror.sync(); }
+        ~MirrorScope() { mirror.invalidate(); }
+    };
+
+    std::size_t hashValues(const std::vector<double> &values) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (std::vector<double>::const_iterator it = values.begin(), ed = values.end(); it != ed; ++it) {
+            uint64_t bits; std::memcpy(&bits, &*it, sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ULL;
+            hash ^= (hash >> 32);
+        }
+        return std::size_t(hash);
+    }
+}
+
+std::size_t cacheutils::ValuesCache::totalBytes_ = 0;
+
 cacheutils::ValuesCache::ValuesCache(const RooAbsCollection &params, int size) :
-    size_(1),
-    maxSize_(size)
+    params_(params),
+    items_(1, new Item()),
+    maxSize_(std::max(1, size))
 {
-    assert(size <= MaxItems_);
-    items[0] = new Item(params);
 }
+
 cacheutils::ValuesCache::ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size) :
-    size_(1),
-    maxSize_(size)
+    params_(*std::auto_ptr<RooArgSet>(pdf.getParameters(obs))),
+    items_(1, new Item()),
+    maxSize_(std::max(1, size))
 {
-    assert(size <= MaxItems_);
-    std::auto_ptr<RooArgSet> params(pdf.getParameters(obs));
-    //std::cout << "Parameters for pdf " << pdf.GetName() << " (" << pdf.ClassName() << "):"; params->Print("");
-    items[0] = new Item(*params);
 }
 
-
 cacheutils::ValuesCache::~ValuesCache() 
 {
-    for (int i = 0; i < size_; ++i) delete items[i];
+    for (std::vector<Item *>::iterator it = items_.begin(), ed = items_.end(); it != ed; ++it) {
+        totalBytes_ -= (*it)->bytes;
+        delete *it;
+    }
 }
 
 void cacheutils::ValuesCache::clear() 
 {
-    for (int i = 0; i < size_; ++i) items[i]->good = false;
+    for (std::vector<Item *>::iterator it = items_.begin(), ed = items_.end(); it != ed; ++it) (*it)->good = false;
+}
+
+int cacheutils::ValuesCache::sizeFor(const RooAbsReal &pdf) 
+{
+    int size = runtimedef::get(std::string("CACHINGPDF_SIZE_") + pdf.ClassName());
+    if (size <= 0) size = runtimedef::get("CACHINGPDF_SIZE");
+    return (size > 0 ? size : int(DefaultSize));
+}
+
+void cacheutils::ValuesCache::account_(Item &item) 
+{
+    std::size_t bytes = (item.values.capacity() + item.key.capacity()) * sizeof(double);
+    totalBytes_ -= item.bytes;
+    totalBytes_ += bytes;
+    item.bytes = bytes;
 }
 
 std::pair<std::vector<Double_t> *, bool> cacheutils::ValuesCache::get() 
 {
-    int found = -1; bool good = false;
-    for (int i = 0; i < size_; ++i) {
-        if (items[i]->good) {
-            // valid entry, check if fresh
-            if (!items[i]->checker.changed()) {
-#ifdef DEBUG_CACHE
-                PerfCounter::add(i == 0 ? "ValuesCache::get hit first" : "ValuesCache::get hit other");
-#endif
-                // fresh: done! 
-                found = i; 
-                good = true; 
-                break;
-            } 
-        } else if (found == -1) {
-            // invalid entry, can be replaced
-            found = i;
-#ifdef DEBUG_CACHE
-            PerfCounter::add("ValuesCache::get hit invalid");
-#endif
+    static PerfCounter & hits = PerfCounter::get("ValuesCache hits");
+    static PerfCounter & misses = PerfCounter::get("ValuesCache misses");
+    static PerfCounter & recycled = PerfCounter::get("ValuesCache items recycled");
+    static std::size_t maxBytes = std::size_t(runtimedef::get("CACHINGPDF_MAXMB") > 0 ? runtimedef::get("CACHINGPDF_MAXMB") : int(DefaultMaxMB)) << 20;
+
+    account_(*items_.front()); // the caller may have filled it after the last call
+    // the first item is always the one for the values seen at the last call, so if none of them
+    // changed (checked on the ParamMirror, when bound) there's no need to compute and search the key
+    if (!params_.changed(true) && items_.front()->good) {
+        hits.add();
+        return std::pair<std::vector<Double_t> *, bool>(&items_.front()->values, true);
+    }
+    const std::vector<double> &key = params_.lastValues();
+    std::size_t hash = hashValues(key);
+    int found = -1, n = items_.size();
+    for (int i = 0; i < n; ++i) {
+        const Item &item = *items_[i];
+        if (item.good && item.hash == hash && item.key == key) { found = i; break; }
+    }
+    bool good = (found != -1);
+    if (good) {
+        hits.add();
+    } else {
+        misses.add();
+        // take the oldest invalid entry; if there's none, make a new one if allowed, or recycle the oldest one
+        for (int i = n-1; i >= 0; --i) {
+            if (!items_[i]->good) { found = i; break; }
         }
-    } 
-    if (found == -1) {
-        // all entries are valid but old 
-#ifdef DEBUG_CACHE
-        PerfCounter::add("ValuesCache::get miss");
-#endif
-        if (size_ < maxSize_) {
-            // if I can, make a new entry
-            items[size_] = new Item(items[0]->checker); // create a new item, copying the ArgSetChecker from the first one
-            found = size_; 
-            size_++;
-        } else {
-            // otherwise, pick the last one
-            found = size_-1;
+        if (found == -1) {
+            if (n < maxSize_ && totalBytes_ + items_.front()->bytes <= maxBytes) {
+                items_.push_back(new Item());
+            } else {
+                recycled.add();
+            }
+            found = items_.size()-1;
         }
+        Item &item = *items_[found];
+        item.key = key; 
+        item.hash = hash;
+        item.good = true;
     }
-    // make sure new entry is the first one
-    if (found != 0) {
-        // remember what found is pointing to
-        Item *f = items[found];
-        // shift the other items down one place
-        while (found > 0) { items[found] = items[found-1]; --found; } 
-        // and put found on top
-        items[found] = f;
-    }
-    if (!good) items[found]->checker.changed(true); // store new values in cache sentry
-    items[found]->good = true;                      // mark this as valid entry
-    return std::pair<std::vector<Double_t> *, bool>(&items[found]->values, good);
+    // make sure the entry is the first one
+    if (found != 0) std::rotate(items_.begin(), items_.begin()+found, items_.begin()+found+1);
+    return std::pair<std::vector<Double_t> *, bool>(&items_.front()->values, good);
 }
 
 cacheutils::CachingPdf::CachingPdf(RooAbsReal *pdf, const RooArgSet *obs) :
@@ -236,7 +410,7 @@ cacheutils::CachingPdf::CachingPdf(RooAbsReal *pdf, const RooArgSet *obs) :
     pdfPieces_(),
     pdf_(utils::fullCloneFunc(pdf, pdfPieces_)),
     lastData_(0),
-    cache_(*pdf_,*obs_)
+    cache_(*pdf_,*obs_,ValuesCache::sizeFor(*pdf_))
 {
 }
 
@@ -246,7 +420,7 @@ cacheutils::CachingPdf::CachingPdf(const CachingPdf &other) :
     pdfPieces_(),
     pdf_(utils::fullCloneFunc(pdfOriginal_, pdfPieces_)),
     lastData_(0),
-    cache_(*pdf_,*obs_)
+    cache_(*pdf_,*obs_,ValuesCache::sizeFor(*pdf_))
 {
 }
 
@@ -314,6 +488,22 @@ cacheutils::CachingPdf::realFill_(const RooAbsData &data, std::vector<Double_t>
 }
 
 
+void
+cacheutils::CachingPdfBase::evalDerivative(const RooAbsData &data, RooRealVar &param, std::vector<Double_t> &out) 
+{
+#ifdef DEBUG_CACHE
+    PerfCounter::add("CachingPdfBase::evalDerivative numerical");
+#endif
+    double val = param.getVal(), h = finiteDifferenceStep(param);
+    param.setVal(val + h); double xp = param.getVal();
+    out = eval(data);
+    param.setVal(val - h); double xm = param.getVal();
+    const std::vector<Double_t> &vm = eval(data);
+    param.setVal(val);
+    double inv = (xp != xm ? 1.0/(xp - xm) : 0.0);
+    for (unsigned int i = 0, n = out.size(); i < n; ++i) out[i] = (out[i] - vm[i]) * inv;
+}
+
 template <typename PdfT, typename VPdfT>
 void
 cacheutils::OptimizedCachingPdfT<PdfT,VPdfT>::newData_(const RooAbsData &data) 
@@ -334,6 +524,64 @@ cacheutils::OptimizedCachingPdfT<PdfT,VPdfT>::realFill_(const RooAbsData &data,
     vpdf_->fill(vals);
 }
 
+template <typename PdfT, typename VPdfT>
+void
+cacheutils::OptimizedCachingPdfT<PdfT,VPdfT>::evalDerivative(const RooAbsData &data, RooRealVar &param, std::vector<Double_t> &out) 
+{
+    CachingPdfBase::evalDerivative(data, param, out);
+}
+
+template <typename PdfT, typename VPdfT>
+const Double_t *
+cacheutils::OptimizedCachingPdfT<PdfT,VPdfT>::evalInPlace(const RooAbsData &data) 
+{
+    return 0;
+}
+
+namespace cacheutils {
+template<>
+void
+OptimizedCachingPdfT<FastVerticalInterpHistPdf2,FastVerticalInterpHistPdf2V>::evalDerivative(const RooAbsData &data, RooRealVar &param, std::vector<Double_t> &out) 
+{
+    // analytic through the morphing, unless the pdf has parameters that are not morphing ones
+    if (lastData_ == &data && vpdf_ != 0 && vpdf_->fillDerivative(param, out)) return;
+    CachingPdfBase::evalDerivative(data, param, out);
+}
+
+template<>
+const Double_t *
+OptimizedCachingPdfT<FastVerticalInterpHistPdf2,FastVerticalInterpHistPdf2V>::evalInPlace(const RooAbsData &data) 
+{
+#ifdef DEBUG_CACHE
+    PerfCounter::add("CachingHistPdf2::evalInPlace called");
+#endif
+    if (lastData_ != &data) newData_(data);
+    return vpdf_->values();
+}
+
+template<>
+const Double_t *
+OptimizedCachingPdfT<FastVerticalInterpHistPdf2D2,FastVerticalInterpHistPdf2D2V>::evalInPlace(const RooAbsData &data) 
+{
+#ifdef DEBUG_CACHE
+    PerfCounter::add("CachingHistPdf2D2::evalInPlace called");
+#endif
+    if (lastData_ != &data) newData_(data);
+    return vpdf_->values();
+}
+
+template<>
+const Double_t *
+OptimizedCachingPdfT<FastHorizontalInterpHistPdf,FastHorizontalInterpHistPdfV>::evalInPlace(const RooAbsData &data) 
+{
+#ifdef DEBUG_CACHE
+    PerfCounter::add("CachingHorizHistPdf::evalInPlace called");
+#endif
+    if (lastData_ != &data) newData_(data);
+    return vpdf_->values();
+}
+}
+
 
 cacheutils::ReminderSum::ReminderSum(const char *name, const char *title, const RooArgList& sumSet) :
     RooAbsReal(name,title),
@@ -355,7 +603,10 @@ cacheutils::CachingAddNLL::CachingAddNLL(const char *name, const char *title, Ro
     RooAbsReal(name, title),
     pdf_(pdf),
     params_("params","parameters",this),
-    zeroPoint_(0)
+    zeroPoint_(0),
+    sumCoeff_(0), reduced_(0), firstUnderflow_(0), underflows_(0),
+    gradientReady_(false),
+    batchSize_(0), batchStoreUsed_(0)
 {
     if (pdf == 0) throw std::invalid_argument(std::string("Pdf passed to ")+name+" is null");
     setData(*data);
@@ -366,7 +617,10 @@ cacheutils::CachingAddNLL::CachingAddNLL(const CachingAddNLL &other, const char
     RooAbsReal(name ? name : (TString("nll_")+other.pdf_->GetName()).Data(), ""),
     pdf_(other.pdf_),
     params_("params","parameters",this),
-    zeroPoint_(0)
+    zeroPoint_(0),
+    sumCoeff_(0), reduced_(0), firstUnderflow_(0), underflows_(0),
+    gradientReady_(false),
+    batchSize_(0), batchStoreUsed_(0)
 {
     setData(*other.data_);
     setup_();
@@ -427,17 +681,32 @@ cacheutils::makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) {
     static bool histNll  = runtimedef::get("ADDNLL_HISTNLL");
     static bool gaussNll  = runtimedef::get("ADDNLL_GAUSSNLL");
     static bool multiNll  = runtimedef::get("ADDNLL_MULTINLL");
+    static bool cbNll  = runtimedef::get("ADDNLL_CBNLL");
 
     if (histNll && typeid(*pdf) == typeid(FastVerticalInterpHistPdf)) {
         return new CachingHistPdf(pdf, obs);
     } else if (histNll && typeid(*pdf) == typeid(FastVerticalInterpHistPdf2)) {
         return new CachingHistPdf2(pdf, obs);
+    } else if (histNll && typeid(*pdf) == typeid(FastVerticalInterpHistPdf2D2)) {
+        return new CachingHistPdf2D2(pdf, obs);
+    } else if (histNll && typeid(*pdf) == typeid(FastHorizontalInterpHistPdf)) {
+        return new CachingHorizHistPdf(pdf, obs);
     } else if (gaussNll && typeid(*pdf) == typeid(RooGaussian)) {
         return new CachingGaussPdf(pdf, obs);
     } else if (gaussNll && typeid(*pdf) == typeid(RooExponential)) {
         return new CachingExpoPdf(pdf, obs);
     } else if (gaussNll && typeid(*pdf) == typeid(RooPower)) {
         return new CachingPowerPdf(pdf, obs);
+    } else if (CachingPdfBase *bern = (gaussNll ? makeCachingBernsteinPdf<7>(pdf, obs) : 0)) {
+        return bern;
+    } else if (cbNll && typeid(*pdf) == typeid(RooCB)) {
+        return new CachingCBPdf(pdf, obs);
+    } else if (cbNll && typeid(*pdf) == typeid(RooDoubleCB)) {
+        return new CachingDoubleCBPdf(pdf, obs);
+    } else if (cbNll && typeid(*pdf) == typeid(RooDoubleCrystalBall)) {
+        return new CachingDoubleCrystalBallPdf(pdf, obs);
+    } else if (cbNll && typeid(*pdf) == typeid(RooaDoubleCBxBW)) {
+        return new CachingDoubleCBxBWPdf(pdf, obs);
     } else if (multiNll && typeid(*pdf) == typeid(RooMultiPdf)) {
         return new CachingMultiPdf(static_cast<RooMultiPdf&>(*pdf), *obs);
     } else if (multiNll && typeid(*pdf) == typeid(RooAddPdf)) {
@@ -448,16 +717,47 @@ cacheutils::makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) {
 
 }
 
+double
+cacheutils::derivative(const RooAbsReal &node, RooRealVar &param) 
+{
+    if (&node == &param) return 1.0;
+    if (node.isFundamental()) return 0.0;
+    RooArgList factors; 
+    double dlog = 0;
+    if (typeid(node) == typeid(ProcessNormalization) && static_cast<const ProcessNormalization &>(node).hasFundamentalThetasOnly()) {
+        const ProcessNormalization &pn = static_cast<const ProcessNormalization &>(node);
+        dlog = pn.logKappaDerivative(param);
+        factors.add(pn.otherFactors());
+    } else if (typeid(node) == typeid(RooProduct)) {
+        factors.add(const_cast<RooProduct &>(static_cast<const RooProduct &>(node)).components());
+    } else {
+        return ::finiteDifference(param, [&node]() { return node.getVal(); });
+    }
+    // d(prod f_i)/dx = prod f_i * sum (df_i/dx)/f_i
+    RooLinkedListIter iter = factors.iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        RooAbsReal *f = dynamic_cast<RooAbsReal *>(a);
+        if (f == 0 || (f != &param && (f->isFundamental() || !f->dependsOn(param)))) continue;
+        double fval = f->getVal();
+        if (fval == 0) return ::finiteDifference(param, [&node]() { return node.getVal(); });
+        dlog += derivative(*f, param) / fval;
+    }
+    return dlog == 0 ? 0.0 : node.getVal() * dlog;
+}
+
 void
 cacheutils::CachingAddNLL::setup_() 
 {
     fastExit_ = !runtimedef::get("NO_ADDNLL_FASTEXIT");
+    gradientReady_ = false;
+    binnedFast_ = false;
     for (int i = 0, n = integrals_.size(); i < n; ++i) delete integrals_[i];
     integrals_.clear(); pdfs_.clear(); coeffs_.clear(); prods_.clear();
     RooAddPdf *addpdf = 0;
     RooRealSumPdf *sumpdf = 0;
     if ((addpdf = dynamic_cast<RooAddPdf *>(pdf_)) != 0) {
         isRooRealSum_ = false;
+        binnedFast_ = runtimedef::get("ADDNLL_BINNED_FASTPATH");
         addPdfs_(addpdf, runtimedef::get("ADDNLL_RECURSIVE"), RooArgList());
     } else if ((sumpdf = dynamic_cast<RooRealSumPdf *>(pdf_)) != 0) {
         const RooArgSet *obs = data_->get();
@@ -506,7 +806,14 @@ cacheutils::CachingAddNLL::evaluate() const
 #ifdef DEBUG_CACHE
     PerfCounter::add("CachingAddNLL::evaluate called");
 #endif
+    prepareEval_();
+    computeEval_();
+    return finishEval_();
+}
 
+void
+cacheutils::CachingAddNLL::prepareEval_() const 
+{
     // For multi pdf's need to reset the cache if index changed before evaluations
     // unless they're being properly treated in the CachingPdf
     static bool multiNll  = runtimedef::get("ADDNLL_MULTINLL");
@@ -517,15 +824,16 @@ cacheutils::CachingAddNLL::evaluate() const
         }
     }
 
-    std::fill( partialSum_.begin(), partialSum_.end(), 0.0 );
-
+    coeffVals_.resize(coeffs_.size());
+    pdfVals_.resize(coeffs_.size());
     std::vector<RooAbsReal*>::iterator  itc = coeffs_.begin(), edc = coeffs_.end();
     boost::ptr_vector<CachingPdfBase>::iterator   itp = pdfs_.begin();//,   edp = pdfs_.end();
-    std::vector<Double_t>::const_iterator itw, bgw = weights_.begin();//,    edw = weights_.end();
-    std::vector<Double_t>::iterator       its, bgs = partialSum_.begin(), eds = partialSum_.end();
+    std::vector<Double_t>::iterator itcv = coeffVals_.begin();
+    std::vector<const Double_t *>::iterator itpv = pdfVals_.begin();
+    static bool inPlace = runtimedef::get("ADDNLL_HIST_INPLACE");
     double sumCoeff = 0;
     //std::cout << "Performing evaluation of " << GetName() << std::endl;
-    for ( ; itc != edc; ++itp, ++itc ) {
+    for ( ; itc != edc; ++itp, ++itc, ++itcv, ++itpv ) {
         // get coefficient
         Double_t coeff = (*itc)->getVal();
         if (isRooRealSum_) {
@@ -534,67 +842,126 @@ cacheutils::CachingAddNLL::evaluate() const
         } else {
             sumCoeff += coeff;
         }
+        *itcv = coeff;
         // get vals
-        const std::vector<Double_t> &pdfvals = itp->eval(*data_);
+        const Double_t *pdfvals = (inPlace ? itp->evalInPlace(*data_) : 0);
+        if (pdfvals == 0) {
+            const std::vector<Double_t> &cached = itp->eval(*data_);
+            pdfvals = (cached.empty() ? 0 : &cached[0]);
+        }
+        *itpv = pdfvals;
 #ifdef LOG_ADDPDFS
         printf("%s coefficient %s (%s) = %20.15f\n", itp->pdf()->GetName(), (*itc)->GetName(), (*itc)->ClassName(), coeff);
         //(*itc)->Print("");
-        for (unsigned int i = 0, n = pdfvals.size(); i < n; ++i) {
+        for (unsigned int i = 0, n = weights_.size(); i < n; ++i) {
             if (i%84==0) printf("%-80s[%3d] = %20.15f\n", itp->pdf()->GetName(), i, pdfvals[i]);
         }
 #endif
+    }
+    sumCoeff_ = sumCoeff;
+}
+
+void
+cacheutils::CachingAddNLL::computeEval_() const 
+{
+    static bool do_kahan = runtimedef::get("ADDNLL_KAHAN_SUM");
+    if (binnedFast_) { computeEvalBinned_(do_kahan); return; }
+
+    std::fill( partialSum_.begin(), partialSum_.end(), 0.0 );
+
+    std::vector<Double_t>::iterator       its, bgs = partialSum_.begin(), eds = partialSum_.end();
+    double sumCoeff = sumCoeff_;
+    for (unsigned int i = 0, n = coeffVals_.size(); i < n; ++i) {
         // update running sum
-        //    std::vector<Double_t>::const_iterator itv = pdfvals.begin();
+        //    const Double_t *itv = pdfVals_[i];
         //    for (its = bgs; its != eds; ++its, ++itv) {
         //         *its += coeff * (*itv); // sum (n_i * pdf_i)
         //    }
         // vectorize to make it faster
-        vectorized::mul_add(pdfvals.size(), coeff, &pdfvals[0], &partialSum_[0]);
+        vectorized::mul_add(partialSum_.size(), coeffVals_[i], pdfVals_[i], &partialSum_[0]);
     }
     // then get the final nll
     double ret = 0;
+    underflows_ = 0;
     for (its = bgs; its != eds ; ++its) {
         if (!isnormal(*its) || *its <= 0) {
-            std::cerr << "WARNING: underflow to " << *its << " in " << GetName() << std::endl; 
-            if (!CachingSimNLL::noDeepLEE_) logEvalError("Number of events is negative or error"); else CachingSimNLL::hasError_ = true;
-            if (fastExit_) { return 9e9; }
+            if (underflows_++ == 0) firstUnderflow_ = *its;
+            if (fastExit_) { reduced_ = 0; return; }
             else *its = 1;
         }
     }
-    #ifndef ADDNLL_KAHAN_SUM
     // Do the reduction 
     //      for ( its = bgs, itw = bgw ; its != eds ; ++its, ++itw ) {
     //         ret += (*itw) * log( ((*its) / sumCoeff) );
     //      }
-    ret += vectorized::nll_reduce(partialSum_.size(), &partialSum_[0], &weights_[0], sumCoeff, &workingArea_[0]);
-    #else
-    double compensation = 0;
-    static bool do_kahan = runtimedef::get("ADDNLL_KAHAN_SUM");
-    for ( its = bgs, itw = bgw ; its != eds ; ++its, ++itw ) {
-        double thispiece = (*itw) * log( ((*its) / sumCoeff) );
-        if (do_kahan) {
-            double kahan_y = thispiece  - compensation;
-            double kahan_t = ret + kahan_y;
-            double kahan_d = (kahan_t - ret);
-            compensation = kahan_d - kahan_y;
-            ret  = kahan_t;
+    // with ADDNLL_KAHAN_SUM the partial sums are compensated: slightly slower, but more accurate on large channels
+    if (do_kahan) {
+        ret += vectorized::nll_reduce_kahan(partialSum_.size(), &partialSum_[0], &weights_[0], sumCoeff, &workingArea_[0]);
+    } else {
+        ret += vectorized::nll_reduce(partialSum_.size(), &partialSum_[0], &weights_[0], sumCoeff, &workingArea_[0]);
+    }
+    reduced_ = ret;
+}
+
+void
+cacheutils::CachingAddNLL::computeEvalBinned_(bool kahan) const 
+{
+    // reduced = sum_i n_i log(nu_i), with nu_i = sum_k c_k p_k(x_i) the expected yield, without dividing
+    // by sumCoeff: finishEval_ then adds sum_k c_k, and the -N log(sumCoeff) terms are never computed.
+    // The sum over the processes and the reduction are done together in blocks of bins, so that the
+    // yields are still in cache when taking the log. The blocks are a multiple of 8 bins, so the
+    // partial sums are the same as with a single block (and as in computeBatch_).
+    const unsigned int nbins = weights_.size(), block = 256;
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 }, compensations[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    underflows_ = 0;
+    for (unsigned int start = 0; start < nbins; start += block) {
+        unsigned int size = std::min(block, nbins - start);
+        std::fill(partialSum_.begin(), partialSum_.begin() + size, 0.0);
+        for (unsigned int i = 0, n = coeffVals_.size(); i < n; ++i) {
+            vectorized::mul_add(size, coeffVals_[i], pdfVals_[i] + start, &partialSum_[0]);
+        }
+        for (unsigned int j = 0; j < size; ++j) {
+            if (!isnormal(partialSum_[j]) || partialSum_[j] <= 0) {
+                if (underflows_++ == 0) firstUnderflow_ = partialSum_[j];
+                if (fastExit_) { reduced_ = 0; return; }
+                else partialSum_[j] = 1;
+            }
+        }
+        if (kahan) {
+            vectorized::nll_accumulate_kahan(size, &partialSum_[0], &weights_[start], 1.0, &workingArea_[0], sums, compensations);
         } else {
-            ret += thispiece;
+            vectorized::nll_accumulate(size, &partialSum_[0], &weights_[start], 1.0, &workingArea_[0], sums);
         }
-        ret += thispiece;
     }
-    #endif
+    reduced_ = (kahan ? vectorized::nll_combine_kahan(sums, compensations) : vectorized::nll_combine(sums));
+}
+
+double
+cacheutils::CachingAddNLL::finishEval_() const 
+{
+    if (underflows_) {
+        std::cerr << "WARNING: underflow to " << firstUnderflow_ << " in " << GetName();
+        if (underflows_ > 1) std::cerr << " (and in other " << (underflows_-1) << " points)";
+        std::cerr << std::endl; 
+        if (!CachingSimNLL::noDeepLEE_) logEvalError("Number of events is negative or error"); else CachingSimNLL::hasError_ = true;
+        if (fastExit_) { return 9e9; }
+    }
     // then flip sign
-    ret = -ret;
+    double ret = -reduced_;
     // std::cout << "AddNLL for " << pdf_->GetName() << ": " << ret << std::endl;
     // and add extended term: expected - observed*log(expected);
-    double expectedEvents = (isRooRealSum_ ? pdf_->getNorm(data_->get()) : sumCoeff);
+    double expectedEvents = (isRooRealSum_ ? pdf_->getNorm(data_->get()) : sumCoeff_);
     if (expectedEvents <= 0) {
         if (!CachingSimNLL::noDeepLEE_) logEvalError("Expected number of events is negative"); else CachingSimNLL::hasError_ = true;
         expectedEvents = 1e-6;
     }
     //ret += expectedEvents - UInt_t(sumWeights_) * log(expectedEvents); // no, doesn't work with Asimov dataset
-    ret += expectedEvents - sumWeights_ * log(expectedEvents);
+    if (binnedFast_) {
+        // reduced_ is already sum n_i log(nu_i), so the N log(expected) terms cancel out
+        ret += expectedEvents;
+    } else {
+        ret += expectedEvents - sumWeights_ * log(expectedEvents);
+    }
     ret += zeroPoint_;
 
     // multipdfs want to add a correction factor to the NLL
@@ -611,37 +978,125 @@ cacheutils::CachingAddNLL::evaluate() const
     return ret;
 }
 
+void
+cacheutils::CachingAddNLL::beginBatch_(const RooArgSet &params) const 
+{
+    batchSize_ = 0; batchStoreUsed_ = 0;
+    batchCopy_.resize(pdfs_.size());
+    for (unsigned int i = 0, n = pdfs_.size(); i < n; ++i) {
+        batchCopy_[i] = pdfs_[i].pdf()->dependsOn(params);
+    }
+}
+
+void
+cacheutils::CachingAddNLL::addBatchPoint_() const 
+{
+    prepareEval_();
+    if (batchPoints_.size() <= batchSize_) batchPoints_.resize(batchSize_ + 1);
+    BatchPoint &bp = batchPoints_[batchSize_++];
+    bp.coeffs = coeffVals_;
+    bp.sumCoeff = sumCoeff_;
+    bp.pdfVals = pdfVals_;
+    for (unsigned int i = 0, n = pdfVals_.size(); i < n; ++i) {
+        if (!batchCopy_[i]) continue;
+        if (batchStoreUsed_ == batchStore_.size()) batchStore_.push_back(std::vector<Double_t>());
+        std::vector<Double_t> &copy = batchStore_[batchStoreUsed_++];
+        copy.assign(pdfVals_[i], pdfVals_[i] + weights_.size());
+        bp.pdfVals[i] = copy.empty() ? 0 : &copy[0];
+    }
+}
+
+void
+cacheutils::CachingAddNLL::computeBatch_() const 
+{
+    // same as computeEval_ for each point, but in blocks of bins. The size of the blocks is a multiple
+    // of 8, so that the partial sums of the reduction are the same as when doing all the bins at once
+    static bool do_kahan = runtimedef::get("ADDNLL_KAHAN_SUM");
+    const unsigned int nbins = weights_.size(), block = 1024;
+    batchSum_.resize(std::min(nbins, block));
+    batchWork_.resize(std::min(nbins, block));
+    batchSums_.assign(8*batchSize_, 0.0);
+    batchCompensations_.assign(8*batchSize_, 0.0);
+    for (unsigned int k = 0; k < batchSize_; ++k) batchPoints_[k].underflows = 0;
+    for (unsigned int start = 0; start < nbins; start += block) {
+        unsigned int size = std::min(block, nbins - start);
+        for (unsigned int k = 0; k < batchSize_; ++k) {
+            BatchPoint &bp = batchPoints_[k];
+            if (fastExit_ && bp.underflows) continue;
+            std::fill(batchSum_.begin(), batchSum_.begin() + size, 0.0);
+            for (unsigned int i = 0, n = bp.coeffs.size(); i < n; ++i) {
+                vectorized::mul_add(size, bp.coeffs[i], bp.pdfVals[i] + start, &batchSum_[0]);
+            }
+            for (unsigned int j = 0; j < size; ++j) {
+                if (!isnormal(batchSum_[j]) || batchSum_[j] <= 0) {
+                    if (bp.underflows++ == 0) bp.firstUnderflow = batchSum_[j];
+                    if (fastExit_) break;
+                    else batchSum_[j] = 1;
+                }
+            }
+            if (fastExit_ && bp.underflows) continue;
+            double norm = (binnedFast_ ? 1.0 : bp.sumCoeff);
+            if (do_kahan) {
+                vectorized::nll_accumulate_kahan(size, &batchSum_[0], &weights_[start], norm, &batchWork_[0], &batchSums_[8*k], &batchCompensations_[8*k]);
+            } else {
+                vectorized::nll_accumulate(size, &batchSum_[0], &weights_[start], norm, &batchWork_[0], &batchSums_[8*k]);
+            }
+        }
+    }
+    for (unsigned int k = 0; k < batchSize_; ++k) {
+        BatchPoint &bp = batchPoints_[k];
+        if (fastExit_ && bp.underflows) { bp.reduced = 0; continue; }
+        bp.reduced = (do_kahan ? vectorized::nll_combine_kahan(&batchSums_[8*k], &batchCompensations_[8*k]) : vectorized::nll_combine(&batchSums_[8*k]));
+    }
+}
+
+double
+cacheutils::CachingAddNLL::finishBatchPoint_(unsigned int k) const 
+{
+    const BatchPoint &bp = batchPoints_[k];
+    sumCoeff_ = bp.sumCoeff;
+    reduced_ = bp.reduced;
+    underflows_ = bp.underflows;
+    firstUnderflow_ = bp.firstUnderflow;
+    return finishEval_();
+}
+
 void 
 cacheutils::CachingAddNLL::setData(const RooAbsData &data) 
 {
     //std::cout << "Setting data for pdf " << pdf_->GetName() << std::endl;
     //utils::printRAD(&data);
-    data_ = &data;
-    setValueDirty();
-    sumWeights_ = 0.0;
     weights_.clear(); weights_.reserve(data.numEntries());
-    #ifdef ADDNLL_KAHAN_SUM
-    double compensation = 0;
-    #endif
     for (int i = 0, n = data.numEntries(); i < n; ++i) {
         data.get(i);
         double w = data.weight();
         if (w) weights_.push_back(w); 
-        #ifdef ADDNLL_KAHAN_SUM
-        static bool do_kahan = runtimedef::get("ADDNLL_KAHAN_SUM");
-        if (do_kahan) {
-            double kahan_y = w - compensation;
-            double kahan_t = sumWeights_ + kahan_y;
-            double kahan_d = (kahan_t - sumWeights_);
-            compensation = kahan_d - kahan_y;
-            sumWeights_  = kahan_t;
-        } else {
-            sumWeights_ += w;
-        }
-        #else
-        sumWeights_ += w;
-        #endif
     }
+    newData_(data);
+}
+
+void 
+cacheutils::CachingAddNLL::setData(const RooAbsData &data, const double *weights, unsigned int n) 
+{
+    weights_.assign(weights, weights + n);
+    newData_(data);
+}
+
+void 
+cacheutils::CachingAddNLL::setWeights(const double *weights, unsigned int n) 
+{
+    if (n != weights_.size()) throw std::invalid_argument("CachingAddNLL::setWeights: the number of entries changed");
+    std::copy(weights, weights + n, weights_.begin());
+    sumWeights_ = sumOfWeights_();
+    setValueDirty();
+}
+
+void 
+cacheutils::CachingAddNLL::newData_(const RooAbsData &data) 
+{
+    data_ = &data;
+    setValueDirty();
+    sumWeights_ = sumOfWeights_();
     partialSum_.resize(weights_.size());
     workingArea_.resize(weights_.size());
     for (auto itp = pdfs_.begin(), edp = pdfs_.end(); itp != edp; ++itp) {
@@ -649,6 +1104,27 @@ cacheutils::CachingAddNLL::setData(const RooAbsData &data)
     }
 }
 
+double
+cacheutils::CachingAddNLL::sumOfWeights_() const 
+{
+    double sumWeights = 0.0;
+    double compensation = 0;
+    static bool do_kahan = runtimedef::get("ADDNLL_KAHAN_SUM");
+    for (std::vector<Double_t>::const_iterator it = weights_.begin(), ed = weights_.end(); it != ed; ++it) {
+        double w = *it;
+        if (do_kahan) {
+            double kahan_y = w - compensation;
+            double kahan_t = sumWeights + kahan_y;
+            double kahan_d = (kahan_t - sumWeights);
+            compensation = kahan_d - kahan_y;
+            sumWeights  = kahan_t;
+        } else {
+            sumWeights += w;
+        }
+    }
+    return sumWeights;
+}
+
 RooArgSet* 
 cacheutils::CachingAddNLL::getObservables(const RooArgSet* depList, Bool_t valueOnly) const 
 {
@@ -661,12 +1137,85 @@ cacheutils::CachingAddNLL::getParameters(const RooArgSet* depList, Bool_t stripD
     return new RooArgSet(params_); 
 }
 
+void
+cacheutils::CachingAddNLL::bindParamMirror_(const ParamMirror *mirror) 
+{
+    for (boost::ptr_vector<CachingPdfBase>::iterator itp = pdfs_.begin(), edp = pdfs_.end(); itp != edp; ++itp) {
+        itp->bindParamMirror(mirror);
+    }
+}
+
+void
+cacheutils::CachingAddNLL::setupGradient_() const 
+{
+    gradTerms_.clear();
+    for (int k = 0, nk = coeffs_.size(); k < nk; ++k) {
+        std::auto_ptr<RooArgSet> vars(coeffs_[k]->getVariables());
+        RooLinkedListIter iter = vars->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            if (dynamic_cast<RooRealVar *>(a)) gradTerms_[a].coeffs.push_back(k);
+        }
+    }
+    for (int k = 0, nk = pdfs_.size(); k < nk; ++k) {
+        std::auto_ptr<RooArgSet> vars(pdfs_[k].pdf()->getParameters(*data_));
+        RooLinkedListIter iter = vars->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            if (dynamic_cast<RooRealVar *>(a)) gradTerms_[a].pdfs.push_back(k);
+        }
+    }
+    gradientReady_ = true;
+}
+
+double
+cacheutils::CachingAddNLL::derivative(RooRealVar &param) const 
+{
+#ifdef DEBUG_CACHE
+    PerfCounter::add("CachingAddNLL::derivative called");
+#endif
+    if (isRooRealSum_) throw std::logic_error("CachingAddNLL::derivative not supported for RooRealSumPdf");
+    if (!gradientReady_) setupGradient_();
+    std::map<const RooAbsArg *, GradTerms>::const_iterator match = gradTerms_.find(&param);
+    if (match == gradTerms_.end()) return 0.0;
+    const GradTerms &terms = match->second;
+
+    // The nll is sum_i -w_i log(S_i/C) + C - N log C, with S_i = sum_k c_k p_k(x_i) and C = sum_k c_k,
+    // and the terms in dC/C cancel out, so dNLL/dx = dC/dx - sum_i w_i (dS_i/dx)/S_i
+    prepareEval_(); // all from the caches, if we're at the point of the last evaluation
+    unsigned int n = weights_.size();
+    gradSum_.assign(n, 0.0); gradWork_.assign(n, 0.0);
+    if (n) {
+        for (unsigned int k = 0, nk = coeffVals_.size(); k < nk; ++k) {
+            vectorized::mul_add(n, coeffVals_[k], pdfVals_[k], &gradSum_[0]);
+        }
+    }
+    double dSumCoeff = 0;
+    for (std::vector<int>::const_iterator it = terms.coeffs.begin(), ed = terms.coeffs.end(); it != ed; ++it) {
+        double dcoeff = cacheutils::derivative(*coeffs_[*it], param);
+        dSumCoeff += dcoeff;
+        if (n && dcoeff != 0) vectorized::mul_add(n, dcoeff, pdfVals_[*it], &gradWork_[0]);
+    }
+    // the pdf terms go last, since a numerical derivative can recycle the value caches and invalidate pdfVals_
+    for (std::vector<int>::const_iterator it = terms.pdfs.begin(), ed = terms.pdfs.end(); it != ed; ++it) {
+        if (n == 0) break;
+        pdfs_[*it].evalDerivative(*data_, param, gradTmp_);
+        vectorized::mul_add(n, coeffVals_[*it], &gradTmp_[0], &gradWork_[0]);
+    }
+    double ret = dSumCoeff;
+    for (unsigned int i = 0; i < n; ++i) {
+        if (gradSum_[i] > 0) ret -= weights_[i] * gradWork_[i] / gradSum_[i];
+    }
+    return ret;
+}
+
 
 cacheutils::CachingSimNLL::CachingSimNLL(RooSimultaneous *pdf, RooAbsData *data, const RooArgSet *nuis) :
     pdfOriginal_(pdf),
     dataOriginal_(data),
     nuis_(nuis),
-    params_("params","parameters",this)
+    params_("params","parameters",this),
+    channelValsStale_(true), incremental_(true),
+    gradientReady_(false),
+    floatMorphsEvals_(0), floatMorphsNextCheck_(1)
 {
     setup_();
 }
@@ -675,7 +1224,10 @@ cacheutils::CachingSimNLL::CachingSimNLL(const CachingSimNLL &other, const char
     pdfOriginal_(other.pdfOriginal_),
     dataOriginal_(other.dataOriginal_),
     nuis_(other.nuis_),
-    params_("params","parameters",this)
+    params_("params","parameters",this),
+    channelValsStale_(true), incremental_(true),
+    gradientReady_(false),
+    floatMorphsEvals_(0), floatMorphsNextCheck_(1)
 {
     setup_();
 }
@@ -736,6 +1288,18 @@ cacheutils::CachingSimNLL::setup_()
             std::auto_ptr<RooArgSet> params(pdfi->getParameters(*dataOriginal_));
             params_.add(*params, false);
         }
+        // the fast gaussians are computed together in flat arrays, and so are Poisson, Gamma and
+        // Lognormal constraints with SIMNLL_FASTCONSTRAINTS (see FastConstraintTerms)
+        fastConstraints_.clear();
+        constrainPdfsInArrays_.assign(constrainPdfs_.size(), 0);
+        if (optimizeContraints_ && runtimedef::get("SIMNLL_FASTCONSTRAINTS")) {
+            for (int ic = 0, nc = constrainPdfs_.size(); ic < nc; ++ic) {
+                constrainPdfsInArrays_[ic] = fastConstraints_.add(*constrainPdfs_[ic], nuis_, ic);
+            }
+        }
+        for (int ic = 0, nc = constrainPdfsFast_.size(); ic < nc; ++ic) {
+            fastConstraints_.addGaussian(*constrainPdfsFast_[ic], constrainPdfs_.size() + ic);
+        }
     } else {
         std::cerr << "PDF didn't factorize!" << std::endl;
         std::cout << "Parameters: " << std::endl;
@@ -770,9 +1334,167 @@ cacheutils::CachingSimNLL::setup_()
         }
     }   
 
+    setupThreads_();
+    setupIndex_();
+    gradientReady_ = false;
+
     setValueDirty();
 }
 
+void
+cacheutils::CachingSimNLL::setupThreads_() 
+{
+    int nthreads = runtimedef::get("SIMNLL_THREADS");
+    if (nthreads <= 1) { threadPool_.reset(); threadPartitions_.clear(); return; }
+    if (threadPool_.get() == 0 || int(threadPool_->size()) != nthreads) threadPool_.reset(new SimpleThreadPool(nthreads));
+    // balance the threads according to the number of bins (or events) and pdfs in each channel
+    std::vector<double> costs(pdfs_.size(), 0.);
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] != 0) costs[ib] = pdfs_[ib]->evalCost();
+    }
+    SimpleThreadPool::partition(costs, nthreads, threadPartitions_);
+}
+
+void
+cacheutils::CachingSimNLL::setupIndex_() 
+{
+    indexVars_.clear(); indexCats_.clear(); indexOffsets_.clear(); indexChannels_.clear();
+    channelUnindexed_.assign(pdfs_.size(), 0);
+    channelDirty_.assign(pdfs_.size(), 1);
+    channelVals_.assign(pdfs_.size(), 0.0);
+    channelValsStale_ = true;
+    incremental_ = !runtimedef::get("SIMNLL_NO_INCREMENTAL");
+    std::map<RooAbsArg *, std::vector<int> > varChannels, catChannels;
+    std::vector<RooAbsArg *> vars, cats; // in order of appearance, so that the index does not depend on pointer values
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        if (!incremental_) channelUnindexed_[ib] = 1;
+        std::auto_ptr<RooArgSet> params(pdfs_[ib]->pdf()->getParameters(*datasets_[ib]));
+        RooLinkedListIter iter = params->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            if (dynamic_cast<RooRealVar *>(a) != 0) {
+                std::vector<int> &chans = varChannels[a];
+                if (chans.empty()) vars.push_back(a);
+                chans.push_back(ib);
+            } else if (dynamic_cast<RooAbsCategory *>(a) != 0) {
+                std::vector<int> &chans = catChannels[a];
+                if (chans.empty()) cats.push_back(a);
+                chans.push_back(ib);
+            } else {
+                channelUnindexed_[ib] = 1;
+            }
+        }
+    }
+    indexOffsets_.push_back(0);
+    for (std::vector<RooAbsArg *>::const_iterator it = vars.begin(), ed = vars.end(); it != ed; ++it) {
+        indexVars_.push_back(static_cast<RooRealVar *>(*it));
+        const std::vector<int> &chans = varChannels[*it];
+        indexChannels_.insert(indexChannels_.end(), chans.begin(), chans.end());
+        indexOffsets_.push_back(indexChannels_.size());
+    }
+    for (std::vector<RooAbsArg *>::const_iterator it = cats.begin(), ed = cats.end(); it != ed; ++it) {
+        indexCats_.push_back(dynamic_cast<RooAbsCategory *>(*it));
+        const std::vector<int> &chans = catChannels[*it];
+        indexChannels_.insert(indexChannels_.end(), chans.begin(), chans.end());
+        indexOffsets_.push_back(indexChannels_.size());
+    }
+    indexVarVals_.resize(indexVars_.size());
+    indexCatVals_.resize(indexCats_.size());
+
+    mirror_.setup(indexVars_, indexCats_);
+    if (!runtimedef::get("SIMNLL_NO_PARAM_MIRROR")) {
+        for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+            if (pdfs_[ib] != 0) pdfs_[ib]->bindParamMirror_(&mirror_);
+        }
+    }
+}
+
+void
+cacheutils::CachingSimNLL::markDirtyChannels_() const 
+{
+    std::fill(channelDirty_.begin(), channelDirty_.end(), channelValsStale_ ? 1 : 0);
+    const double *mirrored = mirror_.values();
+    for (int i = 0, n = indexVars_.size(); i < n; ++i) {
+        double val = mirrored[i];
+        if (val == indexVarVals_[i]) continue;
+        indexVarVals_[i] = val;
+        if (!incremental_) continue;
+        for (int j = indexOffsets_[i], end = indexOffsets_[i+1]; j < end; ++j) channelDirty_[indexChannels_[j]] = 1;
+    }
+    for (int i = 0, n = indexCats_.size(), off = indexVars_.size(); i < n; ++i) {
+        int val = int(mirrored[off+i]);
+        if (val == indexCatVals_[i]) continue;
+        indexCatVals_[i] = val;
+        if (!incremental_) continue;
+        for (int j = indexOffsets_[off+i], end = indexOffsets_[off+i+1]; j < end; ++j) channelDirty_[indexChannels_[j]] = 1;
+    }
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) channelDirty_[ib] = 0;
+        else if (channelUnindexed_[ib] && pdfs_[ib]->needsEval_()) channelDirty_[ib] = 1;
+    }
+    channelValsStale_ = false;
+}
+
+void
+cacheutils::CachingSimNLL::evaluateChannels_() const 
+{
+    MirrorScope scope(mirror_);
+    markDirtyChannels_();
+    if (threadPool_.get()) {
+        evaluateChannelsParallel_();
+    } else {
+        for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+            if (!channelDirty_[ib]) continue;
+            channelVals_[ib] = pdfs_[ib]->evaluate();
+            pdfs_[ib]->setCachedValue_(channelVals_[ib]);
+        }
+    }
+}
+
+void
+cacheutils::CachingSimNLL::evaluateChannelsParallel_() const 
+{
+    // first, serially, do everything that touches the RooFit graph
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (channelDirty_[ib]) pdfs_[ib]->prepareEval_();
+    }
+    // then the number crunching, in parallel
+    threadPool_->run(threadPartitions_, [this](int ib) { 
+        if (channelDirty_[ib]) pdfs_[ib]->computeEval_(); 
+    });
+    // and finally store the results, so that getVal() will not re-evaluate the channels
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (!channelDirty_[ib]) continue;
+        channelVals_[ib] = pdfs_[ib]->finishEval_();
+        pdfs_[ib]->setCachedValue_(channelVals_[ib]);
+    }
+}
+
+void
+cacheutils::CachingSimNLL::validateFloatMorphs_() const 
+{
+    if (++floatMorphsEvals_ < floatMorphsNextCheck_) return;
+    floatMorphsNextCheck_ *= 10;
+    double nllFloat = 0, nllDouble = 0;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] != 0) nllFloat += channelVals_[ib];
+    }
+    // the channels are evaluated again from scratch, as the caches of the pdfs don't know about the switch
+    FastVerticalInterpHistPdf2Base::setDoubleMorphs(true);
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        pdfs_[ib]->newData_(pdfs_[ib]->data());
+        nllDouble += pdfs_[ib]->evaluate();
+    }
+    FastVerticalInterpHistPdf2Base::setDoubleMorphs(false);
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] != 0) pdfs_[ib]->newData_(pdfs_[ib]->data());
+    }
+    channelValsStale_ = true;
+    printf("CachingSimNLL: evaluation %lu, NLL with single precision morphs %.9f, with double precision %.9f, difference %.3g\n",
+            floatMorphsEvals_, nllFloat, nllDouble, nllFloat - nllDouble);
+}
+
 Double_t 
 cacheutils::CachingSimNLL::evaluate() const 
 {
@@ -783,31 +1505,19 @@ cacheutils::CachingSimNLL::evaluate() const
 #ifdef DEBUG_CACHE
     PerfCounter::add("CachingSimNLL::evaluate called");
 #endif
+    // recompute only the channels that depend on parameters that changed
+    evaluateChannels_();
+    if (FastVerticalInterpHistPdf2Base::floatMorphs() == 2) validateFloatMorphs_();
+    // always sum in the same order, so that the result does not depend on the number of threads
+    // nor on which channels were recomputed
     double ret = 0;
-    for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
-        if (*it != 0) {
-            double nllval = (*it)->getVal();
-            // what sanity check could I put here?
-            ret += nllval;
-        }
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] != 0) ret += channelVals_[ib];
     }
     if (!constrainPdfs_.empty() || !constrainPdfsFast_.empty()) {
-        /// ============= GENERIC CONSTRAINTS  =========
-        std::vector<double>::const_iterator itz = constrainZeroPoints_.begin();
-        for (std::vector<RooAbsPdf *>::const_iterator it = constrainPdfs_.begin(), ed = constrainPdfs_.end(); it != ed; ++it, ++itz) { 
-            double pdfval = (*it)->getVal(nuis_);
-            if (!isnormal(pdfval) || pdfval <= 0) {
-                if (!noDeepLEE_) logEvalError((std::string("Constraint pdf ")+(*it)->GetName()+" evaluated to zero, negative or error").c_str());
-                pdfval = 1e-9;
-            }
-            ret -= (log(pdfval) + *itz);
-        }
-        /// ============= FAST GAUSSIAN CONSTRAINTS  =========
-        itz = constrainZeroPointsFast_.begin();
-        for (std::vector<SimpleGaussianConstraint*>::const_iterator it = constrainPdfsFast_.begin(), ed = constrainPdfsFast_.end(); it != ed; ++it, ++itz) { 
-            double logpdfval = (*it)->getLogValFast();
-            //std::cout << "pdf " << (*it)->GetName() << " = " << logpdfval << std::endl;
-            ret -= (logpdfval + *itz);
+        evalConstraints_(constraintTerms_);
+        for (std::vector<double>::const_iterator it = constraintTerms_.begin(), ed = constraintTerms_.end(); it != ed; ++it) {
+            ret -= *it;
         }
     }
 #ifdef TRACE_NLL_EVALS
@@ -819,6 +1529,134 @@ cacheutils::CachingSimNLL::evaluate() const
     return ret;
 }
 
+void
+cacheutils::CachingSimNLL::evalConstraints_(std::vector<double> &terms, bool zeroPoints) const 
+{
+    unsigned int ngen = constrainPdfs_.size(), nfast = constrainPdfsFast_.size();
+    terms.resize(ngen + nfast);
+    /// ============= CONSTRAINTS IN FLAT ARRAYS (all the fast gaussians, and some generic ones) =========
+    constraintsFailed_.clear();
+    if (fastConstraints_.size()) fastConstraints_.eval(&terms[0], constraintsFailed_);
+    std::vector<int>::const_iterator itf = constraintsFailed_.begin(), edf = constraintsFailed_.end(); // in order
+    /// ============= GENERIC CONSTRAINTS  =========
+    for (unsigned int ic = 0; ic < ngen; ++ic) { 
+        bool generic = !constrainPdfsInArrays_[ic];
+        if (itf != edf && *itf == int(ic)) { generic = true; ++itf; }
+        if (generic) {
+            double pdfval = constrainPdfs_[ic]->getVal(nuis_);
+            if (!isnormal(pdfval) || pdfval <= 0) {
+                if (!noDeepLEE_) logEvalError((std::string("Constraint pdf ")+constrainPdfs_[ic]->GetName()+" evaluated to zero, negative or error").c_str());
+                pdfval = 1e-9;
+            }
+            terms[ic] = log(pdfval);
+        }
+        if (zeroPoints) terms[ic] += constrainZeroPoints_[ic];
+    }
+    /// ============= FAST GAUSSIAN CONSTRAINTS  =========
+    if (zeroPoints) {
+        for (unsigned int ic = 0; ic < nfast; ++ic) { 
+            terms[ngen + ic] += constrainZeroPointsFast_[ic];
+        }
+    }
+}
+
+void
+cacheutils::CachingSimNLL::evaluateBatch(const std::vector<RooRealVar *> &params, const double *points, unsigned int npoints, double *nlls) const 
+{
+    if (npoints == 0) return;
+    unsigned int np = params.size(), nb = pdfs_.size();
+    std::vector<double> saved(np);
+    RooArgSet paramSet;
+    for (unsigned int j = 0; j < np; ++j) { saved[j] = params[j]->getVal(); paramSet.add(*params[j]); }
+    // channels that can go through their data once for all points; the others are evaluated point by point
+    std::vector<uint8_t> batched(nb, 0);
+    for (unsigned int ib = 0; ib < nb; ++ib) {
+        if (pdfs_[ib] != 0 && pdfs_[ib]->supportsBatch_()) {
+            batched[ib] = 1;
+            pdfs_[ib]->beginBatch_(paramSet);
+        }
+    }
+    // for each point and channel, where to take the value from: the previous point (SameAsBefore),
+    // vals (Evaluated), or the given point of the batch of the channel
+    enum { SameAsBefore = -1, Evaluated = -2 };
+    std::vector<int> source(npoints*nb, SameAsBefore);
+    std::vector<double> vals(npoints*nb, 0.0), before(channelVals_);
+    std::vector<std::vector<double> > constraints(npoints);
+    for (unsigned int k = 0; k < npoints; ++k) {
+        for (unsigned int j = 0; j < np; ++j) params[j]->setVal(points[k*np + j]);
+        MirrorScope scope(mirror_);
+        markDirtyChannels_();
+        for (unsigned int ib = 0; ib < nb; ++ib) {
+            if (!channelDirty_[ib]) continue;
+            if (batched[ib]) {
+                source[k*nb + ib] = pdfs_[ib]->batchSize_;
+                pdfs_[ib]->addBatchPoint_();
+            } else {
+                channelVals_[ib] = pdfs_[ib]->evaluate();
+                pdfs_[ib]->setCachedValue_(channelVals_[ib]);
+                source[k*nb + ib] = Evaluated;
+                vals[k*nb + ib] = channelVals_[ib];
+            }
+        }
+        if (!constrainPdfs_.empty() || !constrainPdfsFast_.empty()) evalConstraints_(constraints[k]);
+    }
+    // the number crunching, in parallel on the channels if possible
+    if (threadPool_.get()) {
+        threadPool_->run(threadPartitions_, [this,&batched](int ib) { 
+            if (batched[ib] && pdfs_[ib]->batchSize_) pdfs_[ib]->computeBatch_(); 
+        });
+    } else {
+        for (unsigned int ib = 0; ib < nb; ++ib) {
+            if (batched[ib] && pdfs_[ib]->batchSize_) pdfs_[ib]->computeBatch_(); 
+        }
+    }
+    // and the sums, in the same order as in evaluate()
+    for (unsigned int k = 0; k < npoints; ++k) {
+        double ret = 0;
+        for (unsigned int ib = 0; ib < nb; ++ib) {
+            if (pdfs_[ib] == 0) continue;
+            int src = source[k*nb + ib];
+            double &val = vals[k*nb + ib];
+            if (src == SameAsBefore) val = (k ? vals[(k-1)*nb + ib] : before[ib]);
+            else if (src != Evaluated) val = pdfs_[ib]->finishBatchPoint_(src);
+            ret += val;
+        }
+        for (std::vector<double>::const_iterator it = constraints[k].begin(), ed = constraints[k].end(); it != ed; ++it) {
+            ret -= *it;
+        }
+        nlls[k] = ret;
+    }
+    // the channels are left at the last point, as after an evaluate() there
+    for (unsigned int ib = 0; ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        channelVals_[ib] = vals[(npoints-1)*nb + ib];
+        if (batched[ib]) pdfs_[ib]->setCachedValue_(channelVals_[ib]);
+    }
+    for (unsigned int j = 0; j < np; ++j) params[j]->setVal(saved[j]);
+}
+
+void
+cacheutils::CachingSimNLL::numericalGradient(const std::vector<RooRealVar *> &params, double *grad) const 
+{
+    // points x+h and x-h for each parameter, within its range (so that at the boundaries it's a one-sided difference)
+    unsigned int np = params.size();
+    if (np == 0) return;
+    std::vector<double> x0(np), points(2*np*np), nlls(2*np);
+    for (unsigned int j = 0; j < np; ++j) x0[j] = params[j]->getVal();
+    for (unsigned int j = 0; j < np; ++j) {
+        double h = finiteDifferenceStep(*params[j]);
+        std::copy(x0.begin(), x0.end(), &points[(2*j)*np]);
+        std::copy(x0.begin(), x0.end(), &points[(2*j+1)*np]);
+        points[(2*j)*np + j]   = std::min(x0[j] + h, params[j]->getMax());
+        points[(2*j+1)*np + j] = std::max(x0[j] - h, params[j]->getMin());
+    }
+    evaluateBatch(params, &points[0], 2*np, &nlls[0]);
+    for (unsigned int j = 0; j < np; ++j) {
+        double dx = points[(2*j)*np + j] - points[(2*j+1)*np + j];
+        grad[j] = (dx != 0 ? (nlls[2*j] - nlls[2*j+1])/dx : 0.0);
+    }
+}
+
 void 
 cacheutils::CachingSimNLL::setData(const RooAbsData &data) 
 {
@@ -835,7 +1673,28 @@ cacheutils::CachingSimNLL::setData(const RooAbsData &data)
         if (data == 0) { throw std::logic_error("Error: no data"); }
         //std::cout << "   bin " << ib << " (label " << canll->GetName() << ") has pdf " << canll->pdf()->GetName() << " of type " << canll->pdf()->ClassName() <<
         //             " and " << (data ? data->numEntries() : -1) << " dataset entries (sumw " << data->sumEntries() << ", weighted " << data->isWeighted() << ")" << std::endl;
-        canll->setData(*data);
+        if (!threadPool_.get()) setChannelData_(ib);
+    }
+    if (threadPool_.get()) {
+        // each channel reads only its own part of the columns, so they can be done concurrently
+        threadPool_->run(threadPartitions_, [this](int ib) { 
+            if (pdfs_[ib] != 0) setChannelData_(ib); 
+        });
+        // the number of entries in each channel may have changed
+        setupThreads_();
+    }
+    channelValsStale_ = true;
+}
+
+void 
+cacheutils::CachingSimNLL::setChannelData_(int ib) 
+{
+    const double *weights = splitWeights_.empty() ? 0 : &splitWeights_[0] + splitBegin_[ib];
+    unsigned int n = splitBegin_[ib+1] - splitBegin_[ib];
+    if (splitSameLayout_[ib] && &pdfs_[ib]->data() == datasets_[ib]) {
+        pdfs_[ib]->setWeights(weights, n);
+    } else {
+        pdfs_[ib]->setData(*datasets_[ib], weights, n);
     }
 }
 
@@ -860,33 +1719,103 @@ void cacheutils::CachingSimNLL::splitWithWeights(const RooAbsData &data, const R
             } else {
                 datasets_[ib] = new RooDataSet("", "", obsplus, "_weight_");
             }
-        } else {
-            datasets_[ib]->reset();
         }
     }
+    // The events are first copied in columns, grouped by channel: for each channel the weights and the values
+    // of its own observables only, read straight from the variables of the combined dataset. The datasets of
+    // the channels are then filled from the columns, assigning the values to their own variables (adding a
+    // set of variables to a dataset copies them by name, which is what made the split slow with many channels),
+    // and the CachingAddNLLs take their weights from the columns too (see setData).
+    // Channels with observables that are not real variables are still filled event by event.
+    std::vector<std::vector<RooRealVar *> > columns(nb), targets(nb);
+    std::vector<uint8_t> direct(nb, 1);
+    for (int ib = 0; ib < nb; ++ib) {
+        RooLinkedListIter iter = datasets_[ib]->get()->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            RooRealVar *dst = dynamic_cast<RooRealVar *>(a);
+            RooRealVar *src = dynamic_cast<RooRealVar *>(obs.find(a->GetName()));
+            if (dst == 0 || src == 0) { direct[ib] = 0; columns[ib].clear(); targets[ib].clear(); break; }
+            columns[ib].push_back(src); 
+            targets[ib].push_back(dst);
+        }
+        if (!direct[ib]) datasets_[ib]->reset();
+    }
+    // keep the previous columns, to find out which channels got only new weights
+    prevSplitBegin_.swap(splitBegin_); prevSplitValueBegin_.swap(splitValueBegin_); prevSplitValues_.swap(splitValues_);
+    std::vector<int> eventBin; eventBin.reserve(ne);
+    std::vector<double> eventWeights, eventValues; eventWeights.reserve(ne);
+    splitBegin_.assign(nb+1, 0);
     //utils::printRDH((RooAbsData*)&data);
     for (int i = 0; i < ne; ++i) {
-        data.get(i); if (data.weight() == 0) continue;
+        data.get(i); 
+        double w = data.weight();
+        if (!(w > 0)) continue;
         int ib = cat->getBin();
-        //std::cout << "Event " << i << " of weight " << data.weight() << " is in bin " << ib << " label " << cat->getLabel() << std::endl;
-        if (data.weight() > 0) datasets_[ib]->add(obs, data.weight());
+        //std::cout << "Event " << i << " of weight " << w << " is in bin " << ib << " label " << cat->getLabel() << std::endl;
+        eventBin.push_back(ib);
+        eventWeights.push_back(w);
+        splitBegin_[ib+1]++;
+        if (direct[ib]) {
+            for (std::vector<RooRealVar *>::const_iterator it = columns[ib].begin(), ed = columns[ib].end(); it != ed; ++it) {
+                eventValues.push_back((*it)->getVal());
+            }
+        } else {
+            datasets_[ib]->add(obs, w);
+        }
+    }
+    // group by channel, keeping the order of the events within each channel
+    splitValueBegin_.assign(nb+1, 0);
+    for (int ib = 0; ib < nb; ++ib) {
+        splitValueBegin_[ib+1] = splitValueBegin_[ib] + splitBegin_[ib+1] * columns[ib].size();
+        splitBegin_[ib+1] += splitBegin_[ib];
+    }
+    splitWeights_.resize(eventWeights.size());
+    splitValues_.resize(eventValues.size());
+    std::vector<unsigned int> wpos(splitBegin_.begin(), splitBegin_.end()-1), vpos(splitValueBegin_.begin(), splitValueBegin_.end()-1);
+    for (unsigned int i = 0, n = eventBin.size(), iv = 0; i < n; ++i) {
+        int ib = eventBin[i];
+        splitWeights_[wpos[ib]++] = eventWeights[i];
+        for (unsigned int c = 0, nc = columns[ib].size(); c < nc; ++c) splitValues_[vpos[ib]++] = eventValues[iv++];
+    }
+    // If the events of a channel are at the same points as in the previous dataset (e.g. binned toys with
+    // the same empty bins), only the weights changed: the channel dataset is not refilled, and setData
+    // keeps the pdf caches (see CachingAddNLL::setWeights). Its dataset then holds the old weights, but
+    // those are never used: the NLL takes them from splitWeights_.
+    splitSameLayout_.assign(nb, 0);
+    for (int ib = 0; ib < nb; ++ib) {
+        if (!direct[ib]) continue;
+        if (prevSplitBegin_.size() == splitBegin_.size() && 
+                prevSplitBegin_[ib+1] - prevSplitBegin_[ib] == splitBegin_[ib+1] - splitBegin_[ib] &&
+                std::equal(splitValues_.begin() + splitValueBegin_[ib], splitValues_.begin() + splitValueBegin_[ib+1], 
+                           prevSplitValues_.begin() + prevSplitValueBegin_[ib])) {
+            splitSameLayout_[ib] = 1;
+            continue;
+        }
+        datasets_[ib]->reset();
+        const RooArgSet &vars = *datasets_[ib]->get();
+        const double *vals = splitValues_.empty() ? 0 : &splitValues_[0] + splitValueBegin_[ib];
+        unsigned int nc = targets[ib].size();
+        for (unsigned int k = splitBegin_[ib], ek = splitBegin_[ib+1]; k < ek; ++k) {
+            for (unsigned int c = 0; c < nc; ++c) targets[ib][c]->setVal(*vals++);
+            datasets_[ib]->add(vars, splitWeights_[k]);
+        }
     }
 }
 
 void cacheutils::CachingSimNLL::setZeroPoint() {
+    evaluateChannels_();
     for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
         if (*it != 0) (*it)->setZeroPoint();
     }
-    std::vector<double>::iterator itz = constrainZeroPoints_.begin();
-    for (std::vector<RooAbsPdf *>::const_iterator it = constrainPdfs_.begin(), ed = constrainPdfs_.end(); it != ed; ++it, ++itz) {
-        double pdfval = (*it)->getVal(nuis_);
-        if (isnormal(pdfval) || pdfval > 0) *itz = -log(pdfval);
+    // the same values as in evaluate(), so that the constraint terms are exactly zero at this point
+    evalConstraints_(constraintTerms_, false);
+    for (unsigned int ic = 0, ngen = constrainPdfs_.size(); ic < ngen; ++ic) {
+        constrainZeroPoints_[ic] = -constraintTerms_[ic];
     }
-    itz = constrainZeroPointsFast_.begin();
-    for (std::vector<SimpleGaussianConstraint*>::const_iterator it = constrainPdfsFast_.begin(), ed = constrainPdfsFast_.end(); it != ed; ++it, ++itz) {
-        double logpdfval = (*it)->getLogValFast();
-        *itz = -logpdfval;
+    for (unsigned int ic = 0, ngen = constrainPdfs_.size(), nfast = constrainPdfsFast_.size(); ic < nfast; ++ic) {
+        constrainZeroPointsFast_[ic] = -constraintTerms_[ngen + ic];
     }
+    channelValsStale_ = true;
     setValueDirty();
 }
 
@@ -896,6 +1825,7 @@ void cacheutils::CachingSimNLL::clearZeroPoint() {
     }
     std::fill(constrainZeroPoints_.begin(), constrainZeroPoints_.end(), 0.0);
     std::fill(constrainZeroPointsFast_.begin(), constrainZeroPointsFast_.end(), 0.0);
+    channelValsStale_ = true;
     setValueDirty();
 }
 
@@ -910,3 +1840,76 @@ cacheutils::CachingSimNLL::getParameters(const RooArgSet* depList, Bool_t stripD
 {
     return new RooArgSet(params_); 
 }
+
+bool
+cacheutils::CachingSimNLL::supportsGradient() const 
+{
+    for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
+        if (*it != 0 && !(*it)->supportsGradient()) return false;
+    }
+    return true;
+}
+
+void
+cacheutils::CachingSimNLL::setupGradient_() const 
+{
+    channelsForParam_.clear(); constraintsForParam_.clear(); constraintsFastForParam_.clear();
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        RooLinkedListIter iter = pdfs_[ib]->params().iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            channelsForParam_[a].push_back(ib);
+        }
+    }
+    for (int ic = 0, nc = constrainPdfs_.size(); ic < nc; ++ic) {
+        std::auto_ptr<RooArgSet> vars(constrainPdfs_[ic]->getParameters(*dataOriginal_));
+        RooLinkedListIter iter = vars->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            constraintsForParam_[a].push_back(ic);
+        }
+    }
+    for (int ic = 0, nc = constrainPdfsFast_.size(); ic < nc; ++ic) {
+        std::auto_ptr<RooArgSet> vars(constrainPdfsFast_[ic]->getParameters(*dataOriginal_));
+        RooLinkedListIter iter = vars->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            constraintsFastForParam_[a].push_back(ic);
+        }
+    }
+    gradientReady_ = true;
+}
+
+void
+cacheutils::CachingSimNLL::gradient(const std::vector<RooRealVar *> &params, double *grad) const 
+{
+#ifdef DEBUG_CACHE
+    PerfCounter::add("CachingSimNLL::gradient called");
+#endif
+    if (!gradientReady_) setupGradient_();
+    getVal(); // bring all the caches to the current point
+    std::map<const RooAbsArg *, std::vector<int> >::const_iterator match;
+    for (unsigned int ip = 0, np = params.size(); ip < np; ++ip) {
+        RooRealVar &param = *params[ip];
+        double ret = 0;
+        if ((match = channelsForParam_.find(&param)) != channelsForParam_.end()) {
+            for (std::vector<int>::const_iterator it = match->second.begin(), ed = match->second.end(); it != ed; ++it) {
+                const CachingAddNLL *nll = pdfs_[*it];
+                if (nll->supportsGradient()) ret += nll->derivative(param);
+                else ret += ::finiteDifference(param, [nll]() { return nll->getVal(); });
+            }
+        }
+        if ((match = constraintsForParam_.find(&param)) != constraintsForParam_.end()) {
+            for (std::vector<int>::const_iterator it = match->second.begin(), ed = match->second.end(); it != ed; ++it) {
+                const RooAbsPdf *pdf = constrainPdfs_[*it]; const RooArgSet *nuis = nuis_;
+                ret -= ::finiteDifference(param, [pdf,nuis]() { return std::log(pdf->getVal(nuis)); });
+            }
+        }
+        if ((match = constraintsFastForParam_.find(&param)) != constraintsFastForParam_.end()) {
+            for (std::vector<int>::const_iterator it = match->second.begin(), ed = match->second.end(); it != ed; ++it) {
+                const SimpleGaussianConstraint *pdf = constrainPdfsFast_[*it];
+                if (pdf->hasFundamentalArgs()) ret -= pdf->getLogValFastDerivative(param);
+                else ret -= ::finiteDifference(param, [pdf]() { return pdf->getLogValFast(); });
+            }
+        }
+        grad[ip] = ret;
+    }
+}
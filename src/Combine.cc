@@ -56,6 +56,8 @@
 #include "../interface/AsimovUtils.h"
 #include "../interface/CascadeMinimizer.h"
 #include "../interface/ProfilingTools.h"
+#include "../interface/FastTemplate.h"
+#include "../interface/VerticalInterpHistPdf.h"
 
 using namespace RooStats;
 using namespace RooFit;
@@ -654,7 +656,13 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
     }
   }
   
+  // the morphs are moved to the arena at the first evaluation of the pdfs
+  if (verbose > 1) fasttemplate::printMemoryReport();
+
   if (saveWorkspace_) {
+    if (FastVerticalInterpHistPdf2Base::floatMorphs() == 1) {
+        std::cerr << "WARNING: the morphs of the FastVerticalInterpHistPdf2 pdfs used with VERTINTERP_FLOAT_MORPHS=1 are saved in the workspace rounded to single precision" << std::endl;
+    }
     w->SetName(workspaceName_.c_str());
     w->loadSnapshot("clean");
     outputFile->WriteTObject(w,workspaceName_.c_str());
@@ -2,6 +2,7 @@
 #include "../interface/DebugProposal.h"
 #include "../interface/VerticalInterpPdf.h"
 #include "../interface/VerticalInterpHistPdf.h"
+#include "../interface/HorizontalInterpHistPdf.h"
 #include "../interface/AsymPow.h"
 #include "../interface/CombDataSetFactory.h"
 #include "../interface/TH1Keys.h"
@@ -38,9 +39,10 @@
 #pragma link C++ class FastVerticalInterpHistPdfBase::Morph+;
 #pragma link C++ class FastVerticalInterpHistPdf+;
 #pragma link C++ class FastVerticalInterpHistPdf2D+;
-#pragma link C++ class FastVerticalInterpHistPdf2Base+;
+#pragma link C++ class FastVerticalInterpHistPdf2Base-; // custom Streamer, that writes the morphs dense
 #pragma link C++ class FastVerticalInterpHistPdf2+;
 #pragma link C++ class FastVerticalInterpHistPdf2D2+;
+#pragma link C++ class FastHorizontalInterpHistPdf+;
 #pragma link C++ class AsymPow+;
 #pragma link C++ class CombDataSetFactory+;
 #pragma link C++ class TH1Keys+;
@@ -0,0 +1,168 @@
+#include "../interface/FastConstraintTerms.h"
+#include "../interface/SimpleGaussianConstraint.h"
+#include "vectorized.h"
+#include <RooRealVar.h>
+#include <RooPoisson.h>
+#include <RooGamma.h>
+#include <RooLognormal.h>
+#include <algorithm>
+#include <cmath>
+#include <typeinfo>
+
+namespace {
+    // to get at the inputs of the pdfs
+    class GaussWorker : public RooGaussian {
+        public:
+            GaussWorker(const RooGaussian &g) : RooGaussian(g, "") {}
+            const RooAbsReal & xvar()    const { return x.arg(); }
+            const RooAbsReal & meanvar() const { return mean.arg(); }
+            const RooAbsReal & sigvar()  const { return sigma.arg(); }
+    };
+    class PoissonWorker : public RooPoisson {
+        public:
+            PoissonWorker(const RooPoisson &p) : RooPoisson(p, "") {}
+            const RooAbsReal & xvar()    const { return x.arg(); }
+            const RooAbsReal & meanvar() const { return mean.arg(); }
+    };
+    class GammaWorker : public RooGamma {
+        public:
+            GammaWorker(const RooGamma &g) : RooGamma(g, "") {}
+            const RooAbsReal & xvar()     const { return x.arg(); }
+            const RooAbsReal & gammavar() const { return gamma.arg(); }
+            const RooAbsReal & betavar()  const { return beta.arg(); }
+            const RooAbsReal & muvar()    const { return mu.arg(); }
+    };
+    class LognormalWorker : public RooLognormal {
+        public:
+            LognormalWorker(const RooLognormal &l) : RooLognormal(l, "") {}
+            const RooAbsReal & xvar()  const { return x.arg(); }
+            const RooAbsReal & m0var() const { return m0.arg(); }
+            const RooAbsReal & kvar()  const { return k.arg(); }
+    };
+}
+
+bool FastConstraintTerms::add(const RooAbsPdf &pdf, const RooArgSet *nuis, int slot)
+{
+    const RooAbsReal *var = 0;
+    std::vector<const RooAbsReal *> keys;
+    Kind kind;
+    if (typeid(pdf) == typeid(RooPoisson)) {
+        PoissonWorker w(static_cast<const RooPoisson &>(pdf));
+        kind = Poisson; var = &w.meanvar(); keys.push_back(&w.xvar());
+    } else if (typeid(pdf) == typeid(RooGamma)) {
+        GammaWorker w(static_cast<const RooGamma &>(pdf));
+        kind = Gamma; var = &w.xvar(); keys.push_back(&w.gammavar()); keys.push_back(&w.betavar()); keys.push_back(&w.muvar());
+    } else if (typeid(pdf) == typeid(RooLognormal)) {
+        LognormalWorker w(static_cast<const RooLognormal &>(pdf));
+        kind = Lognormal; var = &w.xvar(); keys.push_back(&w.m0var()); keys.push_back(&w.kvar());
+    } else {
+        return false;
+    }
+    // the variable must be a plain variable, and the other inputs must be fundamental too (so that their
+    // values are cheap to get) and not among the nuisances (or the normalization would depend on the variable)
+    if (dynamic_cast<const RooRealVar *>(var) == 0) return false;
+    for (std::vector<const RooAbsReal *>::const_iterator it = keys.begin(), ed = keys.end(); it != ed; ++it) {
+        if (!(*it)->isFundamental() || *it == var) return false;
+        if (nuis && nuis->contains(**it)) return false;
+    }
+    if (!slots_.empty() && nuis != nuis_) return false;
+    nuis_ = nuis;
+    slots_.push_back(slot);
+    kinds_.push_back(kind);
+    pdfs_.push_back(&pdf);
+    vars_.push_back(var);
+    shift_.push_back(0); p_.push_back(0); q_.push_back(0); r_.push_back(0); s_.push_back(0); c_.push_back(0);
+    good_.push_back(0);
+    keyBegin_.push_back(keyArgs_.size());
+    keyArgs_.insert(keyArgs_.end(), keys.begin(), keys.end());
+    // values of the keys, then min and max of the variable; all NaN so that the first evaluation sets them
+    keyVals_.resize(keyVals_.size() + keys.size() + 2, std::nan(""));
+    return true;
+}
+
+void FastConstraintTerms::addGaussian(const SimpleGaussianConstraint &pdf, int slot)
+{
+    GaussWorker w(pdf);
+    gaussSlots_.push_back(slot);
+    gaussX_.push_back(&w.xvar());
+    gaussMean_.push_back(&w.meanvar());
+    // as in SimpleGaussianConstraint::init
+    Double_t sig = w.sigvar().getVal();
+    gaussScale_.push_back(-0.5/(sig*sig));
+}
+
+void FastConstraintTerms::clear()
+{
+    gaussSlots_.clear(); gaussX_.clear(); gaussMean_.clear(); gaussScale_.clear();
+    slots_.clear(); kinds_.clear(); pdfs_.clear(); vars_.clear();
+    shift_.clear(); p_.clear(); q_.clear(); r_.clear(); s_.clear(); c_.clear(); good_.clear();
+    keyBegin_.clear(); keyArgs_.clear(); keyVals_.clear();
+}
+
+bool FastConstraintTerms::keyChanged_(unsigned int i)
+{
+    unsigned int begin = keyBegin_[i], end = (i+1 < keyBegin_.size() ? keyBegin_[i+1] : keyArgs_.size());
+    double *vals = &keyVals_[begin + 2*i];
+    const RooRealVar *var = static_cast<const RooRealVar *>(vars_[i]);
+    bool changed = false;
+    for (unsigned int k = begin; k < end; ++k, ++vals) {
+        double val = keyArgs_[k]->getVal();
+        if (val != *vals) { *vals = val; changed = true; }
+    }
+    double lo = var->getMin(), hi = var->getMax();
+    if (lo != vals[0] || hi != vals[1]) { vals[0] = lo; vals[1] = hi; changed = true; }
+    if (changed) {
+        const double *key = &keyVals_[begin + 2*i];
+        switch (kinds_[i]) {
+            case Poisson:   // x log(mean) - mean
+                shift_[i] = 0; p_[i] = key[0]; q_[i] = -1; r_[i] = 0; s_[i] = 0;
+                break;
+            case Gamma:     // (gamma-1) log(x-mu) - (x-mu)/beta
+                shift_[i] = key[2]; p_[i] = key[0] - 1; q_[i] = -1.0/key[1]; r_[i] = 0; s_[i] = 0;
+                break;
+            case Lognormal: // -log(x) - 0.5 (log(x)-log(m0))^2/log(k)^2
+                shift_[i] = 0; p_[i] = -1; q_[i] = 0; r_[i] = -0.5/(std::log(key[1])*std::log(key[1])); s_[i] = std::log(key[0]);
+                break;
+        }
+    }
+    return changed;
+}
+
+bool FastConstraintTerms::calibrate_(unsigned int i, double f)
+{
+    if (!(work_[i] > 0)) return false; // out of the domain, no way to know c here
+    if (kinds_[i] == Poisson && p_[i] != std::floor(p_[i])) return false; // RooPoisson may round x
+    double val = pdfs_[i]->getVal(nuis_);
+    if (!std::isnormal(val) || val <= 0) return false;
+    c_[i] = std::log(val) - f;
+    return true;
+}
+
+void FastConstraintTerms::eval(double *out, std::vector<int> &failed)
+{
+    failed.clear();
+    unsigned int n = gaussSlots_.size(), m = slots_.size(), size = std::max(n, m);
+    if (size == 0) return;
+    x_.resize(size); mean_.resize(size); out_.resize(size); work_.resize(size); work2_.resize(size);
+    if (n) {
+        for (unsigned int i = 0; i < n; ++i) { x_[i] = gaussX_[i]->getVal(); mean_[i] = gaussMean_[i]->getVal(); }
+        vectorized::gaussian_constraints(n, &x_[0], &mean_[0], &gaussScale_[0], &out_[0]);
+        for (unsigned int i = 0; i < n; ++i) out[gaussSlots_[i]] = out_[i];
+    }
+    if (m) {
+        calib_.clear();
+        for (unsigned int i = 0; i < m; ++i) {
+            x_[i] = vars_[i]->getVal();
+            bool changed = keyChanged_(i);
+            if (changed || !good_[i]) calib_.push_back(i);
+        }
+        vectorized::log_constraints(m, &x_[0], &shift_[0], &p_[0], &q_[0], &r_[0], &s_[0], &out_[0], &work_[0], &work2_[0]);
+        for (std::vector<int>::const_iterator it = calib_.begin(), ed = calib_.end(); it != ed; ++it) {
+            good_[*it] = calibrate_(*it, out_[*it]);
+        }
+        for (unsigned int i = 0; i < m; ++i) {
+            if (good_[i] && work_[i] > 0) out[slots_[i]] = out_[i] + c_[i];
+            else failed.push_back(slots_[i]);
+        }
+    }
+}
@@ -4,6 +4,174 @@
 #include <cstdlib>
 #include <cstdio>
 #include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+
+namespace {
+    // Slabs of memory from which the arrays are allocated in order: a slab keeps track only of how many
+    // slices are still in use, and it's freed (or, if it's the one being filled, reused) when there are none.
+    // Until then, the slices that are deallocated are kept in a free list for their size, and reused first
+    class Arena {
+        public:
+            enum { Alignment = 64, SlabSize = 4 << 20 };
+            Arena() : current_(0), live_(0), peak_(0), arrays_(0) {}
+
+            void * allocate(std::size_t bytes) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::size_t size = std::max<std::size_t>(Alignment, (bytes + Alignment - 1) & ~std::size_t(Alignment - 1));
+                char *ret = 0;
+                std::map<std::size_t, std::vector<char *> >::iterator free = free_.find(size);
+                if (free != free_.end() && !free->second.empty()) {
+                    ret = free->second.back(); free->second.pop_back();
+                    slabOf(ret).slices++;
+                } else {
+                    Slab *slab = current_;
+                    if (size > SlabSize/4) {
+                        // large arrays get a slab of their own, not to waste the rest of the current one
+                        slab = newSlab(size);
+                    } else if (slab == 0 || slab->used + size > slab->size) {
+                        if (slab && slab->slices == 0) releaseSlab(slab);
+                        slab = current_ = newSlab(SlabSize);
+                    }
+                    ret = slab->begin + slab->used;
+                    slab->used += size; slab->slices++;
+                }
+                live_ += size; peak_ = std::max(peak_, live_); arrays_++;
+                return ret;
+            }
+
+            void deallocate(void *ptr, std::size_t bytes) {
+                if (ptr == 0) return;
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::size_t size = std::max<std::size_t>(Alignment, (bytes + Alignment - 1) & ~std::size_t(Alignment - 1));
+                Slab &slab = slabOf(static_cast<char *>(ptr));
+                live_ -= size; arrays_--;
+                if (--slab.slices > 0) { 
+                    free_[size].push_back(static_cast<char *>(ptr)); 
+                    return; 
+                }
+                // none of the free slices of this slab can be used any longer
+                for (std::map<std::size_t, std::vector<char *> >::iterator it = free_.begin(); it != free_.end(); ++it) {
+                    std::vector<char *> &list = it->second;
+                    for (unsigned int i = 0; i < list.size(); ) {
+                        if (list[i] >= slab.begin && list[i] < slab.begin + slab.size) { list[i] = list.back(); list.pop_back(); }
+                        else ++i;
+                    }
+                }
+                if (&slab == current_) slab.used = 0;
+                else releaseSlab(&slab);
+            }
+
+            void printReport() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::size_t reserved = 0;
+                for (std::map<char *, Slab>::const_iterator it = slabs_.begin(); it != slabs_.end(); ++it) reserved += it->second.size;
+                printf("fasttemplate arena (morphs of FastVerticalInterpHistPdf2): %lu arrays using %.3f MB (peak %.3f MB), in %lu slabs of %.3f MB in total\n",
+                        (unsigned long)(arrays_), live_/1048576., peak_/1048576., (unsigned long)(slabs_.size()), reserved/1048576.);
+            }
+
+        private:
+            struct Slab { char *begin; std::size_t size, used, slices; };
+            std::mutex mutex_;
+            std::map<char *, Slab> slabs_;
+            std::map<std::size_t, std::vector<char *> > free_;
+            Slab *current_;
+            std::size_t live_, peak_, arrays_;
+
+            Slab & slabOf(char *ptr) {
+                std::map<char *, Slab>::iterator it = slabs_.upper_bound(ptr);
+                --it;
+                return it->second;
+            }
+            Slab * newSlab(std::size_t size) {
+                void *mem = 0;
+                if (posix_memalign(&mem, Alignment, size) != 0) throw std::bad_alloc();
+                Slab &slab = slabs_[static_cast<char *>(mem)];
+                slab.begin = static_cast<char *>(mem); slab.size = size; slab.used = 0; slab.slices = 0;
+                return &slab;
+            }
+            void releaseSlab(Slab *slab) {
+                if (slab == current_) current_ = 0;
+                char *begin = slab->begin;
+                free(begin);
+                slabs_.erase(begin);
+            }
+    };
+
+    // never deleted, as arrays in static objects can be destroyed after it
+    Arena & arena() {
+        static Arena *arena = new Arena();
+        return *arena;
+    }
+}
+
+void * fasttemplate::allocate(std::size_t bytes) {
+    return arena().allocate(bytes);
+}
+
+void fasttemplate::deallocate(void *ptr, std::size_t bytes) {
+    arena().deallocate(ptr, bytes);
+}
+
+void fasttemplate::printMemoryReport() {
+    arena().printReport();
+}
+
+namespace {
+    // fill eytzinger[k] for the subtree rooted at k with edges[i], edges[i+1], ... in order
+    void fillEytzinger(const double *edges, unsigned int nedges, unsigned int &i, unsigned int k, std::vector<double> &eytzinger, std::vector<int> &rank) {
+        if (k > nedges) return;
+        fillEytzinger(edges, nedges, i, 2*k, eytzinger, rank);
+        eytzinger[k] = edges[i]; rank[k] = i; ++i;
+        fillEytzinger(edges, nedges, i, 2*k+1, eytzinger, rank);
+    }
+}
+
+void fasttemplate::BinLookup::init(const double *edges, unsigned int nedges) {
+    ready_ = true;
+    nbins_ = int(nedges) - 1;
+    edges_.clear(); eytzinger_.clear(); rank_.clear();
+    uniform_ = (nedges >= 2 && edges[nedges-1] > edges[0]);
+    if (uniform_) {
+        double width = (edges[nedges-1] - edges[0]) / nbins_;
+        for (unsigned int i = 1; i < nedges; ++i) {
+            if (std::abs(edges[i] - (edges[0] + i * width)) > 1e-6 * width) { uniform_ = false; break; }
+        }
+        invWidth_ = 1.0 / width;
+    }
+    if (uniform_) {
+        edges_.assign(edges, edges + nedges);
+    } else {
+        eytzinger_.resize(nedges + 1);
+        rank_.resize(nedges + 1);
+        unsigned int i = 0;
+        fillEytzinger(edges, nedges, i, 1, eytzinger_, rank_);
+        rank_[0] = nedges;
+    }
+}
+
+int fasttemplate::BinLookup::find(double x) const {
+    if (uniform_) {
+        if (!(x > edges_[0])) return -1;
+        if (x > edges_[nbins_]) return nbins_;
+        int i = std::min<int>(int((x - edges_[0]) * invWidth_), nbins_ - 1);
+        // x may be on the wrong side of an edge after rounding
+        while (edges_[i] >= x) --i;
+        while (edges_[i+1] < x) ++i;
+        return i;
+    }
+    // go down the tree to the right if the edge is below x and to the left otherwise, and
+    // then back up to the last left turn, which was at the first edge not below x
+    unsigned int k = 1, n = eytzinger_.size() - 1;
+    while (k <= n) k = 2*k + (eytzinger_[k] < x);
+    k >>= __builtin_ffs(~k);
+    return rank_[k] - 1;
+}
+
+void fasttemplate::BinLookup::find(const double *x, int *bins, unsigned int n) const {
+    for (unsigned int i = 0; i < n; ++i) bins[i] = find(x[i]);
+}
 
 FastTemplate::T FastTemplate::Integral() const {
     T total = 0;
@@ -52,27 +220,28 @@ FastHisto::FastHisto(const TH1 &hist) :
         binWidths_[i] = hist.GetBinWidth(i+1);
     }
     binEdges_.back() = hist.GetBinLowEdge(size()+1);
+    lookup_.init(&binEdges_[0], binEdges_.size());
 }
 
 FastHisto::FastHisto(const FastHisto &other) :
     FastTemplate(other),
     binEdges_(other.binEdges_),
-    binWidths_(other.binWidths_)
+    binWidths_(other.binWidths_),
+    lookup_(other.lookup_)
 {
 }
 
 int FastHisto::FindBin(const T &x) const {
-    auto match = std::lower_bound(binEdges_.begin(), binEdges_.end(), x);
-    if (match == binEdges_.begin()) return -1;
-    if (match == binEdges_.end()) return values_.size();
-    return match - binEdges_.begin() - 1;
+    return lookup().find(x);
 }
 
+void FastHisto::FindBins(const T *x, int *bins, unsigned int n) const {
+    lookup().find(x, bins, n);
+}
 
 FastHisto::T FastHisto::GetAt(const T &x) const {
-    auto match = std::lower_bound(binEdges_.begin(), binEdges_.end(), x);
-    if (match == binEdges_.begin() || match == binEdges_.end()) return T(0.0);
-    return values_[match - binEdges_.begin() - 1];
+    int bin = lookup().find(x);
+    return (bin >= 0 && bin < int(values_.size()) ? values_[bin] : T(0.0));
 }
 
 FastHisto::T FastHisto::IntegralWidth() const {
@@ -107,6 +276,7 @@ FastHisto2D::FastHisto2D(const TH2 &hist, bool normXonly) :
         binEdgesY_[iy] = ay->GetBinLowEdge(iy+1);
     }
     binEdgesY_.back() = ay->GetBinLowEdge(binY_+1);
+    initLookups();
     for (unsigned int ix = 1, i = 0; ix <= binX_; ++ix) {
         for (unsigned int iy = 1; iy <= binY_; ++iy, ++i) {
             binWidths_[i] = (normXonly ? 1 : ax->GetBinWidth(ix))*ay->GetBinWidth(iy);
@@ -120,18 +290,31 @@ FastHisto2D::FastHisto2D(const FastHisto2D &other) :
     binY_(other.binY_),
     binEdgesX_(other.binEdgesX_),
     binEdgesY_(other.binEdgesY_),
-    binWidths_(other.binWidths_)
+    binWidths_(other.binWidths_),
+    lookupX_(other.lookupX_),
+    lookupY_(other.lookupY_)
 {
 }
 
+void FastHisto2D::initLookups() const {
+    lookupX_.init(binEdgesX_.empty() ? 0 : &binEdgesX_[0], binEdgesX_.size());
+    lookupY_.init(binEdgesY_.empty() ? 0 : &binEdgesY_[0], binEdgesY_.size());
+}
+
 FastHisto2D::T FastHisto2D::GetAt(const T &x, const T &y) const {
-    auto matchx = std::lower_bound(binEdgesX_.begin(), binEdgesX_.end(), x);
-    if (matchx == binEdgesX_.begin() || matchx == binEdgesX_.end()) return T(0.0);
-    int ix = (matchx - binEdgesX_.begin() - 1);
-    auto matchy = std::lower_bound(binEdgesY_.begin(), binEdgesY_.end(), y);
-    if (matchy == binEdgesY_.begin() || matchy == binEdgesY_.end()) return T(0.0);
-    int iy = (matchy - binEdgesY_.begin() - 1);
-    return values_[ix * binY_ + iy];
+    int bin = FindBin(x, y);
+    return (bin >= 0 ? values_[bin] : T(0.0));
+}
+
+int FastHisto2D::FindBin(const T &x, const T &y) const {
+    if (!lookupX_.ready()) initLookups();
+    int ix = lookupX_.find(x), iy = lookupY_.find(y);
+    if (ix < 0 || ix >= int(binX_) || iy < 0 || iy >= int(binY_)) return -1;
+    return ix * binY_ + iy;
+}
+
+void FastHisto2D::FindBins(const T *x, const T *y, int *bins, unsigned int n) const {
+    for (unsigned int i = 0; i < n; ++i) bins[i] = FindBin(x[i], y[i]);
 }
 
 FastHisto2D::T FastHisto2D::IntegralWidth() const {
@@ -9,10 +9,83 @@
 #include "RooAbsCategory.h"
 #include <math.h>
 #include "TMath.h"
+#include "../interface/ProfilingTools.h"
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
 
 using namespace TMath;
 
+namespace {
+	// 7-point Gauss and 15-point Kronrod rules on [-1,1] (the Gauss nodes are the odd Kronrod ones, and 0)
+	const double xgk[8] = { 0.991455371120812639206854697526329, 0.949107912342758524526189684047851, 0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+	                        0.586087235467691130294144845693013, 0.405845151377397166906606412076961, 0.207784955007898467600689403773245, 0.000000000000000000000000000000000 };
+	const double wgk[8] = { 0.022935322010529224963732008058970, 0.063092092629978553290700663189204, 0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+	                        0.169004726639267902826583426598550, 0.190350578064785409913256402421014, 0.204432940075298892414161999234649, 0.209482141084727828012999174891714 };
+	const double wg[4]  = { 0.129484966168869693270611432679082, 0.279705391489276667901467771423780, 0.381830050505118944950369775488975, 0.417959183673469387755102040816327 };
+
+	// integral of f over [a, b] with the Kronrod rule, and the difference with the Gauss one in err
+	template<typename F> double gaussKronrod(const F &f, double a, double b, double &err) {
+		double c = 0.5*(a+b), h = 0.5*(b-a), fc = f(c);
+		double resk = wgk[7]*fc, resg = wg[3]*fc;
+		for (int j = 0; j < 7; ++j) {
+			double fsum = f(c - h*xgk[j]) + f(c + h*xgk[j]);
+			resk += wgk[j]*fsum;
+			if (j % 2 == 1) resg += wg[j/2]*fsum;
+		}
+		err = std::abs((resk - resg)*h);
+		return resk*h;
+	}
+
+	// integral of f over [a, b] to a relative precision of 1e-7, the default of RooFit's numerical integration:
+	// the interval with the largest error is bisected until the sum of the errors is small enough (as in QUADPACK's QAG).
+	// The shapes are smooth (the peaks are flattened by PeakFlattener), so that takes a few tens of intervals at most
+	template<typename F> double adaptiveIntegral(const F &f, double a, double b) {
+		const double relTol = 1e-7;
+		const unsigned int minIntervals = 8, maxIntervals = 200;
+		std::vector<double> lo, hi, val, err;
+		for (unsigned int i = 0; i < minIntervals; ++i) {
+			lo.push_back(a + (b-a)*i/minIntervals);
+			hi.push_back(i+1 == minIntervals ? b : a + (b-a)*(i+1)/minIntervals);
+			double e, v = gaussKronrod(f, lo.back(), hi.back(), e);
+			val.push_back(v); err.push_back(e);
+		}
+		for (;;) {
+			double total = 0, totalErr = 0;
+			for (unsigned int i = 0, n = val.size(); i < n; ++i) { total += val[i]; totalErr += err[i]; }
+			if (totalErr <= relTol*std::abs(total) || val.size() >= maxIntervals) return total;
+			unsigned int worst = std::max_element(err.begin(), err.end()) - err.begin();
+			double mid = 0.5*(lo[worst] + hi[worst]), e1, e2;
+			double v1 = gaussKronrod(f, lo[worst], mid, e1), v2 = gaussKronrod(f, mid, hi[worst], e2);
+			lo.push_back(mid); hi.push_back(hi[worst]); val.push_back(v2); err.push_back(e2);
+			hi[worst] = mid; val[worst] = v1; err[worst] = e1;
+		}
+	}
+
+	// f(x) dx/du with x = peak + width tan(u): a Breit-Wigner of that width is flat in u
+	template<typename F> struct PeakFlattener {
+		PeakFlattener(const F &f, double peak, double width) : f_(f), peak_(peak), width_(width) {}
+		double operator()(double u) const { double t = std::tan(u); return f_(peak_ + width_*t) * width_ * (1 + t*t); }
+		const F &f_; double peak_, width_;
+	};
+
+	// numerical normalization integral of a pdf over [xmin, xmax], for the values of its parameters and range in key,
+	// taken from the cache if it's one of the last ones that were computed. If width > 0 the pdf has a peak at peak with about
+	// that width, which can be much narrower than the range: then the integral is done in u = atan((x - peak)/width)
+	template<typename F> double cachedIntegral(HZZ4LIntegralCache &cache, const double *key, unsigned int nkey, const F &f, double xmin, double xmax, double peak = 0, double width = 0) {
+		if (cache.matches(key, nkey)) return cache.value();
+		double ret;
+		if (width > 0) {
+			ret = adaptiveIntegral(PeakFlattener<F>(f, peak, width), std::atan((xmin - peak)/width), std::atan((xmax - peak)/width));
+		} else {
+			ret = adaptiveIntegral(f, xmin, xmax);
+		}
+		cache.set(key, nkey, ret);
+		return ret;
+	}
+}
+
 namespace RooFit{
 	
 	void readFile();
@@ -1953,31 +2026,49 @@ frac("frac",this,other.frac)
 
 
 Double_t RooqqZZPdf::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooqqZZPdf::evaluateAt(Double_t mass) const
 {
 	
 	//std::cout << "a1 = " << a1 << ", a2 = " << a2 << ", a3 = " << a3 << std::endl;                                                                    
 	//std::cout << "b1 = " << b1 << ", b2 = " << b2 << ", b3 = " << b3 << std::endl;                                                                    
 	
 	double signa = 0.;
-	if ((m4l-a1) > 0) { signa = 1.; }
-	else if ((m4l-a1) < 0) { signa = -1.; }
+	if ((mass-a1) > 0) { signa = 1.; }
+	else if ((mass-a1) < 0) { signa = -1.; }
 	else { signa = 0.; }
 	
 	double signb = 0.;
-	if ((m4l-b1) > 0) { signb = 1.; }
-	else if ((m4l-b1) < 0) { signb = -1.; }
+	if ((mass-b1) > 0) { signb = 1.; }
+	else if ((mass-b1) < 0) { signb = -1.; }
 	else { signb = 0.; }
 	
-	double bkglo = (0.5 + 0.5*signa * TMath::Erf(TMath::Abs(m4l-a1)/a2)) * exp(-1.*m4l/a3);
-	double bkghi = (0.5 + 0.5*signb * TMath::Erf(TMath::Abs(m4l-b1)/b2)) * exp(-1.*m4l/b3);
+	double bkglo = (0.5 + 0.5*signa * TMath::Erf(TMath::Abs(mass-a1)/a2)) * exp(-1.*mass/a3);
+	double bkghi = (0.5 + 0.5*signb * TMath::Erf(TMath::Abs(mass-b1)/b2)) * exp(-1.*mass/b3);
 	double total = bkglo*frac + (1-frac)*bkghi;
 	
-	double dynamicKqq = 1. + m4l*0.001074 + m4l*m4l*-7.851e-07;
+	double dynamicKqq = 1. + mass*0.001074 + mass*mass*-7.851e-07;
 	
 	double totalNLO = total*dynamicKqq;
 	return totalNLO ;
 }
 
+Int_t RooqqZZPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooqqZZPdf::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)a1, (double)a2, (double)a3, (double)b1, (double)b2, (double)b3, (double)frac };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName));
+}
+
 
 /************RooggZZPdf***********/
 
@@ -2018,7 +2109,13 @@ frac("frac",this,other.frac)
 {
 }
 
+
 Double_t RooggZZPdf::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooggZZPdf::evaluateAt(Double_t mass) const
 {
 	
 	//std::cout << "a1 = " << a1 << ", a2 = " << a2 << ", a3 = " << a3 << std::endl;                                                                    
@@ -2026,17 +2123,17 @@ Double_t RooggZZPdf::evaluate() const
 	
 	// ENTER EXPRESSION IN TERMS OF VARIABLE ARGUMENTS HERE                                                                                             
 	double signa = 0.;
-	if ((m4l-a1) > 0) { signa = 1.; }
-	else if ((m4l-a1) < 0) { signa = -1.; }
+	if ((mass-a1) > 0) { signa = 1.; }
+	else if ((mass-a1) < 0) { signa = -1.; }
 	else { signa = 0.; }
 	
 	double signb = 0.;
-	if ((m4l-b1) > 0) { signb = 1.; }
-	else if ((m4l-b1) < 0) { signb = -1.; }
+	if ((mass-b1) > 0) { signb = 1.; }
+	else if ((mass-b1) < 0) { signb = -1.; }
 	else { signb = 0.; }
 	
-	double bkglo = (0.5 + 0.5*signa * TMath::Erf(TMath::Abs(m4l-a1)/a2)) * exp(-1.*m4l/a3);
-	double bkghi = (0.5 + 0.5*signb * TMath::Erf(TMath::Abs(m4l-b1)/b2)) * exp(-1.*m4l/b3);
+	double bkglo = (0.5 + 0.5*signa * TMath::Erf(TMath::Abs(mass-a1)/a2)) * exp(-1.*mass/a3);
+	double bkghi = (0.5 + 0.5*signb * TMath::Erf(TMath::Abs(mass-b1)/b2)) * exp(-1.*mass/b3);
 	double total = bkglo*frac + (1-frac)*bkghi;
 	
 	double m_a = 0.17;
@@ -2044,12 +2141,25 @@ Double_t RooggZZPdf::evaluate() const
 	double m_c = 1.55e-07;
 	double m_d = 169.2;
 	double m_e = 45.94;	
-	double dynamicKgg = (m_a + m_b*m4l + m_c*m4l*m4l)*(0.5 + 0.5*TMath::Erf( (m4l-m_d)/m_e ) );
+	double dynamicKgg = (m_a + m_b*mass + m_c*mass*mass)*(0.5 + 0.5*TMath::Erf( (mass-m_d)/m_e ) );
 	double totalNLO = total*dynamicKgg;
 	
 	return totalNLO ;
 }
 
+Int_t RooggZZPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooggZZPdf::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)a1, (double)a2, (double)a3, (double)b1, (double)b2, (double)b3, (double)frac };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName));
+}
+
 //// ------- v2 below ------
 
 ClassImp(RooqqZZPdf_v2)
@@ -2115,15 +2225,33 @@ a13("a13",this,other.a13)
 
 
 Double_t RooqqZZPdf_v2::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooqqZZPdf_v2::evaluateAt(Double_t mass) const
 {
 	
-	double ZZ = (.5+.5*TMath::Erf((m4l-a0)/a1))*(a3/(1+exp((m4l-a0)/a2)))+
-    (.5+.5*TMath::Erf((m4l-a4)/a5))*(a7/(1+exp((m4l-a4)/a6))+a9/(1+exp((m4l-a4)/a8)))
-    +(.5+.5*TMath::Erf((m4l-a10)/a11))*(a13/(1+exp((m4l-a10)/a12)) );
+	double ZZ = (.5+.5*TMath::Erf((mass-a0)/a1))*(a3/(1+exp((mass-a0)/a2)))+
+    (.5+.5*TMath::Erf((mass-a4)/a5))*(a7/(1+exp((mass-a4)/a6))+a9/(1+exp((mass-a4)/a8)))
+    +(.5+.5*TMath::Erf((mass-a10)/a11))*(a13/(1+exp((mass-a10)/a12)) );
 	
 	return ZZ;
 }
 
+Int_t RooqqZZPdf_v2::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooqqZZPdf_v2::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)a0, (double)a1, (double)a2, (double)a3, (double)a4, (double)a5, (double)a6, (double)a7, (double)a8, (double)a9, (double)a10, (double)a11, (double)a12, (double)a13 };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName));
+}
+
 
 
 
@@ -2179,15 +2307,33 @@ a9("a9",this,other.a9)
 
 
 Double_t RooggZZPdf_v2::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooggZZPdf_v2::evaluateAt(Double_t mass) const
 {
 	
-	double ZZ = (.5+.5*TMath::Erf((m4l-a0)/a1))*(a3/(1+exp((m4l-a0)/a2)))+
-    (.5+.5*TMath::Erf((m4l-a4)/a5))*(a7/(1+exp((m4l-a4)/a6))+a9/(1+exp((m4l-a4)/a8)));
+	double ZZ = (.5+.5*TMath::Erf((mass-a0)/a1))*(a3/(1+exp((mass-a0)/a2)))+
+    (.5+.5*TMath::Erf((mass-a4)/a5))*(a7/(1+exp((mass-a4)/a6))+a9/(1+exp((mass-a4)/a8)));
 	
 	
 	return ZZ;
 }
 
+Int_t RooggZZPdf_v2::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooggZZPdf_v2::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)a0, (double)a1, (double)a2, (double)a3, (double)a4, (double)a5, (double)a6, (double)a7, (double)a8, (double)a9 };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName));
+}
+
 ClassImp(RooBetaFunc_v2) 
 
 RooBetaFunc_v2::RooBetaFunc_v2(){}
@@ -3094,6 +3240,11 @@ mH("mH",this,other.mH)
 }
 
 Double_t RooRelBWUF::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooRelBWUF::evaluateAt(Double_t mass) const
 {
 	using namespace RooFit;
 	
@@ -3101,7 +3252,7 @@ Double_t RooRelBWUF::evaluate() const
 	
 	
 	Double_t mHreq = mH;
-	Double_t x = m4l;
+	Double_t x = mass;
 	
 	/*
 	Double_t Gamma_gg = HiggsWidth(7,x);
@@ -3118,6 +3269,21 @@ Double_t RooRelBWUF::evaluate() const
 	//*/
 }
 
+Int_t RooRelBWUF::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooRelBWUF::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	using namespace RooFit;
+	if( BR[0][0] == 0 ){ readFile(); }
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)mH };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName), mH, HiggsWidth(0,mH));
+}
+
 
 
 /************RooRelBWUF_SM4*************/
@@ -3142,6 +3308,11 @@ mH("mH",this,other.mH)
 }
 
 Double_t RooRelBWUF_SM4::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooRelBWUF_SM4::evaluateAt(Double_t mass) const
 {
 	using namespace RooFit;
 	
@@ -3149,7 +3320,7 @@ Double_t RooRelBWUF_SM4::evaluate() const
 	
 	
 	Double_t mHreq = mH;
-	Double_t x = m4l;
+	Double_t x = mass;
 	
 
 	Double_t pdf_1_NoBrem = pdf1SM4(x,mHreq);
@@ -3157,6 +3328,21 @@ Double_t RooRelBWUF_SM4::evaluate() const
 
 }
 
+Int_t RooRelBWUF_SM4::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooRelBWUF_SM4::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	using namespace RooFit;
+	if( BR[0][0] == 0 ){ readFile(); }
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)mH };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName), mH, HiggsWidthSM4(0,mH));
+}
+
 /************RooRelBWUFParamWidth*************/
 
 ClassImp(RooRelBWUFParamWidth)
@@ -3199,6 +3385,21 @@ Double_t RooRelBWUFParamWidth::evaluate() const
 }
 
 
+Int_t RooRelBWUFParamWidth::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooRelBWUFParamWidth::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	// integral of 1/(dm^2 + (x/2)^2)
+	Double_t halfWidth = 0.5*width;
+	return (atan((m4l.max(rangeName) - mH)/halfWidth) - atan((m4l.min(rangeName) - mH)/halfWidth))/halfWidth;
+}
+
+
 /************RooRelBWUFParam*************/
 
 ClassImp(RooRelBWUFParam)
@@ -3224,6 +3425,11 @@ scaleParam("scaleParam",this,other.scaleParam)
 }
 
 Double_t RooRelBWUFParam::evaluate() const
+{
+	return evaluateAt(m4l);
+}
+
+Double_t RooRelBWUFParam::evaluateAt(Double_t mass) const
 {
 	using namespace RooFit;
 	
@@ -3231,7 +3437,7 @@ Double_t RooRelBWUFParam::evaluate() const
 	
 	
 	Double_t mHreq = mH;
-	Double_t mStar = m4l;
+	Double_t mStar = mass;
 	Double_t x = scaleParam;
 	
 	
@@ -3250,6 +3456,21 @@ Double_t RooRelBWUFParam::evaluate() const
 	//*/
 }
 
+Int_t RooRelBWUFParam::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooRelBWUFParam::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	using namespace RooFit;
+	if( BR[0][0] == 0 ){ readFile(); }
+	double key[] = { m4l.min(rangeName), m4l.max(rangeName), (double)mH, (double)scaleParam };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m4l.min(rangeName), m4l.max(rangeName), mH, HiggsWidth(0,mH));
+}
+
 /************RooRelBWHighMass*************/
 
 ClassImp(RooRelBWHighMass)
@@ -3282,6 +3503,29 @@ Double_t RooRelBWHighMass::evaluate() const
 	return pdf;
 }
 
+Int_t RooRelBWHighMass::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m4l)) return 1;
+	return 0;
+}
+
+Double_t RooRelBWHighMass::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	// with u = m4l^2 the integrand is 1/2 * 1/((u-c)^2 + d2), with c = mH^2 - gamma^2/2 and d2 = gamma^2 (mH^2 - gamma^2/4)
+	Double_t c = mH*mH - 0.5*gamma*gamma, d2 = gamma*gamma*(mH*mH - 0.25*gamma*gamma);
+	Double_t umin = pow(m4l.min(rangeName),2) - c, umax = pow(m4l.max(rangeName),2) - c;
+	if (d2 > 0) {
+		Double_t d = sqrt(d2);
+		return 0.5*(atan(umax/d) - atan(umin/d))/d;
+	} else if (d2 < 0) {
+		Double_t e = sqrt(-d2);
+		return 0.25*(log(fabs((umax - e)/(umax + e))) - log(fabs((umin - e)/(umin + e))))/e;
+	} else {
+		return 0.5*(1/umin - 1/umax);
+	}
+}
+
 
 
 
@@ -3497,13 +3741,31 @@ gamma("gamma",this,other.gamma)
 
 
 Double_t RooRelBW1::evaluate() const
+{
+	return evaluateAt(m);
+}
+
+Double_t RooRelBW1::evaluateAt(Double_t mass) const
 {
 	
-	Double_t arg= m*m - mean*mean;
+	Double_t arg= mass*mass - mean*mean;
 	Double_t relBW =  (mean*gamma) / (arg*arg + mean*mean*gamma*gamma);
 	return relBW;
 }
 
+Int_t RooRelBW1::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const
+{
+	if (matchArgs(allVars,analVars,m)) return 1;
+	return 0;
+}
+
+Double_t RooRelBW1::analyticalIntegral(Int_t code, const char* rangeName) const
+{
+	assert(code==1);
+	double key[] = { m.min(rangeName), m.max(rangeName), (double)mean, (double)gamma };
+	return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, m.min(rangeName), m.max(rangeName), mean, gamma);
+}
+
 
 
 /****************RooTsallis******************/
@@ -3551,9 +3813,27 @@ RooTsallis::RooTsallis() {}
 
 
  double RooTsallis::evaluate() const 
+ { 
+   return evaluateAt(x);
+ } 
+
+ double RooTsallis::evaluateAt(Double_t mass) const 
  { 
    // cout<<"In rooTsallis3::evaluate()"<<endl;
-   return pow(x,n2)*exp(-bb*x)*pow(1 + (sqrt(x*x + m*m) - m)/(n*T),-n) + fexp*exp(-bb2*x);
+   return pow(mass,n2)*exp(-bb*mass)*pow(1 + (sqrt(mass*mass + m*m) - m)/(n*T),-n) + fexp*exp(-bb2*mass);
+ } 
+
+ Int_t RooTsallis::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const 
+ {
+   if (matchArgs(allVars,analVars,x)) return 1;
+   return 0;
+ }
+
+ Double_t RooTsallis::analyticalIntegral(Int_t code, const char* rangeName) const 
+ {
+   assert(code==1);
+   double key[] = { x.min(rangeName), x.max(rangeName), (double)m, (double)n, (double)n2, (double)bb, (double)bb2, (double)T, (double)fexp };
+   return cachedIntegral(integral_, key, sizeof(key)/sizeof(double), [this](double mass) { return evaluateAt(mass); }, x.min(rangeName), x.max(rangeName));
  } 
 
 
@@ -3611,7 +3891,7 @@ RooaDoubleCBxBW::RooaDoubleCBxBW(const RooaDoubleCBxBW& other, const char* name)
 {
 }
 
-double RooaDoubleCBxBW::evaluateDoubleCB() const
+double RooaDoubleCBxBW::evaluateDoubleCB(double xv) const
 {
 
   double al = alphaL;
@@ -3632,7 +3912,7 @@ double RooaDoubleCBxBW::evaluateDoubleCB() const
   double c1R = ( -(AR/TMath::Power(BR+tsR,(int)nR+1))*nR*(tsR-t0R) - AR/TMath::Power(BR+tsR,(int)nR) ) / ((tsR-t0R)*(tsR-t0R));
   double c2R = ( AR/TMath::Power(BR+tsR,(int)nR) - c1R*(tsR-t0R)*(tsR-t0R) ) / (tsR-t0R);
 
-  double t = (x-(mean+shift))/sigma;
+  double t = (xv-(mean+shift))/sigma;
 
   double gaussval = exp(-0.5*t*t);
   double polval = 0.0;
@@ -3653,7 +3933,7 @@ double RooaDoubleCBxBW::evaluateDoubleCB() const
   return gaussval + polval;
 }
 
-double RooaDoubleCBxBW::evaluatePowerLaw(double lim, unsigned power, bool isLeft) const
+double RooaDoubleCBxBW::evaluatePowerLaw(double xv, double lim, unsigned power, bool isLeft) const
 {
   double al = alphaL;
   double absaL = fabs((double)al);
@@ -3664,19 +3944,19 @@ double RooaDoubleCBxBW::evaluatePowerLaw(double lim, unsigned power, bool isLeft
   double BR = nR/absaR-absaR;
 
   double d1 = -mean/width;
-  double d2 = (isLeft ? BL*sigma + shift - x : -BR*sigma + shift - x)/width;
+  double d2 = (isLeft ? BL*sigma + shift - xv : -BR*sigma + shift - xv)/width;
   double expr1 = (d1-d2)*(d1-d2)  +  1.0;
 
   if      (power ==  0) return -(atan2(d1 - lim, 1.));
 
   else if (power ==  1) return ((2*d2*atan2((d1 - lim),1.) + 2*d1*atan2((-d1 + lim),1.) + 2*log(fabs(-d2 + lim)) - log(d1*d1 + 1.0 - 2*d1*lim + lim*lim))/ (2*expr1));
 
-  else return ( -evaluatePowerLaw(lim, power-2, isLeft) + 2*(d1-d2)*evaluatePowerLaw(lim, power-1, isLeft) - 1.0/((power-1)*pow(lim-d2,power-1)) )  /  expr1;
+  else return ( -evaluatePowerLaw(xv, lim, power-2, isLeft) + 2*(d1-d2)*evaluatePowerLaw(xv, lim, power-1, isLeft) - 1.0/((power-1)*pow(lim-d2,power-1)) )  /  expr1;
 }
 
-double RooaDoubleCBxBW::evaluateVoigtian() const
+double RooaDoubleCBxBW::evaluateVoigtian(double xv) const
 {
-  double arg = x - mean - shift;
+  double arg = xv - mean - shift;
   double c = 1./(sqrt(2.)*sigma);
   double a = 0.5*c*width;
   double u = c*arg;
@@ -3685,7 +3965,7 @@ double RooaDoubleCBxBW::evaluateVoigtian() const
   return atan2(0.,-1.)*v.re()/width;
 }
 
-double RooaDoubleCBxBW::evaluateQuadratic(double lim1, double lim2, bool isLeft) const
+double RooaDoubleCBxBW::evaluateQuadratic(double xv, double lim1, double lim2, bool isLeft) const
 {
 
   double al = alphaL;
@@ -3720,17 +4000,68 @@ double RooaDoubleCBxBW::evaluateQuadratic(double lim1, double lim2, bool isLeft)
   double shift2 = shift*shift;
   double width2 = width*width;
   double t02 = t0*t0;
-  double x2 = x*x;
+  double x2 = xv*xv;
 
-  double val1 = (c1*(lim1 + mean) + ((-(c2*sigma*(shift + sigma*t0 + mean - x)) + c1*(shift2 + sigma2*t02 - width2 + mean2 + 2*sigma*t0*(mean - x) + 2*shift*(sigma*t0 + mean - x) - 2*mean*x + x2))*atan2((lim1 + mean),width))/width + ((c2*sigma - 2*c1*(shift + sigma*t0 + mean - x))* log(width2 + (lim1 + mean)*(lim1 + mean)))/2)/sigma2;
+  double val1 = (c1*(lim1 + mean) + ((-(c2*sigma*(shift + sigma*t0 + mean - xv)) + c1*(shift2 + sigma2*t02 - width2 + mean2 + 2*sigma*t0*(mean - xv) + 2*shift*(sigma*t0 + mean - xv) - 2*mean*xv + x2))*atan2((lim1 + mean),width))/width + ((c2*sigma - 2*c1*(shift + sigma*t0 + mean - xv))* log(width2 + (lim1 + mean)*(lim1 + mean)))/2)/sigma2;
 
-  double val2 = (c1*(lim2 + mean) + ((-(c2*sigma*(shift + sigma*t0 + mean - x)) + c1*(shift2 + sigma2*t02 - width2 + mean2 + 2*sigma*t0*(mean - x) + 2*shift*(sigma*t0 + mean - x) - 2*mean*x + x2))*atan2((lim2 + mean),width))/width + ((c2*sigma - 2*c1*(shift + sigma*t0 + mean - x))* log(width2 + (lim2 + mean)*(lim2 + mean)))/2)/sigma2;
+  double val2 = (c1*(lim2 + mean) + ((-(c2*sigma*(shift + sigma*t0 + mean - xv)) + c1*(shift2 + sigma2*t02 - width2 + mean2 + 2*sigma*t0*(mean - xv) + 2*shift*(sigma*t0 + mean - xv) - 2*mean*xv + x2))*atan2((lim2 + mean),width))/width + ((c2*sigma - 2*c1*(shift + sigma*t0 + mean - xv))* log(width2 + (lim2 + mean)*(lim2 + mean)))/2)/sigma2;
 
 
   return val2 - val1;
 }
 
 double RooaDoubleCBxBW::evaluate() const
+{
+  static unsigned int tableNodes = runtimedef::get("CBXBW_TABLE");
+  if (tableNodes == 0) return evaluateExact(x);
+  updateTable_();
+  return interpolate_(x - shift);
+}
+
+void RooaDoubleCBxBW::evaluateMany(unsigned int n, const double *xvals, double *out) const
+{
+  static unsigned int tableNodes = runtimedef::get("CBXBW_TABLE");
+  if (tableNodes == 0) {
+    for (unsigned int i = 0; i < n; ++i) out[i] = evaluateExact(xvals[i]);
+    return;
+  }
+  updateTable_();
+  double s = shift;
+  for (unsigned int i = 0; i < n; ++i) out[i] = interpolate_(xvals[i] - s);
+}
+
+void RooaDoubleCBxBW::updateTable_() const
+{
+  static unsigned int tableNodes = runtimedef::get("CBXBW_TABLE");
+  const unsigned int maxNodes = 200000;
+  double key[] = { sigma, alphaL, alphaR, mean, width, thetaL, thetaR };
+  double lo = x.min() - shift, hi = x.max() - shift;
+  bool sameKey = (tableKey_.size() == 7 && std::equal(key, key + 7, tableKey_.begin()));
+  // interpolation needs one more node on each side
+  if (sameKey && lo >= tableLo_ + tableStep_ && hi <= tableLo_ + (table_.size() - 2) * tableStep_) return;
+  // leave some margin for the shift to move
+  double margin = 0.1 * (hi - lo);
+  lo -= margin; hi += margin;
+  double step = std::min(double(sigma), width > 0 ? double(width) : double(sigma)) / tableNodes;
+  if (!(step > 0) || (hi - lo) / step > maxNodes) step = (hi - lo) / maxNodes;
+  unsigned int n = std::ceil((hi - lo) / step) + 3;
+  tableLo_ = lo - step; tableStep_ = step;
+  table_.resize(n);
+  double s = shift;
+  for (unsigned int i = 0; i < n; ++i) table_[i] = evaluateExact(tableLo_ + i * step + s);
+  tableKey_.assign(key, key + 7);
+}
+
+double RooaDoubleCBxBW::interpolate_(double d) const
+{
+  double u = (d - tableLo_) / tableStep_;
+  int i = std::max(1, std::min(int(u), int(table_.size()) - 3));
+  double t = u - i;
+  const double *p = &table_[i-1];
+  return p[1] + 0.5 * t * (p[2] - p[0] + t * (2*p[0] - 5*p[1] + 4*p[2] - p[3] + t * (3*(p[1] - p[2]) + p[3] - p[0])));
+}
+
+double RooaDoubleCBxBW::evaluateExact(double xv) const
 {
   double al = alphaL;
   double absaL = fabs((double)al);
@@ -3744,13 +4075,13 @@ double RooaDoubleCBxBW::evaluate() const
 
   double inf = 1000000.0;
 
-  double point1 = tsL*(sigma)+shift-x;
-  double point2 = (-absaL)*(sigma)+shift-x;
-  double point3 = ( absaR)*(sigma)+shift-x;
-  double point4 = tsR*(sigma)+shift-x;
+  double point1 = tsL*(sigma)+shift-xv;
+  double point2 = (-absaL)*(sigma)+shift-xv;
+  double point3 = ( absaR)*(sigma)+shift-xv;
+  double point4 = tsR*(sigma)+shift-xv;
 
-  if (width == 0.0) return evaluateDoubleCB();
-  else return max(0., (AL*pow(-sigma/width,nL)/width)*(evaluatePowerLaw(point1/width, nL, true) - evaluatePowerLaw(-inf, nL, true))) +  evaluateQuadratic(point1, point2, true) + evaluateVoigtian() + evaluateQuadratic(point3, point4, false) + max(0., (AR*pow(sigma/width, nR)/width)*(evaluatePowerLaw(inf, nR, false) - evaluatePowerLaw(point4/width, nR, false)));
+  if (width == 0.0) return evaluateDoubleCB(xv);
+  else return max(0., (AL*pow(-sigma/width,nL)/width)*(evaluatePowerLaw(xv, point1/width, nL, true) - evaluatePowerLaw(xv, -inf, nL, true))) +  evaluateQuadratic(xv, point1, point2, true) + evaluateVoigtian(xv) + evaluateQuadratic(xv, point3, point4, false) + max(0., (AR*pow(sigma/width, nR)/width)*(evaluatePowerLaw(xv, inf, nR, false) - evaluatePowerLaw(xv, point4/width, nR, false)));
 
 }
 
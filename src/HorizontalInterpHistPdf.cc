@@ -0,0 +1,221 @@
+#include "../interface/HorizontalInterpHistPdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "TH1.h"
+#include "RooRealVar.h"
+#include "RooArgSet.h"
+#include "vectorized.h"
+
+ClassImp(FastHorizontalInterpHistPdf)
+
+namespace {
+    // The points (x, y) where a cumulative distribution (at the bin edges) changes slope, with y non-decreasing:
+    // x goes from where the distribution starts to rise to where it stops (as in th1fmorph), and of a run of
+    // empty bins in between only the two ends are kept (the quantile jumps there, so they have the same y)
+    void findKinks(const FastHisto &binning, const double *cdf, int nbins, std::vector<double> &xs, std::vector<double> &ys) {
+        xs.clear(); ys.clear();
+        int first = 0, last = nbins;
+        while (first < nbins && cdf[first+1] <= cdf[0]) ++first;
+        while (last > first && cdf[last-1] >= cdf[nbins]) --last;
+        for (int i = first; i <= last; ++i) {
+            int n = ys.size();
+            if (n >= 2 && cdf[i] <= ys[n-1] && ys[n-2] == ys[n-1]) { xs.back() = binning.GetEdge(i); continue; }
+            xs.push_back(binning.GetEdge(i)); ys.push_back(n && cdf[i] <= ys[n-1] ? ys[n-1] : cdf[i]);
+        }
+    }
+
+    // x at probability y between the kinks i-1 and i
+    inline double quantile(const std::vector<double> &xs, const std::vector<double> &ys, int i, double y) {
+        return xs[i-1] + (xs[i] - xs[i-1]) * (y - ys[i-1]) / (ys[i] - ys[i-1]);
+    }
+}
+
+FastHorizontalInterpHistPdf::FastHorizontalInterpHistPdf(const char *name, const char *title, const RooRealVar &x, const RooAbsReal &param, const TList & funcList, const std::vector<double> &points) :
+    RooAbsPdf(name,title),
+    _x("x","Independent variable",this,const_cast<RooRealVar&>(x)),
+    _param("param","Interpolation parameter",this,const_cast<RooAbsReal&>(param)),
+    _points(points),
+    _cacheParam(0)
+{
+    int ntempl = funcList.GetSize();
+    if (ntempl == 0 || ntempl != int(points.size())) {
+        throw std::invalid_argument("FastHorizontalInterpHistPdf: there must be one template for each point");
+    }
+    for (int i = 1; i < ntempl; ++i) {
+        if (!(points[i] > points[i-1])) throw std::invalid_argument("FastHorizontalInterpHistPdf: the points must be in increasing order");
+    }
+    const TH1 *first = dynamic_cast<const TH1 *>(funcList.At(0));
+    if (first == 0) throw std::invalid_argument("FastHorizontalInterpHistPdf: the templates must be TH1");
+    int nbins = first->GetNbinsX();
+    _binning = FastHisto(*first);
+    _binning.Normalize();
+    _cdfs.resize(ntempl * (nbins+1));
+    for (int k = 0; k < ntempl; ++k) {
+        const TH1 *hist = dynamic_cast<const TH1 *>(funcList.At(k));
+        if (hist == 0) throw std::invalid_argument("FastHorizontalInterpHistPdf: the templates must be TH1");
+        if (hist->GetNbinsX() != nbins) throw std::invalid_argument("FastHorizontalInterpHistPdf: all the templates must have the same binning");
+        for (int i = 0; i <= nbins; ++i) {
+            double edge = hist->GetXaxis()->GetBinLowEdge(i+1), ref = _binning.GetEdge(i);
+            if (std::abs(edge - ref) > 1e-6 * hist->GetXaxis()->GetBinWidth(std::max(i,1))) {
+                throw std::invalid_argument("FastHorizontalInterpHistPdf: all the templates must have the same binning");
+            }
+        }
+        // under- and overflows are ignored, as in th1fmorph
+        double *cdf = &_cdfs[k * (nbins+1)], total = 0;
+        cdf[0] = 0;
+        for (int i = 1; i <= nbins; ++i) cdf[i] = (total += hist->GetBinContent(i));
+        if (total > 0) {
+            for (int i = 1; i < nbins; ++i) cdf[i] /= total;
+            cdf[nbins] = 1;
+        } else {
+            std::fill(cdf, cdf + nbins + 1, 0.);
+        }
+    }
+    initPairs();
+    syncTotal();
+}
+
+FastHorizontalInterpHistPdf::FastHorizontalInterpHistPdf(const FastHorizontalInterpHistPdf& other, const char* name) :
+    RooAbsPdf(other,name),
+    _x("x",this,other._x),
+    _param("param",this,other._param),
+    _points(other._points),
+    _cdfs(other._cdfs),
+    _binning(other._binning),
+    _cache(other._cache),
+    _cacheParam(other._cacheParam),
+    _pairBegin(other._pairBegin),
+    _ys(other._ys), _xlo(other._xlo), _xdiff(other._xdiff)
+{
+}
+
+Double_t FastHorizontalInterpHistPdf::evaluate() const
+{
+    sync();
+    return _cache.GetAt(_x);
+}
+
+void FastHorizontalInterpHistPdf::initPairs() const
+{
+    int ntempl = _points.size(), nbins = _binning.fullsize();
+    _pairBegin.assign(1, 0);
+    _ys.clear(); _xlo.clear(); _xdiff.clear();
+    std::vector<double> xs1, ys1, xs2, ys2;
+    for (int k = 0; k + 1 < ntempl; ++k) {
+        const double *cdf1 = &_cdfs[k * (nbins+1)], *cdf2 = &_cdfs[(k+1) * (nbins+1)];
+        if (cdf1[nbins] > 0 && cdf2[nbins] > 0) {
+            // walk along the kinks of both, by increasing probability (both go from 0 to 1);
+            // the ends of an empty region are matched to the same quantile of the other template
+            findKinks(_binning, cdf1, nbins, xs1, ys1);
+            findKinks(_binning, cdf2, nbins, xs2, ys2);
+            for (int i1 = 0, i2 = 0, n1 = ys1.size(), n2 = ys2.size(); i1 < n1 && i2 < n2; ) {
+                double y, x1, x2;
+                if (ys1[i1] == ys2[i2]) {
+                    y = ys1[i1]; x1 = xs1[i1++]; x2 = xs2[i2++];
+                } else if (ys1[i1] < ys2[i2]) {
+                    y = ys1[i1]; x1 = xs1[i1++]; x2 = quantile(xs2, ys2, i2, y);
+                } else {
+                    y = ys2[i2]; x2 = xs2[i2++]; x1 = quantile(xs1, ys1, i1, y);
+                }
+                _ys.push_back(y); _xlo.push_back(x1); _xdiff.push_back(x2 - x1);
+            }
+        } // else the result is empty, as in th1fmorph
+        _pairBegin.push_back(_ys.size());
+    }
+}
+
+void FastHorizontalInterpHistPdf::syncTotal() const
+{
+    if (_cache.size() == 0) _cache = _binning; // _cache is not persisted
+    if (_pairBegin.empty()) initPairs(); // nor are the tables
+    double param = _param;
+    _cacheParam = param;
+    int npoints = _points.size(), nbins = _cache.fullsize();
+    if (npoints == 1) { _cache = _binning; return; }
+
+    // pair of templates, and quantiles of the interpolation: x = xlo + w * (xhi - xlo)
+    int k = std::upper_bound(_points.begin(), _points.end(), param) - _points.begin() - 1;
+    k = std::max(0, std::min(k, npoints - 2));
+    double w = (param - _points[k]) / (_points[k+1] - _points[k]);
+    int begin = _pairBegin[k], n = _pairBegin[k+1] - begin;
+    if (n == 0) { _cache.Clear(); return; }
+    if (_xwork.size() < unsigned(n)) _xwork.resize(n);
+    const double *ys = &_ys[begin];
+    double *xs = &_xwork[0];
+    std::copy(&_xlo[begin], &_xlo[begin] + n, xs);
+    vectorized::mul_add(n, w, &_xdiff[begin], xs);
+    if (w < 0 || w > 1) {
+        // when extrapolating, the quantiles can cross
+        for (int j = 1; j < n; ++j) xs[j] = std::max(xs[j], xs[j-1]);
+    }
+
+    // cumulative distribution at the bin edges, and its differences divided by the bin widths
+    double prev = 0;
+    for (int i = 0, j = 0; i <= nbins; ++i) {
+        double edge = _cache.GetEdge(i), cdf;
+        if (edge <= xs[0]) {
+            cdf = 0;
+        } else if (edge >= xs[n-1]) {
+            cdf = 1;
+        } else {
+            while (xs[j+1] <= edge) ++j;
+            cdf = ys[j] + (ys[j+1] - ys[j]) * (edge - xs[j]) / (xs[j+1] - xs[j]);
+        }
+        if (i > 0) _cache[i-1] = (cdf - prev) / _cache.GetBinWidth(i-1);
+        prev = cdf;
+    }
+    // parts of the distribution can end up outside the range when extrapolating
+    _cache.Normalize();
+}
+
+FastHorizontalInterpHistPdfV::FastHorizontalInterpHistPdfV(const FastHorizontalInterpHistPdf &hpdf, const RooAbsData &data) :
+    hpdf_(hpdf), begin_(0), end_(0), outside_(false)
+{
+    hpdf.sync();
+    std::vector<Double_t> xvals;
+    RooArgSet obs(hpdf._x.arg());
+    const RooRealVar &x = static_cast<const RooRealVar &>(*obs.first());
+    xvals.reserve(data.numEntries());
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        obs = *data.get(i);
+        if (data.weight() == 0) continue;
+        xvals.push_back(x.getVal());
+    }
+    bins_.resize(xvals.size());
+    if (!xvals.empty()) hpdf._cache.FindBins(&xvals[0], &bins_[0], xvals.size());
+    bool aligned = true;
+    for (int i = 0, n = bins_.size(), nbins = hpdf._cache.fullsize(); i < n; ++i) {
+        if (bins_[i] < 0 || bins_[i] >= nbins) { bins_[i] = -1; outside_ = true; }
+        if (i > 0 && bins_[i] != bins_[i-1] + 1) aligned = false;
+    }
+    if (!bins_.empty() && aligned && !outside_) {
+        begin_ = bins_.front();
+        end_   = bins_.back() + 1;
+        bins_.clear();
+    }
+}
+
+void FastHorizontalInterpHistPdfV::fill(std::vector<Double_t> &out) const
+{
+    hpdf_.sync();
+    const Double_t *values = & hpdf_._cache[0];
+    if (begin_ != end_) {
+        out.assign(values + begin_, values + end_);
+    } else if (!outside_) {
+        out.resize(bins_.size());
+        if (!bins_.empty()) vectorized::gather(bins_.size(), &bins_[0], values, &out[0]);
+    } else {
+        out.resize(bins_.size());
+        for (int i = 0, n = bins_.size(); i < n; ++i) out[i] = (bins_[i] >= 0 ? values[bins_[i]] : 0);
+    }
+}
+
+const Double_t * FastHorizontalInterpHistPdfV::values() const
+{
+    if (begin_ == end_) return 0;
+    hpdf_.sync();
+    return & hpdf_._cache[begin_];
+}
@@ -1,6 +1,7 @@
 #include "../interface/MultiDimFit.h"
 #include <stdexcept>
 #include <cmath>
+#include <algorithm>
 
 #include "TMath.h"
 #include "RooArgSet.h"
@@ -9,6 +10,7 @@
 #include "RooAbsData.h"
 #include "RooFitResult.h"
 #include "../interface/RooMinimizerOpt.h"
+#include "../interface/CachingNLL.h"
 #include <RooStats/ModelConfig.h>
 #include "../interface/Combine.h"
 #include "../interface/CascadeMinimizer.h"
@@ -235,6 +237,9 @@ void MultiDimFit::doGrid(RooAbsReal &nll)
     RooArgSet snap; params->snapshot(snap);
     //snap.Print("V");
     if (n == 1) {
+        // in a fast scan on a CachingSimNLL the points are just collected here, and evaluated in batches below
+        cacheutils::CachingSimNLL *simnll = fastScan_ ? dynamic_cast<cacheutils::CachingSimNLL *>(&nll) : 0;
+        std::vector<double> batchX;
 	// can do a more intellegent spacing of points
         for (unsigned int i = 0; i < points_; ++i) {
             if (i < firstPoint_) continue;
@@ -248,6 +253,7 @@ void MultiDimFit::doGrid(RooAbsReal &nll)
 	    }
 
             if (verbose > 1) std::cout << "Point " << i << "/" << points_ << " " << poiVars_[0]->GetName() << " = " << x << std::endl;
+            if (simnll) { batchX.push_back(x); continue; }
             *params = snap; 
             poiVals_[0] = x;
             poiVars_[0]->setVal(x);
@@ -262,6 +268,21 @@ void MultiDimFit::doGrid(RooAbsReal &nll)
                 Combine::commitPoint(true, /*quantile=*/prob);
             }
         }
+        const unsigned int batchSize = 64;
+        std::vector<double> batchNLL(batchSize);
+        for (unsigned int i0 = 0; i0 < batchX.size(); i0 += batchSize) {
+            unsigned int nbatch = std::min<unsigned int>(batchSize, batchX.size() - i0);
+            *params = snap; 
+            simnll->evaluateBatch(poiVars_, &batchX[i0], nbatch, &batchNLL[0]);
+            for (unsigned int i = 0; i < nbatch; ++i) {
+                poiVals_[0] = batchX[i0+i];
+                poiVars_[0]->setVal(batchX[i0+i]);
+                deltaNLL_ = batchNLL[i] - nll0;
+                double qN = 2*(deltaNLL_);
+                double prob = ROOT::Math::chisquared_cdf_c(qN, n+nOtherFloatingPoi_);
+                Combine::commitPoint(true, /*quantile=*/prob);
+            }
+        }
     } else if (n == 2) {
         unsigned int sqrn = ceil(sqrt(double(points_)));
         unsigned int ipoint = 0, nprint = ceil(0.005*sqrn*sqrn);
@@ -103,6 +103,48 @@ Double_t ProcessNormalization::logKappaForX(double x, const std::pair<double,dou
     return ret;
 } 
 
+Double_t ProcessNormalization::logKappaForXDerivative(double x, const std::pair<double,double> &logKappas) const {
+    if (fabs(x) >= 0.5) return 0;
+    // d/dx [avg + halfdiff * h(2x)] = 2 * halfdiff * h'(2x), with h'(x) = 15/8 (x^2-1)^2
+    double halfdiff = 0.5*(logKappas.second + logKappas.first);
+    double twox = x+x, twox2m1 = twox*twox - 1;
+    return 2 * halfdiff * 1.875 * twox2m1 * twox2m1;
+}
+
+Double_t ProcessNormalization::logKappaDerivative(const RooAbsArg &theta) const {
+    double ret = 0.0;
+    if (!logKappa_.empty()) {
+        RooLinkedListIter iterTheta = thetaList_.iterator();
+        std::vector<double>::const_iterator logKappa = logKappa_.begin();
+        for (RooAbsReal *th = (RooAbsReal*) iterTheta.Next(); th != 0; th = (RooAbsReal*) iterTheta.Next(), ++logKappa) {
+            if (th == &theta) ret += (*logKappa);
+        }
+    }
+    if (!logAsymmKappa_.empty()) {
+        RooLinkedListIter iterTheta = asymmThetaList_.iterator();
+        std::vector<std::pair<double,double> >::const_iterator logKappas = logAsymmKappa_.begin();
+        for (RooAbsReal *th = (RooAbsReal*) iterTheta.Next(); th != 0; th = (RooAbsReal*) iterTheta.Next(), ++logKappas) {
+            if (th != &theta) continue;
+            // d/dx [ x * logKappa(x) ]
+            double x = th->getVal();
+            ret += logKappaForX(x, *logKappas) + x * logKappaForXDerivative(x, *logKappas);
+        }
+    }
+    return ret;
+}
+
+Bool_t ProcessNormalization::hasFundamentalThetasOnly() const {
+    RooLinkedListIter iterTheta = thetaList_.iterator();
+    for (RooAbsArg *th = (RooAbsArg*) iterTheta.Next(); th != 0; th = (RooAbsArg*) iterTheta.Next()) {
+        if (!th->isFundamental()) return false;
+    }
+    RooLinkedListIter iterAsymm = asymmThetaList_.iterator();
+    for (RooAbsArg *th = (RooAbsArg*) iterAsymm.Next(); th != 0; th = (RooAbsArg*) iterAsymm.Next()) {
+        if (!th->isFundamental()) return false;
+    }
+    return true;
+}
+
 void ProcessNormalization::dump() const {
     std::cout << "Dumping ProcessNormalization " << GetName() << " @ " << (void*)this << std::endl;
     std::cout << "\tnominal value: " << nominalValue_ << std::endl;
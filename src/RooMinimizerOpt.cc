@@ -1,4 +1,6 @@
 #include "../interface/RooMinimizerOpt.h"
+#include "../interface/CachingNLL.h"
+#include "../interface/ProfilingTools.h"
 
 #include <stdexcept>
 #include <RooRealVar.h>
@@ -19,6 +21,27 @@ RooMinimizerOpt::RooMinimizerOpt(RooAbsReal& function) :
     setEps(ROOT::Math::MinimizerOptions::DefaultTolerance());
 }
 
+RooMinimizerOpt::~RooMinimizerOpt()
+{
+}
+
+bool
+RooMinimizerOpt::fitFCN()
+{
+    static bool useGradient = runtimedef::get("MINIMIZER_ANALYTIC_GRAD");
+    static bool useBatchGradient = runtimedef::get("MINIMIZER_BATCH_GRAD");
+    _gradFcn.reset();
+    if ((useGradient || useBatchGradient) && typeid(*_fcn) == typeid(RooMinimizerFcnOpt) && _theFitter->Config().MinimizerType() == "Minuit2") {
+        const cacheutils::CachingSimNLL *nll = dynamic_cast<const cacheutils::CachingSimNLL *>(_func);
+        bool analytic = useGradient && nll != 0 && nll->supportsGradient();
+        if (nll != 0 && (analytic || useBatchGradient)) {
+            _gradFcn.reset(new RooMinimizerGradFcnOpt(static_cast<const RooMinimizerFcnOpt &>(*_fcn), *nll, analytic));
+            return _theFitter->FitFCN(*_gradFcn);
+        }
+    }
+    return _theFitter->FitFCN(*_fcn);
+}
+
 Double_t
 RooMinimizerOpt::edm()
 {
@@ -42,7 +65,7 @@ Int_t RooMinimizerOpt::minimize(const char* type, const char* alg)
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CollectErrors) ;
   RooAbsReal::clearEvalErrorLog() ;
 
-  bool ret = _theFitter->FitFCN(*_fcn);
+  bool ret = fitFCN();
   _status = ((ret) ? _theFitter->Result().Status() : -1);
 
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
@@ -73,7 +96,7 @@ Int_t RooMinimizerOpt::improve()
   RooAbsReal::clearEvalErrorLog() ;
 
   _theFitter->Config().SetMinimizer(_minimizerType.c_str(),"migradimproved");
-  bool ret = _theFitter->FitFCN(*_fcn);
+  bool ret = fitFCN();
   _status = ((ret) ? _theFitter->Result().Status() : -1);
 
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
@@ -105,7 +128,7 @@ Int_t RooMinimizerOpt::migrad()
   RooAbsReal::clearEvalErrorLog() ;
 
   _theFitter->Config().SetMinimizer(_minimizerType.c_str(),"migrad");
-  bool ret = _theFitter->FitFCN(*_fcn);
+  bool ret = fitFCN();
   _status = ((ret) ? _theFitter->Result().Status() : -1);
 
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
@@ -639,3 +662,35 @@ void RooMinimizerFcnOpt::initStdVects() const {
       }
   }
 }
+
+void
+RooMinimizerGradFcnOpt::Gradient(const double *x, double *grad) const 
+{
+    double f;
+    FdF(x, f, grad);
+}
+
+void
+RooMinimizerGradFcnOpt::FdF(const double *x, double &f, double *grad) const 
+{
+    f = fcn_(x); // also moves the parameters to x
+    const std::vector<RooRealVar *> &vars = fcn_.vars();
+    gradient(vars, grad);
+    for (unsigned int i = 0, n = vars.size(); i < n; ++i) grad[i] *= fcn_.jacobian(i, x[i]);
+}
+
+double
+RooMinimizerGradFcnOpt::DoDerivative(const double *x, unsigned int icoord) const 
+{
+    fcn_(x);
+    double ret = 0;
+    gradient(std::vector<RooRealVar *>(1, fcn_.vars()[icoord]), &ret);
+    return ret * fcn_.jacobian(icoord, x[icoord]);
+}
+
+void
+RooMinimizerGradFcnOpt::gradient(const std::vector<RooRealVar *> &params, double *grad) const 
+{
+    if (analytic_) nll_.gradient(params, grad);
+    else nll_.numericalGradient(params, grad);
+}
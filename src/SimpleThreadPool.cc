@@ -0,0 +1,100 @@
+#include "../interface/SimpleThreadPool.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <utility>
+
+struct SimpleThreadPool::Impl {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeUp, done;
+    unsigned long generation = 0;
+    unsigned int  pending = 0;
+    bool stop = false;
+    const std::vector<std::vector<int> > *partitions = 0;
+    const std::function<void(int)> *job = 0;
+
+    void loop(unsigned int ithread) {
+        unsigned long seen = 0;
+        for (;;) {
+            const std::vector<int> *mine = 0;
+            const std::function<void(int)> *fn = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [&]{ return stop || generation != seen; });
+                if (stop) return;
+                seen = generation;
+                if (ithread < partitions->size()) mine = &(*partitions)[ithread];
+                fn = job;
+            }
+            if (mine) {
+                for (int i : *mine) (*fn)(i);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) done.notify_one();
+            }
+        }
+    }
+};
+
+SimpleThreadPool::SimpleThreadPool(unsigned int nthreads) :
+    impl_(new Impl()),
+    nthreads_(std::max(1u, nthreads))
+{
+    for (unsigned int i = 1; i < nthreads_; ++i) {
+        impl_->workers.push_back(std::thread(&Impl::loop, impl_, i));
+    }
+}
+
+SimpleThreadPool::~SimpleThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        impl_->stop = true;
+    }
+    impl_->wakeUp.notify_all();
+    for (std::thread &t : impl_->workers) t.join();
+    delete impl_;
+}
+
+void SimpleThreadPool::run(const std::vector<std::vector<int> > &partitions, const std::function<void(int)> &job)
+{
+    if (impl_->workers.empty()) {
+        for (const std::vector<int> &p : partitions) {
+            for (int i : p) job(i);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        impl_->partitions = &partitions;
+        impl_->job = &job;
+        impl_->pending = impl_->workers.size();
+        impl_->generation++;
+    }
+    impl_->wakeUp.notify_all();
+    if (!partitions.empty()) {
+        for (int i : partitions.front()) job(i);
+    }
+    std::unique_lock<std::mutex> lock(impl_->mutex);
+    impl_->done.wait(lock, [this]{ return impl_->pending == 0; });
+}
+
+void SimpleThreadPool::partition(const std::vector<double> &costs, unsigned int nthreads, std::vector<std::vector<int> > &out)
+{
+    nthreads = std::max(1u, nthreads);
+    out.clear(); out.resize(nthreads);
+    std::vector<std::pair<double,int> > sorted;
+    for (int i = 0, n = costs.size(); i < n; ++i) sorted.push_back(std::make_pair(-costs[i], i));
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<double> load(nthreads, 0.);
+    for (const std::pair<double,int> &job : sorted) {
+        unsigned int best = std::min_element(load.begin(), load.end()) - load.begin();
+        load[best] -= job.first;
+        out[best].push_back(job.second);
+    }
+    for (std::vector<int> &p : out) std::sort(p.begin(), p.end());
+}
@@ -0,0 +1,62 @@
+#include "../interface/VectorizedBernstein.h"
+#include "vectorized.h"
+#include <RooRealVar.h>
+#include <cmath>
+#include <stdexcept>
+
+template<int N>
+VectorizedBernstein<N>::VectorizedBernstein(const RooBernsteinFast<N> &pdf, const RooAbsData &data) :
+    xmin_(std::nan("")), xmax_(std::nan(""))
+{
+    RooArgSet obs(*data.get());
+    if (obs.getSize() != 1) throw std::invalid_argument("Multi-dimensional dataset?");
+
+    Worker w(pdf);
+    if (!obs.contains(w.xvar())) throw std::invalid_argument("Dataset is not the x of the polynomial");
+    x_ = dynamic_cast<const RooRealVar*>(& w.xvar());
+    if (x_ == 0) throw std::invalid_argument("The x of the polynomial is not a RooRealVar");
+    for (int i = 0; i < N; ++i) coefs_.push_back(static_cast<const RooAbsReal *>(w.coefs().at(i)));
+    for (int ipow = 0; ipow <= N; ++ipow) {
+        for (int ibern = 0; ibern <= N; ++ibern) cmatrix_[ipow][ibern] = w.cmatrix(ipow, ibern);
+    }
+
+    RooRealVar *x = dynamic_cast<RooRealVar*>(obs.first());
+    xvals_.reserve(data.numEntries());
+    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
+        obs.assignValueOnly(*data.get(i), true);
+        if (data.weight()) xvals_.push_back(x->getVal());
+    }
+    uvals_.resize(xvals_.size());
+}
+
+template<int N>
+void VectorizedBernstein<N>::fill(std::vector<Double_t> &out) const {
+    double xmin = x_->getMin(), xmax = x_->getMax();
+    if (xmin != xmin_ || xmax != xmax_) {
+        // as in RooBernsteinFast::evaluate
+        for (unsigned int i = 0, n = xvals_.size(); i < n; ++i) uvals_[i] = (xvals_[i] - xmin) / (xmax - xmin);
+        xmin_ = xmin; xmax_ = xmax;
+    }
+    // coefficients in the power basis, and integral over [xmin, xmax] as in RooBernsteinFast::analyticalIntegral
+    double bern[N+1], coeffs[N+1], integral = 0;
+    bern[0] = 1.0;
+    for (int ibern = 1; ibern <= N; ++ibern) bern[ibern] = coefs_[ibern-1]->getVal();
+    for (int ipow = 0; ipow <= N; ++ipow) {
+        double c = 0;
+        for (int ibern = 0; ibern <= ipow; ++ibern) c += cmatrix_[ipow][ibern] * bern[ibern];
+        coeffs[ipow] = c;
+        integral += c / (ipow + 1.0);
+    }
+    double inorm = 1.0 / ((xmax - xmin) * integral);
+    for (int ipow = 0; ipow <= N; ++ipow) coeffs[ipow] *= inorm;
+    out.resize(xvals_.size());
+    vectorized::polynomials(xvals_.size(), N, coeffs, &uvals_[0], &out[0]);
+}
+
+template class VectorizedBernstein<1>;
+template class VectorizedBernstein<2>;
+template class VectorizedBernstein<3>;
+template class VectorizedBernstein<4>;
+template class VectorizedBernstein<5>;
+template class VectorizedBernstein<6>;
+template class VectorizedBernstein<7>;
@@ -0,0 +1,93 @@
+#include "../interface/VectorizedCB.h"
+#include "vectorized.h"
+#include <RooRealVar.h>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    // values of the observable for the entries with non-zero weight
+    void fillXVals(const RooAbsData &data, const RooAbsReal &pdfx, std::vector<Double_t> &xvals) {
+        RooArgSet obs(*data.get());
+        if (obs.getSize() != 1) throw std::invalid_argument("Multi-dimensional dataset?");
+        if (!obs.contains(pdfx)) throw std::invalid_argument("Dataset is not the x of the crystal ball");
+        RooRealVar *x = dynamic_cast<RooRealVar*>(obs.first());
+        xvals.reserve(data.numEntries());
+        for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
+            obs.assignValueOnly(*data.get(i), true);
+            if (data.weight()) xvals.push_back(x->getVal());
+        }
+    }
+}
+
+VectorizedCB::VectorizedCB(const RooCB &pdf, const RooAbsData &data) :
+    pdf_(&pdf)
+{
+    Worker w(pdf);
+    fillXVals(data, w.xvar(), xvals_);
+    normSet_.add(w.xvar());
+    mean_ = & w.meanvar(); width_ = & w.widthvar(); alpha_ = & w.alphavar(); n_ = & w.nvar(); theta_ = & w.thetavar();
+    work_.resize(xvals_.size());
+    work2_.resize(xvals_.size());
+}
+
+void VectorizedCB::fill(std::vector<Double_t> &out) const {
+    // as in RooCB::evaluate: the tail is on the left of t, with t flipped if a < 0, and there is no right tail
+    Double_t theta = theta_->getVal(), alpha = alpha_->getVal(), width = width_->getVal(), n = n_->getVal();
+    Double_t a = std::cos(theta)*alpha - std::sin(theta)*width;
+    Double_t w = std::sin(theta)*alpha + std::cos(theta)*width;
+    Double_t absa = std::abs(a);
+    Double_t logA = n*std::log(n/absa) - 0.5*absa*absa, B = n/absa - absa;
+    // the normalization integral is numeric, and it's cached by RooFit
+    Double_t norm = pdf_->getNorm(normSet_);
+    out.resize(xvals_.size());
+    vectorized::crystal_balls(xvals_.size(), mean_->getVal(), (a < 0 ? -w : w), -absa, logA, B, n,
+                              std::numeric_limits<double>::infinity(), 0., 1., 0., norm,
+                              &xvals_[0], &out[0], &work_[0], &work2_[0]);
+}
+
+template<typename PdfT>
+VectorizedDoubleCBT<PdfT>::VectorizedDoubleCBT(const PdfT &pdf, const RooAbsData &data) :
+    pdf_(&pdf)
+{
+    Worker w(pdf);
+    fillXVals(data, w.xvar(), xvals_);
+    normSet_.add(w.xvar());
+    mean_ = & w.meanvar(); width_ = & w.widthvar();
+    alpha1_ = & w.alpha1var(); n1_ = & w.n1var();
+    alpha2_ = & w.alpha2var(); n2_ = & w.n2var();
+    work_.resize(xvals_.size());
+    work2_.resize(xvals_.size());
+}
+
+template<typename PdfT>
+void VectorizedDoubleCBT<PdfT>::fill(std::vector<Double_t> &out) const {
+    Double_t alpha1 = alpha1_->getVal(), n1 = n1_->getVal(), alpha2 = alpha2_->getVal(), n2 = n2_->getVal();
+    Double_t absa1 = std::abs(alpha1), absa2 = std::abs(alpha2);
+    Double_t logA1 = n1*std::log(n1/absa1) - 0.5*alpha1*alpha1, B1 = n1/absa1 - absa1;
+    Double_t logA2 = n2*std::log(n2/absa2) - 0.5*alpha2*alpha2, B2 = n2/absa2 - absa2;
+    // analytical integral of the pdf
+    Double_t norm = pdf_->getNorm(normSet_);
+    out.resize(xvals_.size());
+    vectorized::crystal_balls(xvals_.size(), mean_->getVal(), width_->getVal(), -alpha1, logA1, B1, n1, alpha2, logA2, B2, n2, norm,
+                              &xvals_[0], &out[0], &work_[0], &work2_[0]);
+}
+
+VectorizedDoubleCBxBW::VectorizedDoubleCBxBW(const RooaDoubleCBxBW &pdf, const RooAbsData &data) :
+    pdf_(&pdf)
+{
+    Worker w(pdf);
+    fillXVals(data, w.xvar(), xvals_);
+    normSet_.add(w.xvar());
+}
+
+void VectorizedDoubleCBxBW::fill(std::vector<Double_t> &out) const {
+    out.resize(xvals_.size());
+    if (xvals_.empty()) return;
+    pdf_->evaluateMany(xvals_.size(), &xvals_[0], &out[0]);
+    Double_t inorm = 1.0/pdf_->getNorm(normSet_);
+    for (unsigned int i = 0, n = out.size(); i < n; ++i) out[i] *= inorm;
+}
+
+template class VectorizedDoubleCBT<RooDoubleCB>;
+template class VectorizedDoubleCBT<RooDoubleCrystalBall>;
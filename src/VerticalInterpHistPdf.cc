@@ -1,19 +1,23 @@
 #include "../interface/VerticalInterpHistPdf.h"
 
 #include <cassert>
+#include <cmath>
 #include <memory>
 
 #include "RooFit.h"
 #include "Riostream.h"
 
+#include "TBuffer.h"
 #include "TIterator.h"
 #include "RooRealVar.h"
 #include "RooMsgService.h"
 #include "RooAbsData.h"
 
+#include "../interface/ProfilingTools.h"
+#include "vectorized.h"
+
 //#define TRACE_CALLS
 #ifdef TRACE_CALLS
-#include "../interface/ProfilingTools.h"
 #define TRACEME()   PerfCounter::add( __PRETTY_FUNCTION__ );
 #else
 #define TRACEME() 
@@ -594,7 +598,7 @@ ClassImp(FastVerticalInterpHistPdf2)
 
 //_____________________________________________________________________________
 FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base() :
-    _initBase(false)
+    _initBase(false), _deltaUpdates(0), _morphsCompacted(false)
 {
   // Default constructor
 }
@@ -607,7 +611,7 @@ FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base(const char *name,
   _smoothRegion(smoothRegion),
   _smoothAlgo(smoothAlgo),
   _initBase(false),
-  _morphs(), _morphParams()
+  _morphs(), _morphParams(), _deltaUpdates(0), _morphsCompacted(false)
 { 
   if (inFuncList.GetSize()!=2*inCoefList.getSize()+1) {
     coutE(InputArguments) << "VerticalInterpHistPdf::VerticalInterpHistPdf(" << GetName() 
@@ -650,11 +654,12 @@ FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base(const FastVertica
   _smoothRegion(other._smoothRegion),
   _smoothAlgo(other._smoothAlgo),
   _initBase(other._initBase),
-  _morphs(other._morphs), _morphParams(other._morphParams)
+  _morphs(other._morphs), _morphParams(other._morphParams), _deltaUpdates(0), _morphValues(other._morphValues), _morphFloats(other._morphFloats), _morphsCompacted(other._morphsCompacted)
 {
     if (_initBase) {
         // Morph params are already set, but we must set the sentry
         _sentry.addVars(_coefList);
+        if (floatMorphs() == 2) _sentry.addVar(storageSwitch());
         _sentry.setValueDirty(); 
     }
 }
@@ -666,7 +671,7 @@ FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base(const FastVertica
   _smoothRegion(other._smoothRegion),
   _smoothAlgo(other._smoothAlgo),
   _initBase(false),
-  _morphs(), _morphParams()
+  _morphs(), _morphParams(), _deltaUpdates(0), _morphsCompacted(false)
 {
   // Convert constructor
 }
@@ -699,14 +704,110 @@ FastVerticalInterpHistPdf2Base::initBase() const
 
 
     _sentry.addVars(_coefList);
+    if (floatMorphs() == 2) _sentry.addVar(storageSwitch());
     _sentry.setValueDirty(); 
     _initBase = true;
 }
 
+bool FastVerticalInterpHistPdf2Base::doubleMorphs_ = false;
+
+RooRealVar & 
+FastVerticalInterpHistPdf2Base::storageSwitch() 
+{
+    static RooRealVar *var = new RooRealVar("_FastVerticalInterpHistPdf2_doubleMorphs_", "", 0.);
+    return *var;
+}
+
+int 
+FastVerticalInterpHistPdf2Base::floatMorphs() 
+{
+    // the same for all the pdfs: a change during the job would mix pdfs compacted in different ways
+    static int floatMorphs = runtimedef::get("VERTINTERP_FLOAT_MORPHS");
+    return floatMorphs;
+}
+
+void 
+FastVerticalInterpHistPdf2Base::setDoubleMorphs(bool doubleMorphs) 
+{
+    if (doubleMorphs == doubleMorphs_) return;
+    doubleMorphs_ = doubleMorphs;
+    storageSwitch().setVal(doubleMorphs ? 1. : 0.);
+}
+
+void
+FastVerticalInterpHistPdf2Base::compactMorphs() const 
+{
+    bool sparse = !runtimedef::get("VERTINTERP_DENSE_MORPHS");
+    unsigned int size = 0;
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        Morph &m = _morphs[i];
+        m.nbins = m.sum.fullsize(); m.nactive = m.sum.size();
+        if (sparse) sparsifyMorph(m);
+        m.offset = size;
+        size += 2*morphStride(m);
+    }
+    // a single allocation, so that the morphs are next to each other
+    _morphValues.assign(size, 0.);
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        Morph &m = _morphs[i];
+        double *sum = _morphValues.data() + m.offset, *diff = sum + morphStride(m);
+        if (m.bins.empty()) {
+            if (m.nbins) { std::copy(&m.sum[0], &m.sum[0] + m.nbins, sum); std::copy(&m.diff[0], &m.diff[0] + m.nbins, diff); }
+        } else {
+            for (unsigned int j = 0, nj = m.bins.size(); j < nj; ++j) { sum[j] = m.sum[m.bins[j]]; diff[j] = m.diff[m.bins[j]]; }
+        }
+        m.sum.Release(); m.diff.Release();
+    }
+    if (floatMorphs()) {
+        _morphFloats.assign(_morphValues.begin(), _morphValues.end());
+        if (floatMorphs() == 1) std::vector<double, fasttemplate::Allocator<double> >().swap(_morphValues);
+    }
+    _morphsCompacted = true;
+}
+
+void
+FastVerticalInterpHistPdf2Base::restoreMorphs() const 
+{
+    if (!_morphsCompacted) return;
+    // kept only in single precision (VERTINTERP_FLOAT_MORPHS=1): the values are rounded to it
+    if (_morphValues.empty()) _morphValues.assign(_morphFloats.begin(), _morphFloats.end());
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        Morph &m = _morphs[i];
+        const double *msum = morphSum(m), *mdiff = morphDiff(m);
+        m.sum = FastTemplate(m.nbins); m.diff = FastTemplate(m.nbins);
+        if (m.bins.empty()) {
+            if (m.nbins) { std::copy(msum, msum + m.nbins, &m.sum[0]); std::copy(mdiff, mdiff + m.nbins, &m.diff[0]); }
+        } else {
+            for (unsigned int j = 0, nj = m.bins.size(); j < nj; ++j) { m.sum[m.bins[j]] = msum[j]; m.diff[m.bins[j]] = mdiff[j]; }
+        }
+        m.sum.SetActiveSize(m.nactive); m.diff.SetActiveSize(m.nactive);
+        m.bins.clear();
+    }
+    std::vector<double, fasttemplate::Allocator<double> >().swap(_morphValues);
+    std::vector<float, fasttemplate::Allocator<float> >().swap(_morphFloats);
+    _morphsCompacted = false;
+}
+
+void 
+FastVerticalInterpHistPdf2Base::Streamer(TBuffer &R__b)
+{
+    // the morphs are always written dense and in double precision, and compacted again at the first syncTotal
+    // after reading (or, when writing, right after that)
+    if (R__b.IsReading()) {
+        R__b.ReadClassBuffer(FastVerticalInterpHistPdf2Base::Class(), this);
+        _morphsCompacted = false;
+    } else {
+        bool compacted = _morphsCompacted;
+        restoreMorphs();
+        R__b.WriteClassBuffer(FastVerticalInterpHistPdf2Base::Class(), this);
+        if (compacted) compactMorphs();
+    }
+}
+
 FastVerticalInterpHistPdf2::FastVerticalInterpHistPdf2(const char *name, const char *title, const RooRealVar &x, const TList & funcList, const RooArgList& coefList, Double_t smoothRegion, Int_t smoothAlgo) :
     FastVerticalInterpHistPdf2Base(name,title,RooArgSet(x),funcList,coefList,smoothRegion,smoothAlgo),
     _x("x","Independent variable",this,const_cast<RooRealVar&>(x)),
-    _cache(), _cacheNominal(), _cacheNominalLog()
+    _cache(), _cacheNorm(0), _cacheNominal(), _cacheNominalLog()
 {
     initBase();
     initNominal(funcList.At(0));
@@ -736,7 +837,7 @@ FastVerticalInterpHistPdf2D2::FastVerticalInterpHistPdf2D2(const char *name, con
 FastVerticalInterpHistPdf2::FastVerticalInterpHistPdf2(const FastVerticalInterpHistPdf& other, const char* name) :
     FastVerticalInterpHistPdf2Base(other,name),
     _x("x",this,other._x),
-    _cache(), _cacheNominal(), _cacheNominalLog()
+    _cache(), _cacheNorm(0), _cacheNominal(), _cacheNominalLog()
 {
     initBase();
     other.getVal(RooArgSet(_x.arg()));
@@ -790,6 +891,9 @@ void FastVerticalInterpHistPdf2::setActiveBins(unsigned int bins) {
   _cacheNominal.SetActiveSize(bins);
   _cacheNominalLog.SetActiveSize(bins);
   for (Morph & m : _morphs) {
+    // once compacted, the values are in _morphValues (and for sparse morphs the active bins are those below bins)
+    m.nactive = bins;
+    if (_morphsCompacted) continue;
     m.sum.SetActiveSize(bins);
     m.diff.SetActiveSize(bins);
   }
@@ -906,6 +1010,21 @@ void FastVerticalInterpHistPdf2Base::initMorph(Morph &out, const FastTemplate &n
     //printf("Sum and diff for dimension %d: \n", dim);  out.sum.Dump(); out.diff.Dump();
 }
 
+void FastVerticalInterpHistPdf2Base::sparsifyMorph(Morph &morph) {
+    // above this fraction of non-null bins, the indirect access costs more than melding the null bins
+    const double maxDensity = 0.3;
+    if (!morph.bins.empty()) return;
+    unsigned int n = morph.sum.fullsize(), nonnull = 0;
+    for (unsigned int i = 0; i < n; ++i) {
+        if (morph.sum[i] != 0 || morph.diff[i] != 0) nonnull++;
+    }
+    if (n == 0 || nonnull > maxDensity * n) return;
+    morph.bins.reserve(nonnull);
+    for (unsigned int i = 0; i < n; ++i) {
+        if (morph.sum[i] != 0 || morph.diff[i] != 0) morph.bins.push_back(i);
+    }
+}
+
 
 
 
@@ -925,40 +1044,152 @@ void FastVerticalInterpHistPdf2Base::syncTotal(FastTemplate &cache, const FastTe
      * === and in practice ===
      * we already have computed the histogram for diff=(dhi-dlo) and sum=(dhi+dlo)
      * so we just do template += (0.5 * x) * (diff + smoothStepFunc(x) * sum)
+     * === incremental updates ===
+     * with VERTINTERP_RESYNC=N the sum of the morphs is kept in _morphSum, and when only some of
+     * the parameters moved we add (a' - a) * diff + (a'b' - ab) * sum for those only.
+     * To bound the rounding errors, every N incremental updates we start again from nominal.
      * ========================================== */
-
-    // start from nominal
-    cache.CopyValues(_smoothAlgo < 0 ? cacheNominalLog : cacheNominal);
-    //printf("Cache initialized to nominal template: \n");  cacheNominal.Dump();
-
-    // apply all morphs one by one
-    for (int i = 0, ndim = _coefList.getSize(); i < ndim; ++i) {
+    static unsigned int resync = runtimedef::get("VERTINTERP_RESYNC");
+    unsigned int ndim = _coefList.getSize();
+    if (!_morphsCompacted) compactMorphs();
+    // with both the single and double precision morphs the sum must be recomputed when switching between them
+    if (floatMorphs() == 2) _deltaUpdates = resync;
+
+    bool incremental = (resync && _deltaUpdates < resync && _morphSum.size() == cache.size() && _morphApplied.size() == 2*ndim);
+    _morphApplied.resize(2*ndim);
+    _morphCoeffs.resize(2*ndim);
+    for (unsigned int i = 0; i < ndim; ++i) {
         double x = _morphParams[i]->getVal();
-        double a = 0.5*x, b = smoothStepFunc(x);
-        cache.Meld(_morphs[i].diff, _morphs[i].sum, a, b);    
-        //printf("Merged transformation for dimension %d, x = %+5.3f, step = %.3f: \n", i, x, b);  cache.Dump();
+        double a = 0.5*x, ab = a*smoothStepFunc(x);
+        // for the incremental update only the change matters
+        _morphCoeffs[2*i]   = incremental ? a  - _morphApplied[2*i]   : a;
+        _morphCoeffs[2*i+1] = incremental ? ab - _morphApplied[2*i+1] : ab;
+        _morphApplied[2*i] = a; _morphApplied[2*i+1] = ab;
     }
 
-    // if necessary go back to linear scale
-    if (_smoothAlgo < 0) {
-        cache.Exp();
-        //printf("Done exponential tranformation\n");  cache.Dump();
+    if (incremental) {
+        _deltaUpdates++;
+        meldAll(0, _morphSum, cache);
+    } else if (resync) {
+        _morphSum = cache;
+        _deltaUpdates = 0;
+        meldAll(_smoothAlgo < 0 ? &cacheNominalLog : &cacheNominal, _morphSum, cache);
     } else {
-        cache.CropUnderflows();
+        meldAll(_smoothAlgo < 0 ? &cacheNominalLog : &cacheNominal, cache, cache);
     }
     
     // mark as done
     _sentry.reset();
 }
 
+void FastVerticalInterpHistPdf2Base::meldAll(const FastTemplate *start, FastTemplate &sum, FastTemplate &out) const {
+    // 512 bins of sum and out take 8 kB, and stay in L1 while the morphs are added to them one by one
+    const unsigned int tile = 512;
+    const vectorized::Kernels & kernels = vectorized::kernels();
+    unsigned int n = sum.size(), ndim = _morphs.size();
+    // position in the list of bins of the sparse morphs
+    _morphCursors.assign(ndim, 0);
+    bool floats = useMorphFloats();
+    for (unsigned int lo = 0; lo < n; lo += tile) {
+        unsigned int hi = std::min(n, lo + tile);
+        double *s = &sum[lo];
+        if (start) std::copy(&(*start)[lo], &(*start)[0] + hi, s);
+        for (unsigned int i = 0; i < ndim; ++i) {
+            double x = _morphCoeffs[2*i], xy = _morphCoeffs[2*i+1];
+            const Morph &m = _morphs[i];
+            if (m.bins.empty()) {
+                if (x == 0 && xy == 0) continue;
+                if (floats) vectorized::meld_float(hi - lo, x, xy, morphFloatDiff(m) + lo, morphFloatSum(m) + lo, s);
+                else kernels.meld(hi - lo, x, xy, morphDiff(m) + lo, morphSum(m) + lo, s);
+            } else {
+                unsigned int j = _morphCursors[i], nj = m.bins.size();
+                if (floats) {
+                    const float *msum = morphFloatSum(m), *mdiff = morphFloatDiff(m);
+                    for ( ; j < nj && m.bins[j] < hi; ++j) sum[m.bins[j]] += x * double(mdiff[j]) + xy * double(msum[j]);
+                } else {
+                    const double *msum = morphSum(m), *mdiff = morphDiff(m);
+                    for ( ; j < nj && m.bins[j] < hi; ++j) sum[m.bins[j]] += x * mdiff[j] + xy * msum[j];
+                }
+                _morphCursors[i] = j;
+            }
+        }
+        // if necessary go back to linear scale, or else protect from underflows (as in FastTemplate::CropUnderflows)
+        double *o = &out[lo];
+        if (_smoothAlgo < 0) {
+            for (unsigned int i = 0; i < hi - lo; ++i) o[i] = std::exp(s[i]);
+        } else {
+            for (unsigned int i = 0; i < hi - lo; ++i) o[i] = (s[i] < 1e-9 ? 1e-9 : s[i]);
+        }
+    }
+}
+
 void FastVerticalInterpHistPdf2::syncTotal() const {
     FastVerticalInterpHistPdf2Base::syncTotal(_cache, _cacheNominal, _cacheNominalLog);
 
-    // normalize the result
-    _cache.Normalize(); 
+    // normalize the result (as _cache.Normalize(), but keeping the normalization for the derivatives)
+    _cacheNorm = _cache.IntegralWidth();
+    if (_cacheNorm > 0) _cache.Scale(1.0/_cacheNorm);
     //printf("Normalized result\n");  _cache.Dump();
 }
 
+namespace {
+    // out += a * diff + b * sum for the active bins of the morph, with its values in double or single precision
+    template<typename V>
+    void addMorph(const FastVerticalInterpHistPdf2Base::Morph &m, const V *sum, const V *diff, double a, double b, double *out) {
+        if (m.bins.empty()) {
+            for (unsigned int j = 0; j < m.nactive; ++j) out[j] += a * double(diff[j]) + b * double(sum[j]);
+        } else {
+            for (unsigned int j = 0, n = m.bins.size(); j < n && m.bins[j] < m.nactive; ++j) out[m.bins[j]] += a * double(diff[j]) + b * double(sum[j]);
+        }
+    }
+}
+
+bool FastVerticalInterpHistPdf2Base::addMorphDerivative(const RooAbsArg &param, double *out) const {
+    /* from syncTotal, template += (0.5 * x) * (diff + smoothStepFunc(x) * sum), so
+     * d(template)/dx = 0.5 * diff + 0.5 * (smoothStepFunc(x) + x * smoothStepFunc'(x)) * sum */
+    bool found = false;
+    if (!_morphsCompacted) compactMorphs();
+    for (int i = 0, ndim = _coefList.getSize(); i < ndim; ++i) {
+        if (_morphParams[i] != &param) continue;
+        double x = _morphParams[i]->getVal();
+        double a = 0.5, b = 0.5*(smoothStepFunc(x) + x * smoothStepFuncDerivative(x));
+        const Morph &m = _morphs[i];
+        if (useMorphFloats()) addMorph(m, morphFloatSum(m), morphFloatDiff(m), a, b, out);
+        else                  addMorph(m, morphSum(m), morphDiff(m), a, b, out);
+        found = true;
+    }
+    return found;
+}
+
+bool FastVerticalInterpHistPdf2::derivative(const RooAbsArg &param, std::vector<Double_t> &out) const {
+    if (!_initBase) initBase();
+    if (_cache.size() == 0) _cache = _cacheNominal; // _cache is not persisted
+    if (!_sentry.good() || _cacheNorm == 0) syncTotal();
+    if (_cacheNorm <= 0) return false;
+    unsigned int n = _cache.size();
+    out.assign(n, 0.);
+    // derivative of the un-normalized template (for _smoothAlgo < 0, of its logarithm)
+    if (!addMorphDerivative(param, &out[0])) return false;
+    // then the derivative of the normalized one, p = u/I with I = sum(u * width)
+    //   dp = (du - p * dI)/I
+    double dInorm = 0; // dI/I
+    if (_smoothAlgo < 0) {
+        // du = u * dlog(u), so dp = p * (dlog(u) - dI/I)
+        for (unsigned int i = 0; i < n; ++i) dInorm += _cache[i] * out[i] * _cache.GetBinWidth(i);
+        for (unsigned int i = 0; i < n; ++i) out[i] = _cache[i] * (out[i] - dInorm);
+    } else {
+        // bins that were cropped to 1e-9 by CropUnderflows do not move
+        double invnorm = 1.0/_cacheNorm, cropped = 1.000001e-9 * invnorm;
+        for (unsigned int i = 0; i < n; ++i) {
+            if (_cache[i] <= cropped) out[i] = 0;
+            dInorm += out[i] * _cache.GetBinWidth(i);
+        }
+        dInorm *= invnorm;
+        for (unsigned int i = 0; i < n; ++i) out[i] = out[i] * invnorm - _cache[i] * dInorm;
+    }
+    return true;
+}
+
 void FastVerticalInterpHistPdf2D2::syncTotal() const {
     FastVerticalInterpHistPdf2Base::syncTotal(_cache, _cacheNominal, _cacheNominalLog);
 
@@ -976,16 +1207,20 @@ FastVerticalInterpHistPdf2V::FastVerticalInterpHistPdf2V(const FastVerticalInter
     if (hpdf._cache.size() == 0) hpdf._cache = hpdf._cacheNominal;
     if (!hpdf._sentry.good()) hpdf.syncTotal();
     // find bins
-    std::vector<int> bins;
+    std::vector<Double_t> xvals;
     RooArgSet obs(hpdf._x.arg());
     const RooRealVar &x = static_cast<const RooRealVar &>(*obs.first());
-    bool aligned = true;
+    xvals.reserve(data.numEntries());
     for (int i = 0, n = data.numEntries(); i < n; ++i) {
         obs = *data.get(i);
         if (data.weight() == 0) continue;
-        int idx = hpdf._cache.FindBin(x.getVal());
-        if (!bins.empty() && idx != bins.back() + 1) aligned = false;
-        bins.push_back(idx);
+        xvals.push_back(x.getVal());
+    }
+    std::vector<int> bins(xvals.size());
+    if (!xvals.empty()) hpdf._cache.FindBins(&xvals[0], &bins[0], xvals.size());
+    bool aligned = true;
+    for (int i = 1, n = bins.size(); i < n; ++i) {
+        if (bins[i] != bins[i-1] + 1) { aligned = false; break; }
     }
     if (bins.empty()) {
         // nothing to do.
@@ -1019,16 +1254,111 @@ FastVerticalInterpHistPdf2V::FastVerticalInterpHistPdf2V(const FastVerticalInter
 void FastVerticalInterpHistPdf2V::fill(std::vector<Double_t> &out) const 
 {
     if (!hpdf_._sentry.good()) hpdf_.syncTotal();
+    gather(& hpdf_._cache.GetBinContent(0), out);
+}
+
+const Double_t * FastVerticalInterpHistPdf2V::values() const 
+{
+    if (begin_ == end_) return 0;
+    if (!hpdf_._sentry.good()) hpdf_.syncTotal();
+    return & hpdf_._cache.GetBinContent(begin_);
+}
+
+FastVerticalInterpHistPdf2D2V::FastVerticalInterpHistPdf2D2V(const FastVerticalInterpHistPdf2D2 &hpdf, const RooAbsData &data) :
+    hpdf_(hpdf),begin_(0),end_(0)
+{
+    // check init
+    if (!hpdf._initBase) hpdf.initBase();
+    if (hpdf._cache.size() == 0) hpdf._cache = hpdf._cacheNominal;
+    if (!hpdf._sentry.good()) hpdf.syncTotal();
+    // find bins
+    std::vector<Double_t> xvals, yvals;
+    RooArgSet obs(hpdf._x.arg(), hpdf._y.arg());
+    const RooRealVar &x = static_cast<const RooRealVar &>(hpdf._x.arg());
+    const RooRealVar &y = static_cast<const RooRealVar &>(hpdf._y.arg());
+    xvals.reserve(data.numEntries()); yvals.reserve(data.numEntries());
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        obs = *data.get(i);
+        if (data.weight() == 0) continue;
+        xvals.push_back(x.getVal()); yvals.push_back(y.getVal());
+    }
+    std::vector<int> bins(xvals.size());
+    if (!xvals.empty()) hpdf._cache.FindBins(&xvals[0], &yvals[0], &bins[0], xvals.size());
+    bool aligned = true, outside = false;
+    for (int i = 0, n = bins.size(); i < n; ++i) {
+        if (bins[i] == -1) outside = true;
+        if (i > 0 && bins[i] != bins[i-1] + 1) aligned = false;
+    }
+    if (bins.empty()) {
+        // nothing to do.
+    } else if (aligned && !outside) {
+        begin_ = bins.front();
+        end_   = bins.back()+1;
+    } else {
+        nbins_ = bins.size();
+        bins_.swap(bins);
+        if (outside) return;
+        int start = bins_[0], istart = 0;
+        for (int i = 1, n = bins_.size(); i < n; ++i) {
+            if (bins_[i] != bins_[i-1]+1) { 
+                blocks_.push_back(Block(istart,start,bins_[i-1]+1));
+                start = bins_[i];
+                istart = i;
+            }
+        }
+        blocks_.push_back(Block(istart,start,bins_.back()+1));
+        if (blocks_.size() < 4*bins_.size()) {
+            bins_.clear();
+        } else {
+            blocks_.clear();
+        }
+    }
+}
+
+void FastVerticalInterpHistPdf2D2V::fill(std::vector<Double_t> &out) const 
+{
+    if (!hpdf_._sentry.good()) hpdf_.syncTotal();
+    const Double_t *values = & hpdf_._cache[0];
     if (begin_ != end_) {
         out.resize(end_-begin_);
-        std::copy(& hpdf_._cache.GetBinContent(begin_), & hpdf_._cache.GetBinContent(end_), out.begin());
+        std::copy(values + begin_, values + end_, out.begin());
     } else if (!blocks_.empty()) {
         out.resize(nbins_);
-        for (auto b : blocks_) std::copy(& hpdf_._cache.GetBinContent(b.begin), & hpdf_._cache.GetBinContent(b.end), out.begin()+b.index);
+        for (auto b : blocks_) std::copy(values + b.begin, values + b.end, out.begin()+b.index);
     } else {
         out.resize(bins_.size());
         for (int i = 0, n = bins_.size(); i < n; ++i) {
-            out[i] = hpdf_._cache.GetBinContent(bins_[i]);
+            out[i] = (bins_[i] >= 0 ? values[bins_[i]] : 0);
+        }
+    }
+}
+
+const Double_t * FastVerticalInterpHistPdf2D2V::values() const 
+{
+    if (begin_ == end_) return 0;
+    if (!hpdf_._sentry.good()) hpdf_.syncTotal();
+    return & hpdf_._cache[begin_];
+}
+
+bool FastVerticalInterpHistPdf2V::fillDerivative(const RooAbsArg &param, std::vector<Double_t> &out) const 
+{
+    if (!hpdf_.derivative(param, work_)) return false;
+    gather(&work_[0], out);
+    return true;
+}
+
+void FastVerticalInterpHistPdf2V::gather(const Double_t *values, std::vector<Double_t> &out) const 
+{
+    if (begin_ != end_) {
+        out.resize(end_-begin_);
+        std::copy(values + begin_, values + end_, out.begin());
+    } else if (!blocks_.empty()) {
+        out.resize(nbins_);
+        for (auto b : blocks_) std::copy(values + b.begin, values + b.end, out.begin()+b.index);
+    } else {
+        out.resize(bins_.size());
+        for (int i = 0, n = bins_.size(); i < n; ++i) {
+            out[i] = values[bins_[i]];
         }
     }
 }
@@ -1,61 +1,256 @@
 #include "vectorized.h"
+#include "../interface/ProfilingTools.h"
 
-void vectorized::mul_add(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
-    for (uint32_t i = 0; i < size; ++i) {
-        oarray[i] += coeff * iarray[i];
-    } 
-}
-double vectorized::nll_reduce(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea) {
-    double invsum = 1.0/sumcoeff;
-    for (uint32_t i = 0; i < size; ++i) {
-        pdfvals[i] *= invsum;
+#include <cstdio>
+
+// Scalar reference implementation of the kernels.
+// The sums are done in 8 interleaved partial sums, like the SIMD implementations.
+namespace vectorized { namespace scalar {
+
+    void mul_add(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) {
+            oarray[i] += coeff * iarray[i];
+        }
     }
 
-    vdt::fast_logv(size, pdfvals, workingArea);
+    void nll_accumulate(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea, double * __restrict__ sums) {
+        double invsum = 1.0/sumcoeff;
+        for (uint32_t i = 0; i < size; ++i) {
+            pdfvals[i] *= invsum;
+        }
 
-    for (uint32_t i = 0; i < size; ++i) {
-        pdfvals[i] = weights[i] * workingArea[i];
+        vdt::fast_logv(size, pdfvals, workingArea);
+
+        for (uint32_t i = 0; i < size; ++i) {
+            pdfvals[i] = weights[i] * workingArea[i];
+        }
+
+        for (uint32_t i = 0; i < size; ++i) {
+            sums[i & 7] += pdfvals[i];
+        }
     }
 
+    void nll_accumulate_kahan(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea, double * __restrict__ sums, double * __restrict__ compensations) {
+        double invsum = 1.0/sumcoeff;
+        for (uint32_t i = 0; i < size; ++i) {
+            pdfvals[i] *= invsum;
+        }
 
-    double ret = 0;
-    for (uint32_t i = 0; i < size; ++i) {
-        ret += pdfvals[i];
+        vdt::fast_logv(size, pdfvals, workingArea);
+
+        for (uint32_t i = 0; i < size; ++i) {
+            pdfvals[i] = weights[i] * workingArea[i];
+        }
+
+        for (uint32_t i = 0; i < size; ++i) {
+            double y = pdfvals[i] - compensations[i & 7];
+            double t = sums[i & 7] + y;
+            compensations[i & 7] = (t - sums[i & 7]) - y;
+            sums[i & 7] = t;
+        }
+    }
+
+    void gaussians(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2)
+    {
+        double xscale = -0.5/(sigma*sigma);
+        for (uint32_t i = 0; i < size; ++i) {
+            double dx = xvals[i] - mean;
+            workingArea[i] = xscale * (dx * dx);
+        }
+        vdt::fast_expv(size, workingArea, workingArea2);
+        double inorm = 1.0/norm;
+        for (uint32_t i = 0; i < size; ++i) {
+            out[i] = inorm*workingArea2[i];
+        }
+    }
+
+    void exponentials(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea)
+    {
+        //out[i] = std::exp(xvals[i]*lambda) * nfact; nfact = 1.0/norm
+        double lognfact = -std::log(norm);
+        for (uint32_t i = 0; i < size; ++i) {
+            workingArea[i] = xvals[i] * lambda + lognfact;
+        }
+        vdt::fast_expv(size, workingArea, out);
     }
 
+    void powers(const uint32_t size, double exponent, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea)
+    {
+        //out[i] = std::pow(xvals[i],exponent) * nfact; // nfact = 1.0/norm
+        double lognfact = -std::log(norm);
+        vdt::fast_logv(size, xvals, workingArea);
+        for (uint32_t i = 0; i < size; ++i) {
+            workingArea[i] = workingArea[i]*exponent + lognfact;
+        }
+        vdt::fast_expv(size, workingArea, out);
+    }
+
+    void polynomials(const uint32_t size, uint32_t order, double const * __restrict__ coeffs, const double* __restrict__ xvals, double * __restrict__ out)
+    {
+        for (uint32_t i = 0; i < size; ++i) {
+            out[i] = coeffs[order];
+        }
+        for (uint32_t k = order; k > 0; --k) {
+            double c = coeffs[k-1];
+            for (uint32_t i = 0; i < size; ++i) {
+                out[i] = out[i] * xvals[i] + c;
+            }
+        }
+    }
+
+    void meld(const uint32_t size, double x, double xy, double const * __restrict__ diff, double const * __restrict__ sum, double * __restrict__ out)
+    {
+        for (uint32_t i = 0; i < size; ++i) {
+            out[i] += x * diff[i] + xy * sum[i];
+        }
+    }
+
+    const Kernels * kernels() {
+        static const Kernels k = { "scalar", &mul_add, &nll_accumulate, &nll_accumulate_kahan, &gaussians, &exponentials, &powers, &polynomials, &meld };
+        return &k;
+    }
+} }
+
+const vectorized::Kernels * vectorized::kernels(Isa isa) {
+    switch (isa) {
+        case ScalarIsa: return scalar::kernels();
+        case SSE4Isa:   return sse4::kernels();
+        case AVX2Isa:   return avx2::kernels();
+        case AVX512Isa: return avx512::kernels();
+    }
+    return 0;
+}
+
+const vectorized::Kernels & vectorized::kernels() {
+    static const Kernels *selected = 0;
+    if (selected == 0) {
+        int maxIsa = runtimedef::get("VECTORIZED_ISA");
+        if (maxIsa <= 0 || maxIsa > AVX512Isa) maxIsa = AVX512Isa;
+        for (int isa = maxIsa; isa >= ScalarIsa && selected == 0; --isa) {
+            selected = kernels(Isa(isa));
+        }
+        if (runtimedef::get("VECTORIZED_VERBOSE")) fprintf(stderr, "vectorized: using %s kernels\n", selected->name);
+    }
+    return *selected;
+}
+
+void vectorized::mul_add(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+    kernels().mul_add(size, coeff, iarray, oarray);
+}
+
+double vectorized::nll_reduce(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea) {
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    kernels().nll_accumulate(size, pdfvals, weights, sumcoeff, workingArea, sums);
+    return nll_combine(sums);
+}
+
+double vectorized::nll_reduce_kahan(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea) {
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 }, compensations[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    kernels().nll_accumulate_kahan(size, pdfvals, weights, sumcoeff, workingArea, sums, compensations);
+    return nll_combine_kahan(sums, compensations);
+}
+
+void vectorized::nll_accumulate(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea, double * __restrict__ sums) {
+    kernels().nll_accumulate(size, pdfvals, weights, sumcoeff, workingArea, sums);
+}
+
+void vectorized::nll_accumulate_kahan(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea, double * __restrict__ sums, double * __restrict__ compensations) {
+    kernels().nll_accumulate_kahan(size, pdfvals, weights, sumcoeff, workingArea, sums, compensations);
+}
+
+double vectorized::nll_combine(const double *sums) {
+    return ((sums[0] + sums[4]) + (sums[2] + sums[6])) + ((sums[1] + sums[5]) + (sums[3] + sums[7]));
+}
+
+double vectorized::nll_combine_kahan(const double *sums, const double *compensations) {
+    static const int order[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+    double ret = 0, compensation = 0;
+    for (int k = 0; k < 8; ++k) {
+        double y = (sums[order[k]] - compensations[order[k]]) - compensation;
+        double t = ret + y;
+        compensation = (t - ret) - y;
+        ret = t;
+    }
     return ret;
 }
 
 void vectorized::gaussians(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2)
 {
-    double xscale = -0.5/(sigma*sigma);
-    for (uint32_t i = 0; i < size; ++i) {
-        workingArea[i] = xscale * std::pow(xvals[i] - mean, 2);
-    }
-    vdt::fast_expv(size, workingArea, workingArea2);
-    double inorm = 1.0/norm;
-    for (uint32_t i = 0; i < size; ++i) {
-        out[i] = inorm*workingArea2[i];
-    }
+    kernels().gaussians(size, mean, sigma, norm, xvals, out, workingArea, workingArea2);
 }
 
 void vectorized::exponentials(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea)
 {
-    //out[i] = std::exp(xvals[i]*lambda) * nfact; nfact = 1.0/norm
-    double lognfact = -std::log(norm);
+    kernels().exponentials(size, lambda, norm, xvals, out, workingArea);
+}
+
+void vectorized::powers(const uint32_t size, double exponent, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea)
+{
+    kernels().powers(size, exponent, norm, xvals, out, workingArea);
+}
+
+void vectorized::gaussian_constraints(const uint32_t size, double const * __restrict__ x, double const * __restrict__ mean, double const * __restrict__ scale, double * __restrict__ out) {
     for (uint32_t i = 0; i < size; ++i) {
-        workingArea[i] = xvals[i] * lambda + lognfact;
+        double arg = x[i] - mean[i];
+        out[i] = scale[i]*arg*arg;
     }
-    vdt::fast_expv(size, workingArea, out);
 }
 
-void vectorized::powers(const uint32_t size, double exponent, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea)
+void vectorized::polynomials(const uint32_t size, uint32_t order, double const * __restrict__ coeffs, const double* __restrict__ xvals, double * __restrict__ out)
 {
-    //out[i] = std::pow(xvals[i],exponent) * nfact; // nfact = 1.0/norm
+    kernels().polynomials(size, order, coeffs, xvals, out);
+}
+
+void vectorized::meld(const uint32_t size, double x, double xy, double const * __restrict__ diff, double const * __restrict__ sum, double * __restrict__ out)
+{
+    kernels().meld(size, x, xy, diff, sum, out);
+}
+
+void vectorized::crystal_balls(const uint32_t size, double mean, double width, double lo, double logA1, double B1, double n1, double hi, double logA2, double B2, double n2, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) {
+    // t goes in out until the final exp
+    for (uint32_t i = 0; i < size; ++i) {
+        double t = (xvals[i] - mean)/width;
+        out[i] = t;
+        workingArea[i] = (t < lo ? B1 - t : (t > hi ? B2 + t : 1.0));
+    }
+    vdt::fast_logv(size, workingArea, workingArea2);
     double lognfact = -std::log(norm);
-    vdt::fast_logv(size, xvals, workingArea);
     for (uint32_t i = 0; i < size; ++i) {
-        workingArea[i] = workingArea[i]*exponent + lognfact;
+        double t = out[i];
+        double tail = (t < lo ? logA1 - n1*workingArea2[i] : logA2 - n2*workingArea2[i]);
+        workingArea[i] = ((t < lo || t > hi) ? tail : -0.5*(t*t)) + lognfact;
     }
     vdt::fast_expv(size, workingArea, out);
 }
+
+void vectorized::log_constraints(const uint32_t size, double const * __restrict__ x, double const * __restrict__ shift, double const * __restrict__ p, double const * __restrict__ q, double const * __restrict__ r, double const * __restrict__ s, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) {
+    for (uint32_t i = 0; i < size; ++i) {
+        workingArea[i] = x[i] - shift[i];
+    }
+    vdt::fast_logv(size, workingArea, workingArea2);
+    for (uint32_t i = 0; i < size; ++i) {
+        double d = workingArea2[i] - s[i];
+        out[i] = (p[i]*workingArea2[i] + q[i]*workingArea[i]) + r[i]*(d*d);
+    }
+}
+
+uint32_t vectorized::count_changed(const uint32_t size, const int32_t * __restrict__ index, double const * __restrict__ values, double const * __restrict__ ref) {
+    // no early exit, so that the loop can be vectorized (the common case is that nothing changed)
+    uint32_t ret = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+        ret += (values[index[i]] != ref[i]);
+    }
+    return ret;
+}
+
+void vectorized::meld_float(const uint32_t size, double x, double xy, float const * __restrict__ diff, float const * __restrict__ sum, double * __restrict__ out) {
+    for (uint32_t i = 0; i < size; ++i) {
+        out[i] += x * double(diff[i]) + xy * double(sum[i]);
+    }
+}
+
+void vectorized::gather(const uint32_t size, const int32_t * __restrict__ index, double const * __restrict__ values, double * __restrict__ out) {
+    for (uint32_t i = 0; i < size; ++i) {
+        out[i] = values[index[i]];
+    }
+}
@@ -1,3 +1,6 @@
+#ifndef HiggsAnalysis_CombinedLimit_vectorized_h
+#define HiggsAnalysis_CombinedLimit_vectorized_h
+
 #include "vdt/vdtMath.h"
 
 namespace vectorized {
@@ -7,13 +10,80 @@ namespace vectorized {
     // nll_reduce = sum ( weights * log(pdfvals/sumCoeff) )
     double nll_reduce(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea) ;
 
+    // same as nll_reduce, but each of the partial sums is compensated (Kahan) so that the result is
+    // accurate also for very large numbers of bins or events; about as fast as nll_reduce
+    double nll_reduce_kahan(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea) ;
+
+    // nll_reduce and nll_reduce_kahan done in steps: each step adds its elements to the 8 partial sums (and
+    // compensations), starting from element 0 of its arrays, so all steps but the last must have a size that
+    // is a multiple of 8 to get the same result as in a single call. Then the partial sums are combined.
+    void   nll_accumulate(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea, double * __restrict__ sums) ;
+    void   nll_accumulate_kahan(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea, double * __restrict__ sums, double * __restrict__ compensations) ;
+    double nll_combine(const double *sums) ;
+    double nll_combine_kahan(const double *sums, const double *compensations) ;
+
     // gaussians
     void gaussians(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) ;
 
     // exponentials
     void exponentials(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea) ;
 
+    // polynomials: out = sum_k coeffs[k] xvals^k, for k = 0 .. order, computed with Horner's rule
+    void polynomials(const uint32_t size, uint32_t order, double const * __restrict__ coeffs, const double* __restrict__ xvals, double * __restrict__ out) ;
+
+    // vertical morphing: out += x * diff + xy * sum
+    void meld(const uint32_t size, double x, double xy, double const * __restrict__ diff, double const * __restrict__ sum, double * __restrict__ out) ;
+
+    // same as meld, with diff and sum in single precision (the computation is in double precision)
+    void meld_float(const uint32_t size, double x, double xy, float const * __restrict__ diff, float const * __restrict__ sum, double * __restrict__ out) ;
+
+    // crystal balls: t = (xvals - mean)/width, out = f(t)/norm with a gaussian core f = exp(-t^2/2) for lo <= t <= hi
+    // and power-law tails f = A1 (B1 - t)^-n1 for t < lo, f = A2 (B2 + t)^-n2 for t > hi. No branches: the tails are
+    // computed as exp(logA - n log(B -+ t)), with a single log and a single exp for each element
+    void crystal_balls(const uint32_t size, double mean, double width, double lo, double logA1, double B1, double n1, double hi, double logA2, double B2, double n2, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) ;
+
+    // log of gaussian constraints: out = scale * (x - mean)^2, computed as in SimpleGaussianConstraint::getLogValFast
+    void gaussian_constraints(const uint32_t size, double const * __restrict__ x, double const * __restrict__ mean, double const * __restrict__ scale, double * __restrict__ out) ;
+
+    // log of other constraint pdfs up to a constant (see FastConstraintTerms):
+    // u = x - shift (in workingArea), out = p log(u) + q u + r (log(u) - s)^2
+    void log_constraints(const uint32_t size, double const * __restrict__ x, double const * __restrict__ shift, double const * __restrict__ p, double const * __restrict__ q, double const * __restrict__ r, double const * __restrict__ s, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) ;
+
+    // number of elements for which values[index[i]] != ref[i]
+    uint32_t count_changed(const uint32_t size, const int32_t * __restrict__ index, double const * __restrict__ values, double const * __restrict__ ref) ;
+
+    // out[i] = values[index[i]]
+    void gather(const uint32_t size, const int32_t * __restrict__ index, double const * __restrict__ values, double * __restrict__ out) ;
+
     // powers
     void powers(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea) ;
+
+    // The kernels above are implemented for several instruction sets, and the best one supported
+    // by the cpu is picked at the first call (it can be limited with --X-rtd VECTORIZED_ISA=N, with
+    // N = 1 for scalar, 2 for SSE4.1, 3 for AVX2, 4 for AVX-512). All implementations do the same
+    // operations in the same order (sums are always done in 8 interleaved partial sums), so they
+    // give the same results to the last bit.
+    struct Kernels {
+        const char *name;
+        void     (*mul_add)(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray);
+        void     (*nll_accumulate)(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea, double * __restrict__ sums);
+        void     (*nll_accumulate_kahan)(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea, double * __restrict__ sums, double * __restrict__ compensations);
+        void     (*gaussians)(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2);
+        void     (*exponentials)(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea);
+        void     (*powers)(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea);
+        void     (*polynomials)(const uint32_t size, uint32_t order, double const * __restrict__ coeffs, const double* __restrict__ xvals, double * __restrict__ out);
+        void     (*meld)(const uint32_t size, double x, double xy, double const * __restrict__ diff, double const * __restrict__ sum, double * __restrict__ out);
+    };
+    enum Isa { ScalarIsa = 1, SSE4Isa = 2, AVX2Isa = 3, AVX512Isa = 4 };
+    // the kernels in use
+    const Kernels & kernels() ;
+    // the kernels for a given instruction set, or null if not supported by this cpu or compiler
+    const Kernels * kernels(Isa isa) ;
+
+    namespace scalar { const Kernels * kernels(); }
+    namespace sse4   { const Kernels * kernels(); }
+    namespace avx2   { const Kernels * kernels(); }
+    namespace avx512 { const Kernels * kernels(); }
 }
 
+#endif
@@ -0,0 +1,60 @@
+// AVX2 implementation of the kernels of vectorized.h (see vectorized_simd.h)
+#include "vectorized.h"
+#include <stdint.h>
+#include <limits>
+
+#if defined(__x86_64__) && defined(__GNUC__) && ((__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || __GNUC__ > 4)
+// no "fma": the compiler must not fuse multiplications and additions, to get the same results as the scalar code
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+namespace vectorized { namespace avx2 {
+    struct V {
+        typedef __m256d D;
+        typedef __m256d M;
+        enum { width = 4 };
+        static D load(const double *p) { return _mm256_load_pd(p); }
+        static D loadu(const double *p) { return _mm256_loadu_pd(p); }
+        static void store(double *p, D v) { _mm256_store_pd(p, v); }
+        static void storeu(double *p, D v) { _mm256_storeu_pd(p, v); }
+        static D set1(double x) { return _mm256_set1_pd(x); }
+        static D zero() { return _mm256_setzero_pd(); }
+        static D add(D a, D b) { return _mm256_add_pd(a, b); }
+        static D sub(D a, D b) { return _mm256_sub_pd(a, b); }
+        static D mul(D a, D b) { return _mm256_mul_pd(a, b); }
+        static D div(D a, D b) { return _mm256_div_pd(a, b); }
+        static M gt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+        static M lt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+        // mask ? a : b
+        static D select(M mask, D a, D b) { return _mm256_blendv_pd(b, a, mask); }
+        // as vdt: truncate, and subtract one if the sign bit is set
+        static D fpfloor(D x) { return _mm256_sub_pd(_mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), _mm256_blendv_pd(zero(), set1(1.0), x)); }
+        // 2^n for integer n in [-1022, 1023]
+        static D pow2n(D n) {
+            __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n, set1(6755399441055744.0)));
+            return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52));
+        }
+        // the biased exponent (and sign bit), as a double
+        static D exponent(D x) {
+            __m256i e = _mm256_or_si256(_mm256_srli_epi64(_mm256_castpd_si256(x), 52), _mm256_castpd_si256(set1(4503599627370496.0)));
+            return _mm256_sub_pd(_mm256_castsi256_pd(e), set1(4503599627370496.0));
+        }
+        // the mantissa, with the exponent of 0.5
+        static D mantissa(D x) {
+            __m256i n = _mm256_and_si256(_mm256_castpd_si256(x), _mm256_set1_epi64x(0x800FFFFFFFFFFFFFLL));
+            return _mm256_castsi256_pd(_mm256_or_si256(n, _mm256_set1_epi64x(0x3FE0000000000000LL)));
+        }
+    };
+
+#include "vectorized_simd.h"
+
+    const Kernels * kernels() {
+        if (!__builtin_cpu_supports("avx2")) return 0;
+        static const Kernels k = { "avx2", &simd::mul_add_any, &simd::nll_accumulate_any, &simd::nll_accumulate_kahan_any, &simd::gaussians_any, &simd::exponentials_any, &simd::powers_any, &simd::polynomials_any, &simd::meld_any };
+        return &k;
+    }
+} }
+
+#else
+const vectorized::Kernels * vectorized::avx2::kernels() { return 0; }
+#endif
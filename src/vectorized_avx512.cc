@@ -0,0 +1,66 @@
+// AVX-512 implementation of the kernels of vectorized.h (see vectorized_simd.h)
+#include "vectorized.h"
+#include <stdint.h>
+#include <limits>
+
+#if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 5
+#pragma GCC target("avx512f")
+// avx512f implies fma: the compiler must not fuse multiplications and additions, to get the same results as the scalar code
+#pragma GCC optimize("fp-contract=off")
+// the avx512 intrinsics of some gcc versions give spurious warnings about their undefined pass-through operands
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+
+namespace vectorized { namespace avx512 {
+    struct V {
+        typedef __m512d D;
+        typedef __mmask8 M;
+        enum { width = 8 };
+        static D load(const double *p) { return _mm512_load_pd(p); }
+        static D loadu(const double *p) { return _mm512_loadu_pd(p); }
+        static void store(double *p, D v) { _mm512_store_pd(p, v); }
+        static void storeu(double *p, D v) { _mm512_storeu_pd(p, v); }
+        static D set1(double x) { return _mm512_set1_pd(x); }
+        static D zero() { return _mm512_setzero_pd(); }
+        static D add(D a, D b) { return _mm512_add_pd(a, b); }
+        static D sub(D a, D b) { return _mm512_sub_pd(a, b); }
+        static D mul(D a, D b) { return _mm512_mul_pd(a, b); }
+        static D div(D a, D b) { return _mm512_div_pd(a, b); }
+        static M gt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+        static M lt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+        // mask ? a : b
+        static D select(M mask, D a, D b) { return _mm512_mask_blend_pd(mask, b, a); }
+        // as vdt: truncate, and subtract one if the sign bit is set
+        static D fpfloor(D x) { 
+            M negative = _mm512_test_epi64_mask(_mm512_castpd_si512(x), _mm512_set1_epi64(0x8000000000000000LL));
+            return _mm512_sub_pd(_mm512_roundscale_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), _mm512_maskz_mov_pd(negative, set1(1.0))); 
+        }
+        // 2^n for integer n in [-1022, 1023]
+        static D pow2n(D n) {
+            __m512i bits = _mm512_castpd_si512(_mm512_add_pd(n, set1(6755399441055744.0)));
+            return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_add_epi64(bits, _mm512_set1_epi64(1023)), 52));
+        }
+        // the biased exponent (and sign bit), as a double
+        static D exponent(D x) {
+            __m512i e = _mm512_or_si512(_mm512_srli_epi64(_mm512_castpd_si512(x), 52), _mm512_castpd_si512(set1(4503599627370496.0)));
+            return _mm512_sub_pd(_mm512_castsi512_pd(e), set1(4503599627370496.0));
+        }
+        // the mantissa, with the exponent of 0.5
+        static D mantissa(D x) {
+            __m512i n = _mm512_and_si512(_mm512_castpd_si512(x), _mm512_set1_epi64(0x800FFFFFFFFFFFFFLL));
+            return _mm512_castsi512_pd(_mm512_or_si512(n, _mm512_set1_epi64(0x3FE0000000000000LL)));
+        }
+    };
+
+#include "vectorized_simd.h"
+
+    const Kernels * kernels() {
+        if (!__builtin_cpu_supports("avx512f")) return 0;
+        static const Kernels k = { "avx512f", &simd::mul_add_any, &simd::nll_accumulate_any, &simd::nll_accumulate_kahan_any, &simd::gaussians_any, &simd::exponentials_any, &simd::powers_any, &simd::polynomials_any, &simd::meld_any };
+        return &k;
+    }
+} }
+
+#else
+const vectorized::Kernels * vectorized::avx512::kernels() { return 0; }
+#endif
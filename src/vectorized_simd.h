@@ -0,0 +1,262 @@
+// SIMD implementation of the kernels of vectorized.h, written once for all instruction sets.
+// To be included by vectorized_<isa>.cc inside namespace vectorized::<isa>, after defining a struct V
+// with the vector type D, the mask type M and the operations on them for that instruction set.
+//
+// The algorithms and the order of the operations are the same as in the scalar reference
+// implementation in vectorized.cc (and in vdt for exp and log), so that the results are the same.
+
+namespace simd {
+
+    template<bool Aligned> inline V::D load(const double *p) { return Aligned ? V::load(p) : V::loadu(p); }
+    template<bool Aligned> inline void store(double *p, V::D v) { if (Aligned) V::store(p, v); else V::storeu(p, v); }
+
+    inline bool aligned(const void *p) { return (reinterpret_cast<uintptr_t>(p) % (V::width*sizeof(double))) == 0; }
+
+    // same as vdt::fast_exp
+    inline V::D exp(V::D initial_x) {
+        V::D x = initial_x;
+        V::D px = V::fpfloor(V::add(V::mul(V::set1(1.4426950408889634073599), x), V::set1(0.5)));
+        V::D pow2n = V::pow2n(px);
+        x = V::sub(x, V::mul(px, V::set1(6.93145751953125E-1)));
+        x = V::sub(x, V::mul(px, V::set1(1.42860682030941723212E-6)));
+        V::D xx = V::mul(x, x);
+        px = V::set1(1.26177193074810590878E-4);
+        px = V::add(V::mul(px, xx), V::set1(3.02994407707441961300E-2));
+        px = V::add(V::mul(px, xx), V::set1(9.99999999999999999910E-1));
+        px = V::mul(px, x);
+        V::D qx = V::set1(3.00198505138664455042E-6);
+        qx = V::add(V::mul(qx, xx), V::set1(2.52448340349684104192E-3));
+        qx = V::add(V::mul(qx, xx), V::set1(2.27265548208155028766E-1));
+        qx = V::add(V::mul(qx, xx), V::set1(2.00000000000000000009E0));
+        x = V::div(px, V::sub(qx, px));
+        x = V::add(V::set1(1.0), V::mul(V::set1(2.0), x));
+        x = V::mul(x, pow2n);
+        x = V::select(V::gt(initial_x, V::set1(708.)), V::set1(std::numeric_limits<double>::infinity()), x);
+        x = V::select(V::lt(initial_x, V::set1(-708.)), V::zero(), x);
+        return x;
+    }
+
+    // same as vdt::fast_log
+    inline V::D log(V::D original_x) {
+        V::D fe = V::sub(V::exponent(original_x), V::set1(1023.));
+        V::D x = V::mantissa(original_x);
+        V::M big = V::gt(x, V::set1(0.70710678118654752440));
+        fe = V::select(big, V::add(fe, V::set1(1.0)), fe);
+        x = V::select(big, x, V::add(x, x));
+        x = V::sub(x, V::set1(1.0));
+        V::D px = V::set1(1.01875663804580931796E-4);
+        px = V::add(V::mul(px, x), V::set1(4.97494994976747001425E-1));
+        px = V::add(V::mul(px, x), V::set1(4.70579119878881725854E0));
+        px = V::add(V::mul(px, x), V::set1(1.44989225341610930846E1));
+        px = V::add(V::mul(px, x), V::set1(1.79368678507819816313E1));
+        px = V::add(V::mul(px, x), V::set1(7.70838733755885391666E0));
+        V::D x2 = V::mul(x, x);
+        px = V::mul(px, x);
+        px = V::mul(px, x2);
+        V::D qx = V::add(x, V::set1(1.12873587189167450590E1));
+        qx = V::add(V::mul(qx, x), V::set1(4.52279145837532221105E1));
+        qx = V::add(V::mul(qx, x), V::set1(8.29875266912776603211E1));
+        qx = V::add(V::mul(qx, x), V::set1(7.11544750618563894466E1));
+        qx = V::add(V::mul(qx, x), V::set1(2.31251620126765340583E1));
+        V::D res = V::div(px, qx);
+        res = V::sub(res, V::mul(fe, V::set1(2.121944400546905827679e-4)));
+        res = V::sub(res, V::mul(V::set1(0.5), x2));
+        res = V::add(x, res);
+        res = V::add(res, V::mul(fe, V::set1(0.693359375)));
+        res = V::select(V::gt(original_x, V::set1(1e307)), V::set1(std::numeric_limits<double>::infinity()), res);
+        res = V::select(V::lt(original_x, V::zero()), V::set1(-std::numeric_limits<double>::quiet_NaN()), res);
+        return res;
+    }
+
+    template<bool Aligned>
+    void mul_add(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        V::D vcoeff = V::set1(coeff);
+        uint32_t i = 0, nv = size - size % V::width;
+        for ( ; i < nv; i += V::width) {
+            store<Aligned>(oarray+i, V::add(load<Aligned>(oarray+i), V::mul(vcoeff, load<Aligned>(iarray+i))));
+        }
+        for ( ; i < size; ++i) {
+            oarray[i] += coeff * iarray[i];
+        }
+    }
+
+    // the 8 interleaved partial sums of the scalar reference are kept in NAcc vectors
+    enum { NSums = 8, NAcc = NSums / V::width };
+
+    template<bool Aligned>
+    void nll_accumulate(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double * __restrict__ workingArea, double * __restrict__ sums) {
+        double invsum = 1.0/sumcoeff;
+        V::D vinvsum = V::set1(invsum);
+        V::D acc[NAcc];
+        for (int k = 0; k < NAcc; ++k) acc[k] = V::loadu(sums + k*V::width);
+        uint32_t i = 0, nb = size - size % NSums;
+        for ( ; i < nb; i += NSums) {
+            for (int k = 0; k < NAcc; ++k) {
+                uint32_t j = i + k*V::width;
+                V::D logp = log(V::mul(load<Aligned>(pdfvals+j), vinvsum));
+                store<Aligned>(workingArea+j, logp);
+                V::D term = V::mul(load<Aligned>(weights+j), logp);
+                store<Aligned>(pdfvals+j, term);
+                acc[k] = V::add(acc[k], term);
+            }
+        }
+        for (int k = 0; k < NAcc; ++k) V::storeu(sums + k*V::width, acc[k]);
+        for (uint32_t j = i; j < size; ++j) {
+            workingArea[j] = vdt::fast_log(pdfvals[j] * invsum);
+            pdfvals[j] = weights[j] * workingArea[j];
+            sums[j-i] += pdfvals[j];
+        }
+    }
+
+    template<bool Aligned>
+    void nll_accumulate_kahan(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double * __restrict__ workingArea, double * __restrict__ sums, double * __restrict__ compensations) {
+        double invsum = 1.0/sumcoeff;
+        V::D vinvsum = V::set1(invsum);
+        V::D acc[NAcc], comp[NAcc];
+        for (int k = 0; k < NAcc; ++k) { 
+            acc[k] = V::loadu(sums + k*V::width); 
+            comp[k] = V::loadu(compensations + k*V::width); 
+        }
+        uint32_t i = 0, nb = size - size % NSums;
+        for ( ; i < nb; i += NSums) {
+            for (int k = 0; k < NAcc; ++k) {
+                uint32_t j = i + k*V::width;
+                V::D logp = log(V::mul(load<Aligned>(pdfvals+j), vinvsum));
+                store<Aligned>(workingArea+j, logp);
+                V::D term = V::mul(load<Aligned>(weights+j), logp);
+                store<Aligned>(pdfvals+j, term);
+                V::D y = V::sub(term, comp[k]);
+                V::D t = V::add(acc[k], y);
+                comp[k] = V::sub(V::sub(t, acc[k]), y);
+                acc[k] = t;
+            }
+        }
+        for (int k = 0; k < NAcc; ++k) { 
+            V::storeu(sums + k*V::width, acc[k]); 
+            V::storeu(compensations + k*V::width, comp[k]); 
+        }
+        for (uint32_t j = i; j < size; ++j) {
+            workingArea[j] = vdt::fast_log(pdfvals[j] * invsum);
+            pdfvals[j] = weights[j] * workingArea[j];
+            double y = pdfvals[j] - compensations[j-i];
+            double t = sums[j-i] + y;
+            compensations[j-i] = (t - sums[j-i]) - y;
+            sums[j-i] = t;
+        }
+    }
+
+    template<bool Aligned>
+    void gaussians(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) {
+        double xscale = -0.5/(sigma*sigma), inorm = 1.0/norm;
+        V::D vmean = V::set1(mean), vxscale = V::set1(xscale), vinorm = V::set1(inorm);
+        uint32_t i = 0, nv = size - size % V::width;
+        for ( ; i < nv; i += V::width) {
+            V::D dx = V::sub(load<Aligned>(xvals+i), vmean);
+            V::D arg = V::mul(vxscale, V::mul(dx, dx));
+            V::D e = exp(arg);
+            store<Aligned>(workingArea+i, arg);
+            store<Aligned>(workingArea2+i, e);
+            store<Aligned>(out+i, V::mul(vinorm, e));
+        }
+        for ( ; i < size; ++i) {
+            double dx = xvals[i] - mean;
+            workingArea[i] = xscale * (dx * dx);
+            workingArea2[i] = vdt::fast_exp(workingArea[i]);
+            out[i] = inorm*workingArea2[i];
+        }
+    }
+
+    template<bool Aligned>
+    void exponentials(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea) {
+        double lognfact = -std::log(norm);
+        V::D vlambda = V::set1(lambda), vlognfact = V::set1(lognfact);
+        uint32_t i = 0, nv = size - size % V::width;
+        for ( ; i < nv; i += V::width) {
+            V::D arg = V::add(V::mul(load<Aligned>(xvals+i), vlambda), vlognfact);
+            store<Aligned>(workingArea+i, arg);
+            store<Aligned>(out+i, exp(arg));
+        }
+        for ( ; i < size; ++i) {
+            workingArea[i] = xvals[i] * lambda + lognfact;
+            out[i] = vdt::fast_exp(workingArea[i]);
+        }
+    }
+
+    template<bool Aligned>
+    void powers(const uint32_t size, double exponent, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea) {
+        double lognfact = -std::log(norm);
+        V::D vexponent = V::set1(exponent), vlognfact = V::set1(lognfact);
+        uint32_t i = 0, nv = size - size % V::width;
+        for ( ; i < nv; i += V::width) {
+            V::D arg = V::add(V::mul(log(load<Aligned>(xvals+i)), vexponent), vlognfact);
+            store<Aligned>(workingArea+i, arg);
+            store<Aligned>(out+i, exp(arg));
+        }
+        for ( ; i < size; ++i) {
+            workingArea[i] = vdt::fast_log(xvals[i])*exponent + lognfact;
+            out[i] = vdt::fast_exp(workingArea[i]);
+        }
+    }
+
+    template<bool Aligned>
+    void polynomials(const uint32_t size, uint32_t order, double const * __restrict__ coeffs, const double* __restrict__ xvals, double * __restrict__ out) {
+        uint32_t i = 0, nv = size - size % V::width;
+        for ( ; i < nv; i += V::width) {
+            V::D x = load<Aligned>(xvals+i), p = V::set1(coeffs[order]);
+            for (uint32_t k = order; k > 0; --k) p = V::add(V::mul(p, x), V::set1(coeffs[k-1]));
+            store<Aligned>(out+i, p);
+        }
+        for ( ; i < size; ++i) {
+            double p = coeffs[order];
+            for (uint32_t k = order; k > 0; --k) p = p * xvals[i] + coeffs[k-1];
+            out[i] = p;
+        }
+    }
+
+    template<bool Aligned>
+    void meld(const uint32_t size, double x, double xy, double const * __restrict__ diff, double const * __restrict__ sum, double * __restrict__ out) {
+        V::D vx = V::set1(x), vxy = V::set1(xy);
+        uint32_t i = 0, nv = size - size % V::width;
+        for ( ; i < nv; i += V::width) {
+            V::D d = V::add(V::mul(vx, load<Aligned>(diff+i)), V::mul(vxy, load<Aligned>(sum+i)));
+            store<Aligned>(out+i, V::add(load<Aligned>(out+i), d));
+        }
+        for ( ; i < size; ++i) {
+            out[i] += x * diff[i] + xy * sum[i];
+        }
+    }
+
+    // dispatch to the aligned versions when all the buffers are aligned to the vector size
+    void mul_add_any(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        if (aligned(iarray) && aligned(oarray)) mul_add<true>(size, coeff, iarray, oarray);
+        else mul_add<false>(size, coeff, iarray, oarray);
+    }
+    void nll_accumulate_any(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double * __restrict__ workingArea, double * __restrict__ sums) {
+        if (aligned(pdfvals) && aligned(weights) && aligned(workingArea)) nll_accumulate<true>(size, pdfvals, weights, sumcoeff, workingArea, sums);
+        else nll_accumulate<false>(size, pdfvals, weights, sumcoeff, workingArea, sums);
+    }
+    void nll_accumulate_kahan_any(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double * __restrict__ workingArea, double * __restrict__ sums, double * __restrict__ compensations) {
+        if (aligned(pdfvals) && aligned(weights) && aligned(workingArea)) nll_accumulate_kahan<true>(size, pdfvals, weights, sumcoeff, workingArea, sums, compensations);
+        else nll_accumulate_kahan<false>(size, pdfvals, weights, sumcoeff, workingArea, sums, compensations);
+    }
+    void gaussians_any(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2) {
+        if (aligned(xvals) && aligned(out) && aligned(workingArea) && aligned(workingArea2)) gaussians<true>(size, mean, sigma, norm, xvals, out, workingArea, workingArea2);
+        else gaussians<false>(size, mean, sigma, norm, xvals, out, workingArea, workingArea2);
+    }
+    void exponentials_any(const uint32_t size, double lambda, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea) {
+        if (aligned(xvals) && aligned(out) && aligned(workingArea)) exponentials<true>(size, lambda, norm, xvals, out, workingArea);
+        else exponentials<false>(size, lambda, norm, xvals, out, workingArea);
+    }
+    void powers_any(const uint32_t size, double exponent, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea) {
+        if (aligned(xvals) && aligned(out) && aligned(workingArea)) powers<true>(size, exponent, norm, xvals, out, workingArea);
+        else powers<false>(size, exponent, norm, xvals, out, workingArea);
+    }
+    void polynomials_any(const uint32_t size, uint32_t order, double const * __restrict__ coeffs, const double* __restrict__ xvals, double * __restrict__ out) {
+        if (aligned(xvals) && aligned(out)) polynomials<true>(size, order, coeffs, xvals, out);
+        else polynomials<false>(size, order, coeffs, xvals, out);
+    }
+    void meld_any(const uint32_t size, double x, double xy, double const * __restrict__ diff, double const * __restrict__ sum, double * __restrict__ out) {
+        if (aligned(diff) && aligned(sum) && aligned(out)) meld<true>(size, x, xy, diff, sum, out);
+        else meld<false>(size, x, xy, diff, sum, out);
+    }
+}
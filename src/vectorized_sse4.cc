@@ -0,0 +1,59 @@
+// SSE4.1 implementation of the kernels of vectorized.h (see vectorized_simd.h)
+#include "vectorized.h"
+#include <stdint.h>
+#include <limits>
+
+#if defined(__x86_64__) && defined(__GNUC__) && ((__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || __GNUC__ > 4)
+#pragma GCC target("sse4.1")
+#include <smmintrin.h>
+
+namespace vectorized { namespace sse4 {
+    struct V {
+        typedef __m128d D;
+        typedef __m128d M;
+        enum { width = 2 };
+        static D load(const double *p) { return _mm_load_pd(p); }
+        static D loadu(const double *p) { return _mm_loadu_pd(p); }
+        static void store(double *p, D v) { _mm_store_pd(p, v); }
+        static void storeu(double *p, D v) { _mm_storeu_pd(p, v); }
+        static D set1(double x) { return _mm_set1_pd(x); }
+        static D zero() { return _mm_setzero_pd(); }
+        static D add(D a, D b) { return _mm_add_pd(a, b); }
+        static D sub(D a, D b) { return _mm_sub_pd(a, b); }
+        static D mul(D a, D b) { return _mm_mul_pd(a, b); }
+        static D div(D a, D b) { return _mm_div_pd(a, b); }
+        static M gt(D a, D b) { return _mm_cmpgt_pd(a, b); }
+        static M lt(D a, D b) { return _mm_cmplt_pd(a, b); }
+        // mask ? a : b
+        static D select(M mask, D a, D b) { return _mm_blendv_pd(b, a, mask); }
+        // as vdt: truncate, and subtract one if the sign bit is set
+        static D fpfloor(D x) { return _mm_sub_pd(_mm_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), _mm_blendv_pd(zero(), set1(1.0), x)); }
+        // 2^n for integer n in [-1022, 1023]
+        static D pow2n(D n) {
+            __m128i bits = _mm_castpd_si128(_mm_add_pd(n, set1(6755399441055744.0)));
+            return _mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(bits, _mm_set1_epi64x(1023)), 52));
+        }
+        // the biased exponent (and sign bit), as a double
+        static D exponent(D x) {
+            __m128i e = _mm_or_si128(_mm_srli_epi64(_mm_castpd_si128(x), 52), _mm_castpd_si128(set1(4503599627370496.0)));
+            return _mm_sub_pd(_mm_castsi128_pd(e), set1(4503599627370496.0));
+        }
+        // the mantissa, with the exponent of 0.5
+        static D mantissa(D x) {
+            __m128i n = _mm_and_si128(_mm_castpd_si128(x), _mm_set1_epi64x(0x800FFFFFFFFFFFFFLL));
+            return _mm_castsi128_pd(_mm_or_si128(n, _mm_set1_epi64x(0x3FE0000000000000LL)));
+        }
+    };
+
+#include "vectorized_simd.h"
+
+    const Kernels * kernels() {
+        if (!__builtin_cpu_supports("sse4.1")) return 0;
+        static const Kernels k = { "sse4.1", &simd::mul_add_any, &simd::nll_accumulate_any, &simd::nll_accumulate_kahan_any, &simd::gaussians_any, &simd::exponentials_any, &simd::powers_any, &simd::polynomials_any, &simd::meld_any };
+        return &k;
+    }
+} }
+
+#else
+const vectorized::Kernels * vectorized::sse4::kernels() { return 0; }
+#endif
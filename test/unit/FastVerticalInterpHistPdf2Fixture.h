@@ -0,0 +1,58 @@
+#ifndef FastVerticalInterpHistPdf2Fixture_h
+#define FastVerticalInterpHistPdf2Fixture_h
+
+#include <memory>
+#include <TFile.h>
+#include <TH1F.h>
+#include <TList.h>
+#include <TRandom3.h>
+#include <RooRealVar.h>
+#include <RooArgList.h>
+#include <RooWorkspace.h>
+
+// Inputs for the tests of FastVerticalInterpHistPdf2: a nominal histogram of nbins bins in x, with random contents,
+// and the hi and lo histograms of nmorphs morphing parameters theta0, theta1, ... The even morphs change all the
+// bins, the odd ones only a random fraction sparseFraction of them, so that they are sparse.
+// The histograms (in templates) and the parameters (in coefs) are owned by the fixture; rnd is left for the test.
+struct FastVerticalInterpHistPdf2Fixture {
+    FastVerticalInterpHistPdf2Fixture(int nbins, int nmorphs, double sparseFraction) :
+        x("x", "", 0.5, 0, 10), rnd(37)
+    {
+        TH1F *nominal = new TH1F("nominal", "", nbins, 0, 10);
+        nominal->SetDirectory(0);
+        for (int i = 1; i <= nbins; ++i) nominal->SetBinContent(i, rnd.Uniform(1, 3));
+        templates.SetOwner();
+        templates.Add(nominal);
+        for (int k = 0; k < nmorphs; ++k) {
+            TH1F *hi = (TH1F *) nominal->Clone(Form("hi%d", k)), *lo = (TH1F *) nominal->Clone(Form("lo%d", k));
+            hi->SetDirectory(0); lo->SetDirectory(0);
+            for (int i = 1; i <= nbins; ++i) {
+                if (k % 2 && rnd.Uniform() > sparseFraction) continue;
+                hi->SetBinContent(i, nominal->GetBinContent(i) * rnd.Uniform(0.9, 1.2));
+                lo->SetBinContent(i, nominal->GetBinContent(i) * rnd.Uniform(0.8, 1.1));
+            }
+            templates.Add(hi); templates.Add(lo);
+            coefs.addOwned(*new RooRealVar(Form("theta%d", k), "", 0, -5, 5));
+        }
+    }
+
+    RooRealVar & theta(int k) { return static_cast<RooRealVar &>(coefs[k]); }
+
+    RooRealVar x;
+    TRandom3 rnd;
+    TList templates;
+    RooArgList coefs;
+};
+
+// Write w to fileName, and read it back
+inline std::unique_ptr<RooWorkspace> writeAndReadWorkspace(const RooWorkspace &w, const char *fileName) {
+    std::unique_ptr<TFile> file(TFile::Open(fileName, "RECREATE"));
+    file->WriteTObject(&w, "w");
+    file->Close();
+    file.reset(TFile::Open(fileName));
+    std::unique_ptr<RooWorkspace> ret((RooWorkspace *) file->Get("w"));
+    file->Close();
+    return ret;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include <RooPoisson.h>
+#include <RooGamma.h>
+#include <RooLognormal.h>
+#include <RooRandom.h>
+#include "HiggsAnalysis/CombinedLimit/interface/SimpleGaussianConstraint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FastConstraintTerms.h"
+
+// Check of FastConstraintTerms against log(pdf->getVal(nuis)) for the supported kinds of constraints,
+// moving the nuisances and, from time to time, the global observables (which makes it recompute the constants).
+// Usage: testFastConstraintTerms.exe [points]
+
+int main(int argc, char **argv) {
+    int npoints = argc > 1 ? atoi(argv[1]) : 200;
+    // gaussian (lnN)
+    RooRealVar theta("theta", "", 0, -7, 7), thetaIn("theta_In", "", 0, -7, 7), one("one", "", 1);
+    SimpleGaussianConstraint gauss("theta_Pdf", "", theta, thetaIn, one);
+    // poisson (gmN)
+    RooRealVar n("n", "", 11, 0.5, 60), nIn("n_In", "", 10, 0, 60);
+    RooPoisson poisson("n_Pdf", "", nIn, n, true);
+    // gamma (gmM)
+    RooRealVar g("g", "", 1, 0.2, 3), gIn("g_In", "", 25, 1, 60), gScale("g_scaling", "", 0.04), zero("zero", "", 0);
+    RooGamma gamma("g_Pdf", "", g, gIn, gScale, zero);
+    // lognormal
+    RooRealVar l("l", "", 1, 0.1, 10), lIn("l_In", "", 1, 0.1, 10), kappa("kappa", "", 1.3);
+    RooLognormal lognormal("l_Pdf", "", l, lIn, kappa);
+    thetaIn.setConstant(true); nIn.setConstant(true); gIn.setConstant(true); lIn.setConstant(true);
+
+    RooArgSet nuis(theta, n, g, l);
+    std::vector<RooAbsPdf *> pdfs; pdfs.push_back(&poisson); pdfs.push_back(&gamma); pdfs.push_back(&lognormal);
+    FastConstraintTerms terms;
+    for (int i = 0; i < 3; ++i) {
+        if (!terms.add(*pdfs[i], &nuis, i)) { printf("%s not supported  FAIL\n", pdfs[i]->GetName()); return 1; }
+    }
+    terms.addGaussian(gauss, 3);
+
+    std::vector<double> out(4);
+    std::vector<int> failed;
+    double worst[4] = { 0, 0, 0, 0 };
+    int bad = 0;
+    for (int k = 0; k < npoints; ++k) {
+        if (k % 50 == 0) {
+            nIn.setVal(RooRandom::randomGenerator()->Poisson(10));
+            gIn.setVal(RooRandom::randomGenerator()->Uniform(10, 40));
+            lIn.setVal(RooRandom::randomGenerator()->Uniform(0.8, 1.2));
+            thetaIn.setVal(RooRandom::randomGenerator()->Gaus());
+        }
+        theta.setVal(RooRandom::randomGenerator()->Uniform(-3, 3));
+        n.setVal(RooRandom::randomGenerator()->Uniform(2, 30));
+        g.setVal(RooRandom::randomGenerator()->Uniform(0.5, 2));
+        l.setVal(RooRandom::randomGenerator()->Uniform(0.5, 2));
+        terms.eval(&out[0], failed);
+        if (!failed.empty()) { printf("point %d: %d terms failed  FAIL\n", k, int(failed.size())); bad++; continue; }
+        for (int i = 0; i < 3; ++i) {
+            double ref = std::log(pdfs[i]->getVal(&nuis));
+            worst[i] = std::max(worst[i], std::abs(out[i] - ref)/std::max(1.0, std::abs(ref)));
+        }
+        if (out[3] != gauss.getLogValFast()) { printf("point %d: gaussian %.17g vs %.17g  FAIL\n", k, out[3], gauss.getLogValFast()); bad++; }
+    }
+    const char *names[3] = { "poisson", "gamma", "lognormal" };
+    for (int i = 0; i < 3; ++i) {
+        bool good = worst[i] < 1e-9;
+        printf("%-10s max relative difference %g %s\n", names[i], worst[i], good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+    // out of the domain: must be left to the caller
+    n.setRange(-5, 60); n.setVal(-1);
+    terms.eval(&out[0], failed);
+    if (failed.size() != 1 || failed[0] != 0) { printf("negative mean of the poisson not reported  FAIL\n"); bad++; }
+    return bad ? 2 : 0;
+}
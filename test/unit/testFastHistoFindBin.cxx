@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TRandom3.h>
+#include <TStopwatch.h>
+#include "HiggsAnalysis/CombinedLimit/interface/FastTemplate.h"
+
+// Check of FastHisto::FindBin/FindBins/GetAt and FastHisto2D::FindBin/GetAt against a binary search on the
+// bin edges, with uniform and variable binning, on random points and on the edges themselves.
+// Usage: testFastHistoFindBin.exe [points]
+
+int reference(const std::vector<double> &edges, double x) {
+    std::vector<double>::const_iterator match = std::lower_bound(edges.begin(), edges.end(), x);
+    if (match == edges.begin()) return -1;
+    if (match == edges.end()) return edges.size() - 1;
+    return match - edges.begin() - 1;
+}
+
+int main(int argc, char **argv) {
+    int npoints = argc > 1 ? atoi(argv[1]) : 100000;
+    TRandom3 rnd(42);
+    int bad = 0;
+    for (int variable = 0; variable <= 1; ++variable) {
+        std::vector<double> edges(1, 0.3);
+        for (int i = 0; i < 80; ++i) edges.push_back(variable ? edges.back() + rnd.Uniform(0.01, 1) : 0.3 + 0.25*(i+1));
+        TH1D h1("h1", "", edges.size()-1, &edges[0]);
+        TH2D h2("h2", "", edges.size()-1, &edges[0], edges.size()-1, &edges[0]);
+        for (int i = 1; i < int(edges.size()); ++i) {
+            h1.SetBinContent(i, i);
+            for (int j = 1; j < int(edges.size()); ++j) h2.SetBinContent(i, j, 100*i + j);
+        }
+        FastHisto f1(h1); FastHisto2D f2(h2);
+
+        std::vector<double> xs(edges), ys;
+        for (unsigned int i = 0, n = edges.size(); i < n; ++i) {
+            xs.push_back(std::nextafter(edges[i], -1e9)); xs.push_back(std::nextafter(edges[i], 1e9));
+        }
+        for (int i = 0; i < npoints; ++i) xs.push_back(rnd.Uniform(edges.front() - 1, edges.back() + 1));
+        for (unsigned int i = 0, n = xs.size(); i < n; ++i) ys.push_back(xs[rnd.Integer(n)]);
+        std::vector<int> bins(xs.size()), bins2(xs.size());
+        f1.FindBins(&xs[0], &bins[0], xs.size());
+        f2.FindBins(&xs[0], &ys[0], &bins2[0], xs.size());
+        int nbins = edges.size() - 1, fails = 0;
+        for (unsigned int i = 0, n = xs.size(); i < n; ++i) {
+            int ix = reference(edges, xs[i]), iy = reference(edges, ys[i]);
+            bool inside = (ix >= 0 && ix < nbins), inside2 = inside && (iy >= 0 && iy < nbins);
+            int ref2 = (inside2 ? ix * nbins + iy : -1);
+            if (f1.FindBin(xs[i]) != ix || bins[i] != ix || f1.GetAt(xs[i]) != (inside ? ix+1 : 0)) fails++;
+            if (f2.FindBin(xs[i], ys[i]) != ref2 || bins2[i] != ref2 || f2.GetAt(xs[i], ys[i]) != (inside2 ? 100*(ix+1) + iy+1 : 0)) fails++;
+        }
+        TStopwatch timer; timer.Start();
+        f1.FindBins(&xs[0], &bins[0], xs.size());
+        double time = timer.RealTime();
+        printf("%-8s binning: %d failures, %.3f s for %u points %s\n", variable ? "variable" : "uniform", fails, time, unsigned(xs.size()), fails ? "  FAIL" : "");
+        if (fails) bad++;
+    }
+    return bad ? 2 : 0;
+}
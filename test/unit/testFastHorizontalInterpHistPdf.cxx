@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <TH1F.h>
+#include <TList.h>
+#include <TRandom3.h>
+#include <TStopwatch.h>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include <RooDataSet.h>
+#include <RooDataHist.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HorizontalInterpHistPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/th1fmorph.h"
+
+// Check of FastHorizontalInterpHistPdf: at the mass points it must give back the (normalized) templates,
+// the cached values (through FastHorizontalInterpHistPdfV) must be the same as pdf->getVal(x), and between
+// and beyond the mass points it must give the same bin contents as th1fmorph, for smooth templates, templates
+// with empty regions, and empty ones. Then the time for a scan of the mass is compared with th1fmorph.
+// Usage: testFastHorizontalInterpHistPdf.exe [scan points]
+
+double worstDifference(const FastHorizontalInterpHistPdf &pdf, RooRealVar &x, const RooAbsData &data, RooRealVar &mh, int npoints) {
+    RooArgSet obs(x);
+    std::auto_ptr<cacheutils::CachingPdfBase> cpdf(cacheutils::makeCachingPdf(const_cast<FastHorizontalInterpHistPdf *>(&pdf), &obs));
+    double worst = 0;
+    for (int k = 0; k < npoints; ++k) {
+        mh.setVal(115 + 20.0*k/std::max(npoints-1,1));
+        std::vector<Double_t> vals = cpdf->eval(data);
+        const Double_t *inplace = cpdf->evalInPlace(data);
+        for (int i = 0, j = 0, n = data.numEntries(); i < n; ++i) {
+            obs = *data.get(i);
+            if (data.weight() == 0) continue;
+            double ref = pdf.getVal(&obs);
+            worst = std::max(worst, std::abs(vals[j] - ref));
+            if (inplace) worst = std::max(worst, std::abs(inplace[j] - ref));
+            ++j;
+        }
+    }
+    return worst;
+}
+
+// Largest difference in the bin contents (normalized to 1) with th1fmorph on the pair of templates around each
+// mass, for interpolation and for a moderate extrapolation. th1fmorph differs where its treatment of empty bins
+// kicks in (when the interpolated cumulative distribution has no point within 1.1 bin widths), and it spreads
+// the probability over empty regions between non-empty bins: the templates here have none of those.
+double worstDifferenceTh1fmorph(const char *name, int shape, RooRealVar &x, RooRealVar &mh) {
+    std::vector<double> points; points.push_back(120); points.push_back(125); points.push_back(130);
+    std::vector<TH1F *> hists; TList templates;
+    for (int k = 0; k < 3; ++k) {
+        TH1F *h = new TH1F(Form("%s%d", name, k), "", 50, 100, 200);
+        for (int i = 1; i <= 50; ++i) {
+            double xc = h->GetXaxis()->GetBinCenter(i), sigma = 4 + k, g = std::exp(-0.5*std::pow((xc - points[k])/sigma, 2));
+            switch (shape) {
+                case 0: h->SetBinContent(i, 0.02 + g); break;                                      // smooth
+                case 1: h->SetBinContent(i, std::abs(xc - points[k]) < 2.5*sigma ? g : 0); break; // empty tails
+                case 2: h->SetBinContent(i, 0); break;                                             // empty
+            }
+        }
+        hists.push_back(h); templates.Add(h);
+    }
+    FastHorizontalInterpHistPdf pdf(name, "", x, mh, templates, points);
+    const double masses[] = { 119, 121, 122.5, 124, 126.5, 128, 129.5, 131, 133 };
+    double worst = 0;
+    for (int j = 0; j < 9; ++j) {
+        int k = masses[j] < points[1] ? 0 : 1;
+        mh.setVal(masses[j]);
+        TH1F *morph = th1fmorph("morph", "", hists[k], hists[k+1], points[k], points[k+1], masses[j], 1.0, 0);
+        for (int i = 1; i <= 50; ++i) {
+            x.setVal(morph->GetXaxis()->GetBinCenter(i));
+            worst = std::max(worst, std::abs(pdf.getVal(RooArgSet(x)) * morph->GetBinWidth(i) - morph->GetBinContent(i)));
+        }
+        delete morph;
+    }
+    for (int k = 0; k < 3; ++k) delete hists[k];
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    int npoints = argc > 1 ? atoi(argv[1]) : 41;
+    runtimedef::set("ADDNLL_HISTNLL", 1);
+    RooRealVar x("x", "", 150, 100, 200), mh("MH", "", 125, 110, 140);
+    TRandom3 rnd(37);
+    // gaussian peaks with a flat background, and a gap in the middle one
+    std::vector<double> points; points.push_back(120); points.push_back(125); points.push_back(130);
+    std::vector<TH1F *> hists; TList templates;
+    for (int k = 0; k < 3; ++k) {
+        TH1F *h = new TH1F(Form("m%d", k), "", 50, 100, 200);
+        for (int i = 1; i <= 50; ++i) {
+            double xc = h->GetXaxis()->GetBinCenter(i), sigma = 4 + k;
+            h->SetBinContent(i, 0.02 + std::exp(-0.5*std::pow((xc - points[k])/sigma, 2)) * rnd.Uniform(0.9, 1.1));
+        }
+        if (k == 1) h->SetBinContent(20, 0);
+        hists.push_back(h); templates.Add(h);
+    }
+
+    x.setBins(50);
+    RooDataHist binned("binned", "", RooArgSet(x));
+    for (int i = 0, n = binned.numEntries(); i < n; ++i) binned.set(*binned.get(i), (i % 7 == 3 ? 0 : 1 + i % 5));
+    RooDataSet unbinned("unbinned", "", RooArgSet(x));
+    for (int i = 0; i < 500; ++i) {
+        x.setVal(rnd.Uniform(100, 200));
+        unbinned.add(RooArgSet(x));
+    }
+
+    FastHorizontalInterpHistPdf pdf("pdf", "", x, mh, templates, points);
+    int bad = 0;
+    for (int k = 0; k < 3; ++k) {
+        mh.setVal(points[k]);
+        double worst = 0, norm = hists[k]->Integral();
+        for (int i = 1; i <= 50; ++i) {
+            x.setVal(hists[k]->GetXaxis()->GetBinCenter(i));
+            worst = std::max(worst, std::abs(pdf.getVal(RooArgSet(x)) * hists[k]->GetBinWidth(i) - hists[k]->GetBinContent(i)/norm));
+        }
+        bool good = worst < 1e-12;
+        printf("template %d        max difference %g %s\n", k, worst, good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+    double worst[2] = { worstDifference(pdf, x, binned, mh, npoints), worstDifference(pdf, x, unbinned, mh, npoints) };
+    const char *names[2] = { "binned", "unbinned" };
+    for (int i = 0; i < 2; ++i) {
+        bool good = worst[i] < 1e-12;
+        printf("cached %-9s  max difference %g %s\n", names[i], worst[i], good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+
+    const char *shapes[3] = { "smooth", "empty tails", "empty" };
+    for (int shape = 0; shape < 3; ++shape) {
+        double worst = worstDifferenceTh1fmorph(Form("shape%d_", shape), shape, x, mh);
+        bool good = worst < 1e-6;
+        printf("th1fmorph %-12s max difference %g %s\n", shapes[shape], worst, good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+
+    TStopwatch timer; timer.Start();
+    for (int k = 0; k < 100*npoints; ++k) {
+        mh.setVal(120 + 5.0*k/(100*npoints));
+        x.setVal(150); pdf.getVal(RooArgSet(x));
+    }
+    double tfast = timer.RealTime(); timer.Start();
+    for (int k = 0; k < 100*npoints; ++k) {
+        delete th1fmorph("morph", "", hists[0], hists[1], 120, 125, 120 + 5.0*k/(100*npoints), 1.0, 0);
+    }
+    double tmorph = timer.RealTime();
+    printf("%d morphs: %.3f s, with th1fmorph %.3f s\n", 100*npoints, tfast, tmorph);
+    return bad ? 2 : 0;
+}
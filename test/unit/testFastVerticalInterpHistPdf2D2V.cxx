@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <TH2F.h>
+#include <TList.h>
+#include <TRandom3.h>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include <RooDataSet.h>
+#include <RooDataHist.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+// Check of the cached values of FastVerticalInterpHistPdf2D2 (through FastVerticalInterpHistPdf2D2V)
+// against pdf->getVal(x,y), for the conditional and the plain pdf, on binned and unbinned data.
+// Usage: testFastVerticalInterpHistPdf2D2V.exe [points]
+
+double worstDifference(const FastVerticalInterpHistPdf2D2 &pdf, RooRealVar &x, RooRealVar &y, const RooAbsData &data, RooRealVar &theta, int npoints) {
+    RooArgSet obs(x, y);
+    std::auto_ptr<cacheutils::CachingPdfBase> cpdf(cacheutils::makeCachingPdf(const_cast<FastVerticalInterpHistPdf2D2 *>(&pdf), &obs));
+    double worst = 0;
+    for (int k = 0; k < npoints; ++k) {
+        theta.setVal(-2 + 4.0*k/std::max(npoints-1,1));
+        std::vector<Double_t> vals = cpdf->eval(data);
+        const Double_t *inplace = cpdf->evalInPlace(data);
+        for (int i = 0, j = 0, n = data.numEntries(); i < n; ++i) {
+            obs = *data.get(i);
+            if (data.weight() == 0) continue;
+            double ref = pdf.getVal(&obs);
+            worst = std::max(worst, std::abs(vals[j] - ref));
+            if (inplace) worst = std::max(worst, std::abs(inplace[j] - ref));
+            ++j;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    int npoints = argc > 1 ? atoi(argv[1]) : 9;
+    runtimedef::set("ADDNLL_HISTNLL", 1);
+    RooRealVar x("x", "", 0, 0, 10), y("y", "", 0, -1, 1), theta("theta", "", 0, -5, 5);
+    TH2F nominal("nominal", "", 20, 0, 10, 8, -1, 1), hi("hi", "", 20, 0, 10, 8, -1, 1), lo("lo", "", 20, 0, 10, 8, -1, 1);
+    TRandom3 rnd(37);
+    for (int ix = 1; ix <= 20; ++ix) {
+        for (int iy = 1; iy <= 8; ++iy) {
+            double v = 1 + rnd.Uniform(0, 2);
+            nominal.SetBinContent(ix, iy, v);
+            hi.SetBinContent(ix, iy, v * rnd.Uniform(0.8, 1.3));
+            lo.SetBinContent(ix, iy, v * rnd.Uniform(0.7, 1.2));
+        }
+    }
+    TList templates; templates.Add(&nominal); templates.Add(&hi); templates.Add(&lo);
+    RooArgList coefs(theta);
+
+    x.setBins(20); y.setBins(8);
+    RooDataHist binned("binned", "", RooArgSet(x, y));
+    for (int i = 0, n = binned.numEntries(); i < n; ++i) binned.set(*binned.get(i), (i % 7 == 3 ? 0 : 1 + i % 5));
+    RooDataSet unbinned("unbinned", "", RooArgSet(x, y));
+    for (int i = 0; i < 500; ++i) {
+        x.setVal(rnd.Uniform(0, 10)); y.setVal(rnd.Uniform(-1, 1));
+        unbinned.add(RooArgSet(x, y));
+    }
+
+    int bad = 0;
+    for (int conditional = 0; conditional <= 1; ++conditional) {
+        FastVerticalInterpHistPdf2D2 pdf("pdf", "", x, y, conditional, templates, coefs, 1., 1);
+        double worst[2] = { worstDifference(pdf, x, y, binned, theta, npoints), worstDifference(pdf, x, y, unbinned, theta, npoints) };
+        const char *names[2] = { "binned", "unbinned" };
+        for (int i = 0; i < 2; ++i) {
+            bool good = worst[i] < 1e-12;
+            printf("%-12s %-9s max difference %g %s\n", (conditional ? "conditional" : "plain"), names[i], worst[i], good ? "" : "  FAIL");
+            if (!good) bad++;
+        }
+    }
+    return bad ? 2 : 0;
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "FastVerticalInterpHistPdf2Fixture.h"
+
+// Check of saving FastVerticalInterpHistPdf2 with VERTINTERP_FLOAT_MORPHS=1, when the morphs are kept only
+// in single precision: after a first evaluation the pdf is saved in a workspace and read back, and along a scan
+// of the morphing parameters the pdf read back, and the copy in the workspace after it was written, must give the
+// same values as the original one before (the morphs are written rounded to single precision, so nothing changes).
+// Usage: testFastVerticalInterpHistPdf2FloatMorphs.exe [steps]
+
+int main(int argc, char **argv) {
+    int nsteps = argc > 1 ? atoi(argv[1]) : 100;
+    runtimedef::set("VERTINTERP_FLOAT_MORPHS", 1);
+    const int nbins = 60, nmorphs = 6;
+    FastVerticalInterpHistPdf2Fixture fixture(nbins, nmorphs, 0.1);
+    RooRealVar &x = fixture.x;
+    TRandom3 &rnd = fixture.rnd;
+    const TList &templates = fixture.templates;
+    const RooArgList &coefs = fixture.coefs;
+
+    int bad = 0;
+    RooArgSet obs(x);
+    for (int algo = 1; algo >= -1; algo -= 2) {
+        FastVerticalInterpHistPdf2 pdf("pdf", "", x, templates, coefs, 1., algo);
+        std::vector<std::vector<double> > thetaVals(nsteps, std::vector<double>(nmorphs)), before(nsteps, std::vector<double>(nbins));
+        for (int step = 0; step < nsteps; ++step) {
+            for (int k = 0; k < nmorphs; ++k) fixture.theta(k).setVal(thetaVals[step][k] = rnd.Uniform(-3, 3));
+            for (int i = 0; i < nbins; ++i) {
+                x.setVal((i + 0.5) * 10. / nbins);
+                before[step][i] = pdf.getVal(&obs);
+            }
+        }
+
+        // the copy in the workspace has the compacted morphs of the original
+        RooWorkspace w("w");
+        w.import(pdf);
+        std::unique_ptr<RooWorkspace> wread = writeAndReadWorkspace(w, "testFastVerticalInterpHistPdf2FloatMorphs.root");
+        FastVerticalInterpHistPdf2 *read = (FastVerticalInterpHistPdf2 *) wread->pdf("pdf");
+        RooRealVar *xread = wread->var("x");
+        RooArgSet obsread(*xread), obscopy(*w.var("x"));
+
+        double worst[2] = { 0, 0 };
+        for (int step = 0; step < nsteps; ++step) {
+            for (int k = 0; k < nmorphs; ++k) {
+                wread->var(Form("theta%d", k))->setVal(thetaVals[step][k]);
+                w.var(Form("theta%d", k))->setVal(thetaVals[step][k]);
+            }
+            double norm = *std::max_element(before[step].begin(), before[step].end());
+            for (int i = 0; i < nbins; ++i) {
+                xread->setVal((i + 0.5) * 10. / nbins); w.var("x")->setVal(xread->getVal());
+                worst[0] = std::max(worst[0], std::abs(read->getVal(&obsread) - before[step][i]) / norm);
+                worst[1] = std::max(worst[1], std::abs(w.pdf("pdf")->getVal(&obscopy) - before[step][i]) / norm);
+            }
+        }
+        const char *names[2] = { "read back", "after write" };
+        for (int j = 0; j < 2; ++j) {
+            bool good = worst[j] < 1e-14;
+            printf("%-14s %-11s max relative difference %g over %d steps %s\n", algo > 0 ? "additive" : "multiplicative", names[j], worst[j], nsteps, good ? "" : "  FAIL");
+            if (!good) bad++;
+        }
+    }
+    return bad ? 2 : 0;
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "FastVerticalInterpHistPdf2Fixture.h"
+
+// Check of the incremental updates of FastVerticalInterpHistPdf2 (VERTINTERP_RESYNC=N) against a full rebuild
+// from nominal (a fresh copy of the pdf, which has no sum of the morphs to start from), along a random walk of
+// the morphing parameters moving one at a time as in a minimization, for additive and multiplicative morphing.
+// The difference must stay below 1e-10 of the largest bin.
+// Usage: testFastVerticalInterpHistPdf2Resync.exe [steps] [N]
+
+int main(int argc, char **argv) {
+    int nsteps = argc > 1 ? atoi(argv[1]) : 500;
+    runtimedef::set("VERTINTERP_RESYNC", argc > 2 ? atoi(argv[2]) : 100);
+    const int nbins = 40, nmorphs = 8;
+    FastVerticalInterpHistPdf2Fixture fixture(nbins, nmorphs, 0.2);
+    RooRealVar &x = fixture.x;
+    TRandom3 &rnd = fixture.rnd;
+    const TList &templates = fixture.templates;
+    const RooArgList &coefs = fixture.coefs;
+
+    int bad = 0;
+    for (int algo = 1; algo >= -1; algo -= 2) {
+        FastVerticalInterpHistPdf2 pdf("pdf", "", x, templates, coefs, 1., algo);
+        RooArgSet obs(x);
+        double worst = 0;
+        for (int step = 0; step < nsteps; ++step) {
+            RooRealVar &theta = fixture.theta(rnd.Integer(nmorphs));
+            // mostly small moves, sometimes back to the previous value or a big jump
+            double old = theta.getVal(), r = rnd.Uniform();
+            theta.setVal(r < 0.1 ? rnd.Uniform(-3, 3) : old + rnd.Gaus(0, 0.01));
+            if (r > 0.9) { pdf.getVal(&obs); theta.setVal(old); }
+            FastVerticalInterpHistPdf2 fresh(pdf, "fresh");
+            std::vector<double> incremental(nbins), full(nbins);
+            for (int i = 0; i < nbins; ++i) {
+                x.setVal((i + 0.5) * 10. / nbins);
+                incremental[i] = pdf.getVal(&obs);
+                full[i] = fresh.getVal(&obs);
+            }
+            double norm = *std::max_element(full.begin(), full.end());
+            for (int i = 0; i < nbins; ++i) worst = std::max(worst, std::abs(incremental[i] - full[i]) / norm);
+        }
+        bool good = worst < 1e-10;
+        printf("%-14s max relative difference %g over %d steps %s\n", algo > 0 ? "additive" : "multiplicative", worst, nsteps, good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+    return bad ? 2 : 0;
+}
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "FastVerticalInterpHistPdf2Fixture.h"
+
+// Check of the sparse morphs of FastVerticalInterpHistPdf2: a pdf with some morphs that change only a few bins
+// must give the same values and derivatives as the same pdf with all the morphs dense (VERTINTERP_DENSE_MORPHS=1),
+// along a scan of the morphing parameters, for additive and multiplicative morphing. The morphs are written
+// dense, so the sparse pdf must also give the same after it was saved in a workspace and read back.
+// Usage: testFastVerticalInterpHistPdf2Sparse.exe [steps]
+
+int main(int argc, char **argv) {
+    int nsteps = argc > 1 ? atoi(argv[1]) : 200;
+    const int nbins = 60, nmorphs = 6;
+    FastVerticalInterpHistPdf2Fixture fixture(nbins, nmorphs, 0.1);
+    RooRealVar &x = fixture.x;
+    TRandom3 &rnd = fixture.rnd;
+    const TList &templates = fixture.templates;
+    const RooArgList &coefs = fixture.coefs;
+
+    int bad = 0;
+    RooArgSet obs(x);
+    for (int algo = 1; algo >= -1; algo -= 2) {
+        FastVerticalInterpHistPdf2 sparse("sparse", "", x, templates, coefs, 1., algo);
+        FastVerticalInterpHistPdf2 dense(sparse, "dense");
+        // the morphs are compacted at the first evaluation
+        runtimedef::set("VERTINTERP_DENSE_MORPHS", 1);
+        dense.getVal(&obs);
+        runtimedef::set("VERTINTERP_DENSE_MORPHS", 0);
+        sparse.getVal(&obs);
+
+        RooWorkspace w("w");
+        w.import(sparse);
+        std::unique_ptr<RooWorkspace> wread = writeAndReadWorkspace(w, "testFastVerticalInterpHistPdf2Sparse.root");
+        FastVerticalInterpHistPdf2 *read = (FastVerticalInterpHistPdf2 *) wread->pdf("sparse");
+        RooRealVar *xread = wread->var("x");
+        RooArgSet obsread(*xread);
+
+        double worst[3] = { 0, 0, 0 };
+        std::vector<Double_t> dsparse, ddense;
+        for (int step = 0; step < nsteps; ++step) {
+            for (int k = 0; k < nmorphs; ++k) {
+                double val = rnd.Uniform(-3, 3);
+                fixture.theta(k).setVal(val);
+                wread->var(Form("theta%d", k))->setVal(val);
+            }
+            std::vector<double> vsparse(nbins), vdense(nbins), vread(nbins);
+            for (int i = 0; i < nbins; ++i) {
+                x.setVal((i + 0.5) * 10. / nbins); xread->setVal(x.getVal());
+                vsparse[i] = sparse.getVal(&obs);
+                vdense[i] = dense.getVal(&obs);
+                vread[i] = read->getVal(&obsread);
+            }
+            double norm = *std::max_element(vdense.begin(), vdense.end());
+            for (int i = 0; i < nbins; ++i) {
+                worst[0] = std::max(worst[0], std::abs(vsparse[i] - vdense[i]) / norm);
+                worst[2] = std::max(worst[2], std::abs(vread[i] - vdense[i]) / norm);
+            }
+            for (int k = 0; k < nmorphs; ++k) {
+                if (!sparse.derivative(fixture.theta(k), dsparse) || !dense.derivative(fixture.theta(k), ddense)) { worst[1] = 1; continue; }
+                for (int i = 0; i < nbins; ++i) worst[1] = std::max(worst[1], std::abs(dsparse[i] - ddense[i]) / norm);
+            }
+        }
+        const char *names[3] = { "values", "derivatives", "read back" };
+        for (int j = 0; j < 3; ++j) {
+            bool good = worst[j] < 1e-14;
+            printf("%-14s %-11s max relative difference %g over %d steps %s\n", algo > 0 ? "additive" : "multiplicative", names[j], worst[j], nsteps, good ? "" : "  FAIL");
+            if (!good) bad++;
+        }
+    }
+    return bad ? 2 : 0;
+}
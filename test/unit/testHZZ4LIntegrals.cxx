@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include <RooNumIntConfig.h>
+#include <RooGlobalFunc.h>
+#include "HiggsAnalysis/CombinedLimit/interface/HZZ4LRooPdfs.h"
+
+// Check of the normalization integrals of the HZZ4L mass shapes: the numerical ones against RooFit's own numerical
+// integration (adaptive Gauss-Kronrod, to a relative precision of 1e-10), for a few values of one parameter
+// and back to the first one (so that a stale value from the cache would show up), and the closed forms of
+// RooRelBWUFParamWidth and RooRelBWHighMass against reference values.
+// Usage: testHZZ4LIntegrals.exe
+
+// relative difference between the integral of pdf over x that it computes itself and the one from RooFit
+double numericDifference(RooAbsPdf &pdf, RooRealVar &x, const RooNumIntConfig &cfg) {
+    std::unique_ptr<RooAbsReal> mine(pdf.createIntegral(RooArgSet(x)));
+    double val = mine->getVal();
+    pdf.forceNumInt(kTRUE);
+    std::unique_ptr<RooAbsReal> ref(pdf.createIntegral(RooArgSet(x), RooFit::NumIntConfig(cfg)));
+    double refVal = ref->getVal();
+    pdf.forceNumInt(kFALSE);
+    return std::abs(val - refVal)/std::abs(refVal);
+}
+
+// integral of pdf over [xmin, xmax], relative to the reference value
+double closedFormDifference(RooAbsPdf &pdf, RooRealVar &x, double xmin, double xmax, double reference) {
+    x.setRange(xmin, xmax);
+    std::unique_ptr<RooAbsReal> integral(pdf.createIntegral(RooArgSet(x)));
+    return std::abs(integral->getVal() - reference)/reference;
+}
+
+int main() {
+    RooNumIntConfig cfg(*RooAbsReal::defaultIntegratorConfig());
+    cfg.method1D().setLabel("RooAdaptiveGaussKronrodIntegrator1D");
+    cfg.setEpsRel(1e-10);
+    cfg.setEpsAbs(0);
+
+    RooRealVar m4l("m4l", "", 200, 100, 800);
+    RooRealVar a1("a1", "", 110, 0, 1000), a2("a2", "", 10, 0, 1000), a3("a3", "", 50, 0, 1000), b1("b1", "", 180, 0, 1000), b2("b2", "", 20, 0, 1000), b3("b3", "", 100, 0, 1000), frac("frac", "", 0.3, 0, 1);
+    RooqqZZPdf qqZZ("qqZZ", "", m4l, a1, a2, a3, b1, b2, b3, frac);
+    RooggZZPdf ggZZ("ggZZ", "", m4l, a1, a2, a3, b1, b2, b3, frac);
+
+    RooRealVar c0("c0", "", 110, 0, 1000), c1("c1", "", 10, 0, 1000), c2("c2", "", 40, 0, 1000), c3("c3", "", 1, 0, 10), c4("c4", "", 180, 0, 1000), c5("c5", "", 20, 0, 1000), c6("c6", "", 100, 0, 1000);
+    RooRealVar c7("c7", "", 0.5, 0, 10), c8("c8", "", 300, 0, 1000), c9("c9", "", 0.2, 0, 10), c10("c10", "", 300, 0, 1000), c11("c11", "", 30, 0, 1000), c12("c12", "", 200, 0, 1000), c13("c13", "", 0.1, 0, 10);
+    RooqqZZPdf_v2 qqZZv2("qqZZv2", "", m4l, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10, c11, c12, c13);
+    RooggZZPdf_v2 ggZZv2("ggZZv2", "", m4l, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9);
+
+    // a heavy Higgs boson, so that the peak is wide enough for RooFit's integration
+    RooRealVar mUF("mUF", "", 400, 300, 600), mH("mH", "", 400, 110, 1000), scale("scale", "", 1, 0.1, 10);
+    RooRelBWUF relBWUF("relBWUF", "", mUF, mH);
+    RooRelBWUF_SM4 relBWUF_SM4("relBWUF_SM4", "", mUF, mH);
+    RooRelBWUFParam relBWUFParam("relBWUFParam", "", mUF, mH, scale);
+
+    RooRealVar mBW("mBW", "", 200, 150, 250), mean("mean", "", 200, 150, 250), gamma("gamma", "", 5, 0.1, 50);
+    RooRelBW1 relBW1("relBW1", "", mBW, mean, gamma);
+
+    RooRealVar pt("pt", "", 50, 20, 600), tm("tm", "", 0.2, 0, 10), tn("tn", "", 5, 1, 20), tn2("tn2", "", 1, 0, 5), bb("bb", "", 0.02, 0, 1), bb2("bb2", "", 0.01, 0, 1), T("T", "", 20, 1, 100), fexp("fexp", "", 0.1, 0, 1);
+    RooTsallis tsallis("tsallis", "", pt, tm, tn, tn2, bb, bb2, T, fexp);
+
+    RooRealVar mPW("mPW", "", 125, 100, 150), mHPW("mHPW", "", 125, 100, 150), width("width", "", 2, 0.1, 10);
+    RooRelBWUFParamWidth paramWidth("paramWidth", "", mPW, mHPW, width);
+
+    RooRealVar mHM("mHM", "", 600, 400, 900), mHHM("mHHM", "", 600, 50, 1000), gammaHM("gammaHM", "", 100, 1, 1000);
+    RooRelBWHighMass highMass("highMass", "", mHM, mHHM, gammaHM);
+
+    struct Check { const char *name; RooAbsPdf *pdf; RooRealVar *x; RooRealVar *par; double step; };
+    Check checks[] = {
+        { "RooqqZZPdf",           &qqZZ,         &m4l, &a1,      5    },
+        { "RooggZZPdf",           &ggZZ,         &m4l, &b3,      10   },
+        { "RooqqZZPdf_v2",        &qqZZv2,       &m4l, &c0,      5    },
+        { "RooggZZPdf_v2",        &ggZZv2,       &m4l, &c4,      5    },
+        { "RooRelBWUF",           &relBWUF,      &mUF, &mH,      10   },
+        { "RooRelBWUF_SM4",       &relBWUF_SM4,  &mUF, &mH,      10   },
+        { "RooRelBWUFParam",      &relBWUFParam, &mUF, &scale,   0.2  },
+        { "RooRelBW1",            &relBW1,       &mBW, &gamma,   1    },
+        { "RooTsallis",           &tsallis,      &pt,  &T,       2    },
+        { "RooRelBWUFParamWidth", &paramWidth,   &mPW, &width,   0.5  },
+        { "RooRelBWHighMass",     &highMass,     &mHM, &gammaHM, 20   }
+    };
+    int bad = 0;
+    for (unsigned int i = 0; i < sizeof(checks)/sizeof(checks[0]); ++i) {
+        Check &c = checks[i];
+        double p0 = c.par->getVal(), shifts[4] = { 0, c.step, -c.step, 0 }, worst = 0;
+        for (int k = 0; k < 4; ++k) {
+            c.par->setVal(p0 + shifts[k]);
+            worst = std::max(worst, numericDifference(*c.pdf, *c.x, cfg));
+        }
+        c.par->setVal(p0);
+        bool good = worst < 1e-6;
+        printf("%-24s max relative difference with RooFit %g %s\n", c.name, worst, good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+
+    // reference values from a 20-point Gauss-Legendre rule on 4000 intervals, converged to better than 1e-14
+    struct Point { const char *name; RooAbsPdf *pdf; RooRealVar *x; RooRealVar *p1, *p2; double v1, v2, xmin, xmax, reference; };
+    Point points[] = {
+        { "RooRelBWUFParamWidth (peak)",     &paramWidth, &mPW, &mHPW, &width,   125, 2,   100, 150, 3.06163527934321e+00 },
+        { "RooRelBWUFParamWidth (tail)",     &paramWidth, &mPW, &mHPW, &width,   125, 2,   130, 180, 1.79215744776903e-01 },
+        { "RooRelBWHighMass (atan)",         &highMass,   &mHM, &mHHM, &gammaHM, 600, 100, 400, 900, 2.26906818832230e-05 },
+        { "RooRelBWHighMass (log)",          &highMass,   &mHM, &mHHM, &gammaHM, 100, 250, 50,  500, 2.66879531897489e-05 },
+        { "RooRelBWHighMass (1/u)",          &highMass,   &mHM, &mHHM, &gammaHM, 100, 200, 50,  500, 3.80769230769231e-05 }
+    };
+    for (unsigned int i = 0; i < sizeof(points)/sizeof(points[0]); ++i) {
+        Point &p = points[i];
+        p.p1->setVal(p.v1); p.p2->setVal(p.v2);
+        double diff = closedFormDifference(*p.pdf, *p.x, p.xmin, p.xmax, p.reference);
+        bool good = diff < 1e-12;
+        printf("%-32s relative difference %g %s\n", p.name, diff, good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+    return bad ? 2 : 0;
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <TFile.h>
+#include <TStopwatch.h>
+#include <RooWorkspace.h>
+#include <RooRealVar.h>
+#include <RooAbsData.h>
+#include <RooSimultaneous.h>
+#include <RooRandom.h>
+#include <RooStats/ModelConfig.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+// Check of the batched evaluation of CachingSimNLL against getVal() at each point
+// Usage: testSimNLLBatch.exe workspace.root [points] [ws] [data] [ModelConfig]
+// It evaluates the NLL at a batch of points moving one parameter at a time (as for a
+// finite-difference gradient), and at a batch of points moving all the parameters, and
+// checks that the results are bit-by-bit identical to those of getVal(). The time taken
+// by the two methods is also reported.
+
+RooWorkspace *w;
+
+int runCheck(cacheutils::CachingSimNLL &nll, const std::vector<RooRealVar *> &vars, const std::vector<double> &points, const char *what) {
+    unsigned int np = vars.size(), npoints = points.size() / np;
+    std::vector<double> batch(npoints), single(npoints), x0(np);
+    for (unsigned int j = 0; j < np; ++j) x0[j] = vars[j]->getVal();
+    TStopwatch timer;
+    nll.getVal();
+    timer.Start(); 
+    nll.evaluateBatch(vars, &points[0], npoints, &batch[0]); 
+    double timeBatch = timer.RealTime();
+    timer.Start(); 
+    for (unsigned int k = 0; k < npoints; ++k) {
+        for (unsigned int j = 0; j < np; ++j) vars[j]->setVal(points[k*np+j]);
+        single[k] = nll.getVal();
+    }
+    double timeSingle = timer.RealTime();
+    for (unsigned int j = 0; j < np; ++j) vars[j]->setVal(x0[j]);
+    int bad = 0;
+    for (unsigned int k = 0; k < npoints; ++k) {
+        if (batch[k] != single[k]) { bad++; printf("point %d: batch %.12g single %.12g  FAIL\n", k, batch[k], single[k]); }
+    }
+    printf("%-24s %d points: %s (%d mismatches); time batch %.6f s, one by one %.6f s\n", what, npoints, bad ? "FAIL" : "OK", bad, timeBatch, timeSingle);
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " workspace.root [points] [ws] [data] [ModelConfig]" << std::endl;
+        return 1;
+    }
+    TFile *f = TFile::Open(argv[1]); if (f == 0) return 2;
+    w = (RooWorkspace *) f->Get(argc >= 4 ? argv[3] : "w"); if (w == 0) return 2;
+    RooAbsData *data = w->data(argc >= 5 ? argv[4] : "data_obs"); if (data == 0) return 2;
+    RooStats::ModelConfig *mc = (RooStats::ModelConfig *) w->genobj(argc >= 6 ? argv[5] : "ModelConfig"); if (mc == 0) return 2;
+    int npoints = argc >= 3 ? atoi(argv[2]) : 20;
+    runtimedef::set("ADDNLL_RECURSIVE", 1);
+    runtimedef::set("ADDNLL_GAUSSNLL", 1);
+    runtimedef::set("ADDNLL_HISTNLL", 1);
+    runtimedef::set("ADDNLL_BINNED_FASTPATH", 1);
+
+    RooSimultaneous *pdf = (RooSimultaneous *) mc->GetPdf();
+    RooArgSet nuis(*mc->GetNuisanceParameters());
+    RooArgList params(*pdf->getParameters(*data));
+    cacheutils::CachingSimNLL nll(pdf, data, &nuis);
+    std::vector<RooRealVar *> vars;
+    for (int i = 0, n = params.getSize(); i < n; ++i) {
+        RooRealVar *v = dynamic_cast<RooRealVar *>(params.at(i));
+        if (v && !v->isConstant()) vars.push_back(v);
+    }
+    unsigned int np = vars.size();
+    if (np == 0) return 0;
+    RooRandom::randomGenerator()->SetSeed(42);
+
+    // one parameter at a time, up and down
+    std::vector<double> points;
+    for (unsigned int j = 0; j < np; ++j) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            for (unsigned int i = 0; i < np; ++i) points.push_back(vars[i]->getVal() + (i == j ? sign * 0.01 : 0.0));
+        }
+    }
+    int bad = runCheck(nll, vars, points, "one parameter at a time");
+
+    // all parameters together
+    points.clear();
+    for (int k = 0; k < npoints; ++k) {
+        for (unsigned int i = 0; i < np; ++i) points.push_back(vars[i]->getVal() + 0.2*RooRandom::randomGenerator()->Gaus());
+    }
+    bad += runCheck(nll, vars, points, "all parameters");
+    return bad ? 3 : 0;
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <TFile.h>
+#include <TStopwatch.h>
+#include <RooWorkspace.h>
+#include <RooRealVar.h>
+#include <RooAbsData.h>
+#include <RooSimultaneous.h>
+#include <RooRandom.h>
+#include <RooStats/ModelConfig.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+// Check of the gradient of CachingSimNLL against plain finite differences of the NLL
+// Usage: testSimNLLGradient.exe workspace.root [points] [ws] [data] [ModelConfig]
+// At a few random points, it compares each component of CachingSimNLL::gradient with a
+// central finite difference of getVal(), and reports the time for the two computations.
+
+RooWorkspace *w;
+
+double numericDerivative(cacheutils::CachingSimNLL &nll, RooRealVar &v) {
+    double x0 = v.getVal(), h = 1e-4 * (v.getError() > 0 ? v.getError() : std::max(1.0, std::abs(x0)));
+    v.setVal(x0 + h); double xp = v.getVal(), fp = nll.getVal();
+    v.setVal(x0 - h); double xm = v.getVal(), fm = nll.getVal();
+    v.setVal(x0);
+    return (fp - fm)/(xp - xm);
+}
+
+void runCheck(RooStats::ModelConfig &mc, RooAbsData *data, int npoints) {
+    RooSimultaneous *pdf = (RooSimultaneous *) mc.GetPdf();
+    RooArgSet nuis(*mc.GetNuisanceParameters());
+    RooArgList params(*pdf->getParameters(*data));
+    RooArgSet snap; params.snapshot(snap);
+    cacheutils::CachingSimNLL nll(pdf, data, &nuis);
+    if (!nll.supportsGradient()) { printf("NLL does not support the analytic gradient\n"); return; }
+    std::vector<RooRealVar *> vars;
+    for (int i = 0, n = params.getSize(); i < n; ++i) {
+        RooRealVar *v = dynamic_cast<RooRealVar *>(params.at(i));
+        if (v && !v->isConstant()) vars.push_back(v);
+    }
+    std::vector<double> grad(vars.size());
+    RooRandom::randomGenerator()->SetSeed(42);
+    TStopwatch timer; double timeAnalytic = 0, timeNumeric = 0;
+    int bad = 0;
+    for (int ip = 0; ip < npoints; ++ip) {
+        params = snap;
+        if (ip > 0) for (unsigned int i = 0; i < vars.size(); ++i) vars[i]->setVal(vars[i]->getVal() + 0.2*RooRandom::randomGenerator()->Gaus());
+        nll.getVal();
+        timer.Start(); nll.gradient(vars, &grad[0]); timeAnalytic += timer.RealTime();
+        for (unsigned int i = 0; i < vars.size(); ++i) {
+            timer.Start(); double num = numericDerivative(nll, *vars[i]); timeNumeric += timer.RealTime();
+            bool ok = std::abs(grad[i] - num) <= 1e-3 * std::max(1.0, std::abs(num));
+            if (!ok) { bad++; printf("point %d, %-30s gradient %12.6g numeric %12.6g  FAIL\n", ip, vars[i]->GetName(), grad[i], num); }
+        }
+    }
+    printf("%d parameters, %d points: %s (%d mismatches); time analytic %.6f s, numeric %.6f s\n",
+            int(vars.size()), npoints, bad ? "FAIL" : "OK", bad, timeAnalytic, timeNumeric);
+    params = snap;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " workspace.root [points] [ws] [data] [ModelConfig]" << std::endl;
+        return 1;
+    }
+    TFile *f = TFile::Open(argv[1]); if (f == 0) return 2;
+    w = (RooWorkspace *) f->Get(argc >= 4 ? argv[3] : "w"); if (w == 0) return 2;
+    RooAbsData *data = w->data(argc >= 5 ? argv[4] : "data_obs"); if (data == 0) return 2;
+    RooStats::ModelConfig *mc = (RooStats::ModelConfig *) w->genobj(argc >= 6 ? argv[5] : "ModelConfig"); if (mc == 0) return 2;
+    runtimedef::set("ADDNLL_RECURSIVE", 1);
+    runtimedef::set("ADDNLL_GAUSSNLL", 1);
+    runtimedef::set("ADDNLL_HISTNLL", 1);
+    runCheck(*mc, data, argc >= 3 ? atoi(argv[2]) : 5);
+    return 0;
+}
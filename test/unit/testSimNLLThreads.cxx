@@ -0,0 +1,69 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <TFile.h>
+#include <TStopwatch.h>
+#include <RooWorkspace.h>
+#include <RooRealVar.h>
+#include <RooAbsData.h>
+#include <RooSimultaneous.h>
+#include <RooRandom.h>
+#include <RooStats/ModelConfig.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+// Scaling benchmark for the multi-threaded evaluation of CachingSimNLL
+// Usage: testSimNLLThreads.exe workspace.root [evals] [maxThreads] [ws] [data] [ModelConfig]
+// For each number of threads 1, 2, 4, ... maxThreads it evaluates the NLL at the same
+// sequence of random points, and reports the time per evaluation and whether the values
+// are bit-by-bit identical to the single-threaded ones.
+
+RooWorkspace *w;
+
+void runScaling(RooStats::ModelConfig &mc, RooAbsData *data, int nevals, int maxThreads) {
+    RooSimultaneous *pdf = (RooSimultaneous *) mc.GetPdf();
+    RooArgSet nuis(*mc.GetNuisanceParameters());
+    RooArgList params(*pdf->getParameters(*data));
+    RooArgSet snap; params.snapshot(snap);
+    std::vector<double> reference;
+    double refTime = 0;
+    TStopwatch timer;
+    for (int nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+        runtimedef::set("SIMNLL_THREADS", nthreads);
+        params = snap;
+        RooRandom::randomGenerator()->SetSeed(42);
+        cacheutils::CachingSimNLL nll(pdf, data, &nuis);
+        std::vector<double> vals;
+        double time = 0;
+        for (int i = 0; i < nevals; ++i) {
+            RooRealVar *v = (RooRealVar *) params.at(i % params.getSize());
+            if (!v->isConstant()) v->randomize();
+            timer.Start(); vals.push_back(nll.getVal()); time += timer.RealTime();
+        }
+        if (nthreads == 1) { reference = vals; refTime = time; }
+        int mismatches = 0;
+        for (int i = 0, n = vals.size(); i < n; ++i) {
+            if (vals[i] != reference[i]) mismatches++;
+        }
+        printf("threads %2d: %10.6f s/eval, speedup %5.2f, %s (%d mismatches out of %d)\n",
+                nthreads, time/nevals, refTime/time,
+                mismatches ? "FAIL" : "OK", mismatches, nevals);
+    }
+    params = snap;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " workspace.root [evals] [maxThreads] [ws] [data] [ModelConfig]" << std::endl;
+        return 1;
+    }
+    TFile *f = TFile::Open(argv[1]); if (f == 0) return 2;
+    w = (RooWorkspace *) f->Get(argc >= 5 ? argv[4] : "w"); if (w == 0) return 2;
+    RooAbsData *data = w->data(argc >= 6 ? argv[5] : "data_obs"); if (data == 0) return 2;
+    RooStats::ModelConfig *mc = (RooStats::ModelConfig *) w->genobj(argc >= 7 ? argv[6] : "ModelConfig"); if (mc == 0) return 2;
+    runtimedef::set("ADDNLL_RECURSIVE", 1);
+    runtimedef::set("ADDNLL_GAUSSNLL", 1);
+    runtimedef::set("ADDNLL_HISTNLL", 1);
+    runScaling(*mc, data, argc >= 3 ? atoi(argv[2]) : 200, argc >= 4 ? atoi(argv[3]) : 8);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <TStopwatch.h>
+#include <TRandom3.h>
+#include "HiggsAnalysis/CombinedLimit/src/vectorized.h"
+
+// Accuracy test and microbenchmark of the SIMD implementations of the vectorized kernels.
+// Usage: testVectorized.exe [size] [repetitions]
+// Each instruction set supported by this cpu is compared to the scalar reference on arrays
+// of many sizes (to test the tails) and at aligned and unaligned addresses: the results must
+// be identical to the last bit. The time per call of each implementation is also reported.
+
+// difference in units of the last place
+double ulps(double a, double b) {
+    if (a == b || (std::isnan(a) && std::isnan(b))) return 0;
+    if (!std::isfinite(a) || !std::isfinite(b)) return 1e99;
+    double scale = std::max(std::abs(a), std::abs(b));
+    return std::abs(a - b) / (std::nextafter(scale, 2*scale+1) - scale);
+}
+
+double maxUlps(const std::vector<double> &a, const std::vector<double> &b, int offset, int size) {
+    double ret = 0;
+    for (int i = 0; i < size; ++i) ret = std::max(ret, ulps(a[offset+i], b[offset+i]));
+    return ret;
+}
+
+// coefficients for the polynomials
+const double polyCoeffs[6] = { 0.7, -1.3, 0.45, 2.1, -0.08, 0.011 };
+
+struct Buffers {
+    std::vector<double> x, y, w, out, work, work2;
+    Buffers(int n) : x(n), y(n), w(n), out(n), work(n), work2(n) {}
+};
+
+// nll_reduce and nll_reduce_kahan with a given implementation, in steps of at most 'step' elements
+double nll_reduce(const vectorized::Kernels &k, uint32_t size, double *pdfvals, const double *weights, double sumcoeff, double *workingArea, uint32_t step = 0xFFFFFFF8) {
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for (uint32_t i = 0; i < size; i += step) {
+        k.nll_accumulate(std::min(step, size - i), pdfvals + i, weights + i, sumcoeff, workingArea + i, sums);
+    }
+    return vectorized::nll_combine(sums);
+}
+double nll_reduce_kahan(const vectorized::Kernels &k, uint32_t size, double *pdfvals, const double *weights, double sumcoeff, double *workingArea, uint32_t step = 0xFFFFFFF8) {
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 }, compensations[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for (uint32_t i = 0; i < size; i += step) {
+        k.nll_accumulate_kahan(std::min(step, size - i), pdfvals + i, weights + i, sumcoeff, workingArea + i, sums, compensations);
+    }
+    return vectorized::nll_combine_kahan(sums, compensations);
+}
+
+// runs all kernels on the buffers starting at offset, and returns the sum of the nll_reduce results
+double runAll(const vectorized::Kernels &k, Buffers &b, const Buffers &input, int offset, int size, std::vector<Buffers> &results, uint32_t step) {
+    results.clear();
+    b = input; k.mul_add(size, 0.7, &b.x[offset], &b.out[offset]); results.push_back(b);
+    b = input; double nll = nll_reduce(k, size, &b.y[offset], &b.w[offset], 1.3, &b.work[offset], step); results.push_back(b);
+    b = input; nll += nll_reduce_kahan(k, size, &b.y[offset], &b.w[offset], 1.3, &b.work[offset], step); results.push_back(b);
+    b = input; k.gaussians(size, 0.3, 1.7, 2.5, &b.x[offset], &b.out[offset], &b.work[offset], &b.work2[offset]); results.push_back(b);
+    b = input; k.exponentials(size, -0.8, 2.5, &b.x[offset], &b.out[offset], &b.work[offset]); results.push_back(b);
+    b = input; k.powers(size, -1.6, 2.5, &b.y[offset], &b.out[offset], &b.work[offset]); results.push_back(b);
+    b = input; k.polynomials(size, 5, polyCoeffs, &b.x[offset], &b.out[offset]); results.push_back(b);
+    b = input; k.meld(size, 0.37, -0.21, &b.x[offset], &b.y[offset], &b.out[offset]); results.push_back(b);
+    return nll;
+}
+
+int main(int argc, char **argv) {
+    int benchSize = argc > 1 ? atoi(argv[1]) : 1000;
+    int reps = argc > 2 ? atoi(argv[2]) : 10000;
+    const int nkernels = 8;
+    const char *names[nkernels] = { "mul_add", "nll_reduce", "nll_reduce_kahan", "gaussians", "exponentials", "powers", "polynomials", "meld" };
+
+    const int maxSize = 300, pad = 16;
+    Buffers input(maxSize + pad);
+    TRandom3 rnd(37);
+    for (int i = 0; i < maxSize + pad; ++i) {
+        input.x[i] = rnd.Uniform(-10, 10);
+        input.y[i] = rnd.Exp(1.0) + 1e-3;
+        input.w[i] = rnd.Poisson(3.0);
+        input.out[i] = rnd.Gaus();
+    }
+    // put some special values at the edges of the domain
+    input.x[1] = 0; input.x[2] = -0.0; input.y[3] = 1e-300; input.x[4] = 800;
+
+    const vectorized::Kernels &ref = *vectorized::kernels(vectorized::ScalarIsa);
+    bool ok = true;
+    for (int isa = vectorized::SSE4Isa; isa <= vectorized::AVX512Isa; ++isa) {
+        const vectorized::Kernels *k = vectorized::kernels(vectorized::Isa(isa));
+        if (k == 0) continue;
+        double worst[nkernels] = { 0, 0, 0, 0, 0, 0, 0, 0 }, worstNll = 0;
+        Buffers b1(maxSize + pad), b2(maxSize + pad);
+        std::vector<Buffers> r1, r2;
+        for (int offset = 0; offset < 8; ++offset) {
+            for (int size = 0; size <= maxSize; size += (size < 40 ? 1 : 13)) {
+                // the SIMD implementation is also run in steps, which must give the same result
+                double nll1 = runAll(ref, b1, input, offset, size, r1, 0xFFFFFFF8);
+                double nll2 = runAll(*k, b2, input, offset, size, r2, (size % 3 ? 0xFFFFFFF8 : 24));
+                worstNll = std::max(worstNll, std::abs(nll1-nll2)/std::max(1.0, std::abs(nll1)));
+                for (int i = 0; i < nkernels; ++i) {
+                    worst[i] = std::max(worst[i], maxUlps(r1[i].out, r2[i].out, 0, maxSize + pad));
+                    worst[i] = std::max(worst[i], maxUlps(r1[i].y, r2[i].y, 0, maxSize + pad));
+                    worst[i] = std::max(worst[i], maxUlps(r1[i].work, r2[i].work, 0, maxSize + pad));
+                    worst[i] = std::max(worst[i], maxUlps(r1[i].work2, r2[i].work2, 0, maxSize + pad));
+                }
+            }
+        }
+        printf("%-8s vs scalar: nll_reduce relative difference %g\n", k->name, worstNll);
+        for (int i = 0; i < nkernels; ++i) {
+            bool good = (worst[i] == 0);
+            printf("   %-16s max difference %6g ulp %s\n", names[i], worst[i], good ? "" : "   <<<< FAILED");
+            ok = ok && good;
+        }
+        if (worstNll != 0) { printf("   nll_reduce results differ   <<<< FAILED\n"); ok = false; }
+    }
+
+    // benchmark
+    Buffers bench(benchSize);
+    for (int i = 0; i < benchSize; ++i) {
+        bench.x[i] = input.x[i % maxSize]; bench.y[i] = input.y[i % maxSize]; bench.w[i] = input.w[i % maxSize];
+    }
+
+    // accuracy of the sums, with respect to a sum in long double
+    {
+        Buffers b = bench;
+        double nll = vectorized::nll_reduce(benchSize, &b.y[0], &b.w[0], 1.0, &b.work[0]);
+        long double exact = 0; for (int i = 0; i < benchSize; ++i) exact += b.y[i];
+        b = bench;
+        double nllKahan = vectorized::nll_reduce_kahan(benchSize, &b.y[0], &b.w[0], 1.0, &b.work[0]);
+        printf("\nSum of %d terms: error of nll_reduce %g, of nll_reduce_kahan %g\n", benchSize, double(nll - exact), double(nllKahan - exact));
+    }
+    TStopwatch timer;
+    printf("\nTime per call for %d elements, in ns:\n%-10s", benchSize, "");
+    for (int i = 0; i < nkernels; ++i) printf(" %16s", names[i]);
+    printf("\n");
+    for (int isa = vectorized::ScalarIsa; isa <= vectorized::AVX512Isa; ++isa) {
+        const vectorized::Kernels *k = vectorized::kernels(vectorized::Isa(isa));
+        if (k == 0) continue;
+        printf("%-10s", k->name);
+        for (int i = 0; i < nkernels; ++i) {
+            Buffers b = bench;
+            timer.Start();
+            for (int r = 0; r < reps; ++r) {
+                switch (i) {
+                    case 0: k->mul_add(benchSize, 1e-9, &b.x[0], &b.out[0]); break;
+                    case 1: memcpy(&b.y[0], &bench.y[0], benchSize*sizeof(double)); nll_reduce(*k, benchSize, &b.y[0], &b.w[0], 1.0, &b.work[0]); break;
+                    case 2: memcpy(&b.y[0], &bench.y[0], benchSize*sizeof(double)); nll_reduce_kahan(*k, benchSize, &b.y[0], &b.w[0], 1.0, &b.work[0]); break;
+                    case 3: k->gaussians(benchSize, 0.3, 1.7, 2.5, &b.x[0], &b.out[0], &b.work[0], &b.work2[0]); break;
+                    case 4: k->exponentials(benchSize, -0.8, 2.5, &b.x[0], &b.out[0], &b.work[0]); break;
+                    case 5: k->powers(benchSize, -1.6, 2.5, &b.y[0], &b.out[0], &b.work[0]); break;
+                    case 6: k->polynomials(benchSize, 5, polyCoeffs, &b.x[0], &b.out[0]); break;
+                    case 7: k->meld(benchSize, 1e-9, -1e-9, &b.x[0], &b.y[0], &b.out[0]); break;
+                }
+            }
+            timer.Stop();
+            printf(" %16.1f", timer.RealTime() * 1e9 / reps);
+        }
+        printf("\n");
+    }
+    printf("\nUsing %s kernels by default.\n", vectorized::kernels().name);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include <RooDataSet.h>
+#include <RooRandom.h>
+#include "HiggsAnalysis/CombinedLimit/interface/VectorizedCB.h"
+
+// Check of the vectorized crystal balls against pdf->getVal(x) on a dataset covering the core and both tails,
+// for several values of the parameters (including negative alpha for the RooCB).
+// Usage: testVectorizedCB.exe [points]
+
+template<typename PdfT, typename VPdfT>
+double worstDifference(const PdfT &pdf, RooRealVar &x, const RooDataSet &data) {
+    VPdfT vpdf(pdf, data);
+    std::vector<Double_t> out;
+    vpdf.fill(out);
+    RooArgSet nset(x);
+    double worst = 0;
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        x.setVal(data.get(i)->getRealValue(x.GetName()));
+        double ref = pdf.getVal(&nset);
+        worst = std::max(worst, std::abs(out[i] - ref)/ref);
+    }
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    int npoints = argc > 1 ? atoi(argv[1]) : 20;
+    RooRealVar x("x", "", 100, 60, 140), mean("mean", "", 100, 90, 110), width("width", "", 5, 1, 20);
+    RooRealVar alpha1("alpha1", "", 1.5, -3, 3), n1("n1", "", 3, 1.01, 10), alpha2("alpha2", "", 2, 0.5, 3), n2("n2", "", 5, 1.01, 10);
+    RooRealVar theta("theta", "", 0, -0.5, 0.5);
+    RooCB cb("cb", "", x, mean, width, alpha1, n1, theta);
+    RooDoubleCB dcb("dcb", "", x, mean, width, alpha1, n1, alpha2, n2);
+    RooDoubleCrystalBall dcb2("dcb2", "", x, mean, width, alpha1, n1, alpha2, n2);
+
+    RooDataSet data("data", "", RooArgSet(x));
+    for (int i = 0; i < 400; ++i) { x.setVal(60.1 + 0.2*i); data.add(RooArgSet(x)); }
+
+    double worst[3] = { 0, 0, 0 };
+    for (int k = 0; k < npoints; ++k) {
+        mean.setVal(RooRandom::randomGenerator()->Uniform(95, 105));
+        width.setVal(RooRandom::randomGenerator()->Uniform(2, 10));
+        alpha1.setVal(RooRandom::randomGenerator()->Uniform(0.5, 2.5) * (k % 2 ? -1 : 1));
+        n1.setVal(RooRandom::randomGenerator()->Uniform(1.5, 8));
+        alpha2.setVal(RooRandom::randomGenerator()->Uniform(0.5, 2.5));
+        n2.setVal(RooRandom::randomGenerator()->Uniform(1.5, 8));
+        theta.setVal(RooRandom::randomGenerator()->Uniform(-0.3, 0.3));
+        worst[0] = std::max(worst[0], worstDifference<RooCB,VectorizedCB>(cb, x, data));
+        alpha1.setVal(std::abs(alpha1.getVal()));
+        worst[1] = std::max(worst[1], worstDifference<RooDoubleCB,VectorizedDoubleCB>(dcb, x, data));
+        worst[2] = std::max(worst[2], worstDifference<RooDoubleCrystalBall,VectorizedDoubleCrystalBall>(dcb2, x, data));
+    }
+    const char *names[3] = { "RooCB", "RooDoubleCB", "RooDoubleCrystalBall" };
+    int bad = 0;
+    for (int i = 0; i < 3; ++i) {
+        bool good = worst[i] < 1e-12;
+        printf("%-20s max relative difference %g %s\n", names[i], worst[i], good ? "" : "  FAIL");
+        if (!good) bad++;
+    }
+    return bad ? 2 : 0;
+}